@@ -0,0 +1,215 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Chaotic attractors integrated at a control rate. The system is advanced by
+// one 4th-order Runge-Kutta step every kAttractorDecimation samples - split
+// into up to kMaxAttractorSubsteps shorter steps when it would be too long
+// for the system - and the x coordinate is interpolated in-between with a
+// cubic Hermite spline, whose slopes are the derivatives of the system at both
+// ends. The state of the system is thus one control period ahead of the
+// output.
+//
+// Beyond kMaxAttractorSubsteps steps, the system slows down instead of
+// diverging. With one Euler step per sample (NextEuler(), kept as a reference
+// for the tests and benchmarks), the double scroll diverges at the top of the
+// fast range when b is small.
+
+#ifndef STAGES_ATTRACTOR_H_
+#define STAGES_ATTRACTOR_H_
+
+#include "stmlib/stmlib.h"
+#include "stmlib/dsp/dsp.h"
+
+#include "stages/op_counter.h"
+#include "stages/resources.h"
+
+namespace stages {
+
+const int kAttractorDecimation = 8;
+const int kMaxAttractorSubsteps = 4;
+
+// dx/dt = a (y - x), dy/dt = (c - a) x - x z + c y, dz/dt = x y - b z, with
+// a = 42 and c = 28 (Chen's system). b is between 1 and 6.
+struct DoubleScrollSystem {
+  // Longest RK4 step for which the trajectory stays close to the exact one
+  // over a few periods. RK4 diverges above 0.07.
+  static inline float max_step() { return 0.04f; }
+
+  static inline void Derivative(const float* s, float b, float* d) {
+    const float a = 42.0f;
+    const float c = 28.0f;
+    d[0] = a * (s[1] - s[0]);
+    d[1] = (c - a) * s[0] - s[0] * s[2] + c * s[1];
+    d[2] = s[0] * s[1] - b * s[2];
+    COUNT_OPS(OP_FLOAT, 10);
+  }
+};
+
+// dx/dt = sin(y) - b x, dy/dt = sin(z) - b y, dz/dt = sin(x) - b z (Thomas'
+// cyclically symmetric attractor). b is between 0.001 and 0.2.
+struct ThomasSymmetricSystem {
+  // The Jacobian of this system has eigenvalues of modulus less than 2.
+  static inline float max_step() { return 0.5f; }
+
+  static inline void Derivative(const float* s, float b, float* d) {
+    d[0] = Sine(s[1]) - b * s[0];
+    d[1] = Sine(s[2]) - b * s[1];
+    d[2] = Sine(s[0]) - b * s[2];
+    COUNT_OPS(OP_FLOAT, 6);
+  }
+
+ private:
+  static inline float Sine(float x) {
+    float phase = x * 0.159155f;  // Convert radians to phase.
+    // InterpolateWrap can't handle negative phases, and floorf is too slow.
+    phase -= static_cast<float>(static_cast<int32_t>(phase));
+    phase = phase < 0.0f ? phase + 1.0f : phase;
+    COUNT_OPS(OP_FLOAT, 3);
+    COUNT_OP(OP_LUT);
+    return stmlib::Interpolate(lut_sine, phase, 1024.0f);
+  }
+};
+
+template<typename System>
+class Attractor {
+ public:
+  Attractor() { }
+  ~Attractor() { }
+
+  void Init(float x, float y, float z) {
+    s_[0] = x;
+    s_[1] = y;
+    s_[2] = z;
+    // The first call to Next() integrates the first control period.
+    counter_ = kAttractorDecimation;
+    primed_ = false;
+  }
+
+  // Reference integrator: one Euler step of dt per sample.
+  inline float NextEuler(float dt, float b) {
+    float d[3];
+    System::Derivative(s_, b, d);
+    s_[0] += dt * d[0];
+    s_[1] += dt * d[1];
+    s_[2] += dt * d[2];
+    COUNT_OPS(OP_FLOAT, 6);
+    primed_ = false;
+    return s_[0];
+  }
+
+  // dt is the time step per sample, as for NextEuler().
+  inline float Next(float dt, float b) {
+    if (counter_ == kAttractorDecimation) {
+      Advance(dt * static_cast<float>(kAttractorDecimation), b);
+    }
+    ++counter_;
+    const float x = x_;
+    x_ += delta_[0];
+    delta_[0] += delta_[1];
+    delta_[1] += delta_[2];
+    COUNT_OPS(OP_FLOAT, 3);
+    return x;
+  }
+
+  inline const float* state() const { return s_; }
+
+ private:
+  void Advance(float h, float b) {
+    // The derivative is only missing after Init() or NextEuler().
+    if (!primed_) {
+      System::Derivative(s_, b, d_);
+      primed_ = true;
+    }
+    CONSTRAIN(h, 0.0f, System::max_step() * kMaxAttractorSubsteps);
+    const float x0 = s_[0];
+    const float k0 = d_[0] * h;
+
+    int num_steps = 1;
+    while (h > System::max_step() * num_steps) {
+      ++num_steps;
+    }
+    COUNT_OPS(OP_BRANCH, num_steps);
+    const float step = h / static_cast<float>(num_steps);
+    for (int i = 0; i < num_steps; ++i) {
+      Step(step, b);
+    }
+
+    // Hermite polynomial through x0 and x1, with slopes k0 and k1, on [0, 1]:
+    // x0 + k0 t + c2 t^2 + c3 t^3. It is evaluated by forward differences,
+    // with a step of 1 / kAttractorDecimation.
+    const float x1 = s_[0];
+    const float k1 = d_[0] * h;
+    const float u = 1.0f / static_cast<float>(kAttractorDecimation);
+    const float c1 = k0 * u;
+    const float c2 = (3.0f * (x1 - x0) - 2.0f * k0 - k1) * u * u;
+    const float c3 = (2.0f * (x0 - x1) + k0 + k1) * u * u * u;
+    x_ = x0;
+    delta_[0] = c1 + c2 + c3;
+    delta_[1] = 2.0f * c2 + 6.0f * c3;
+    delta_[2] = 6.0f * c3;
+    counter_ = 0;
+    COUNT_OPS(OP_FLOAT, 22);
+  }
+
+  // RK4 step. The derivative at the start of the step is the one at the end
+  // of the previous step, and the derivative at the end of the step is kept
+  // for the next one and for the slope of the spline.
+  inline void Step(float h, float b) {
+    float k2[3], k3[3], k4[3], s[3];
+    const float half_h = 0.5f * h;
+    for (int i = 0; i < 3; ++i) {
+      s[i] = s_[i] + half_h * d_[i];
+    }
+    System::Derivative(s, b, k2);
+    for (int i = 0; i < 3; ++i) {
+      s[i] = s_[i] + half_h * k2[i];
+    }
+    System::Derivative(s, b, k3);
+    for (int i = 0; i < 3; ++i) {
+      s[i] = s_[i] + h * k3[i];
+    }
+    System::Derivative(s, b, k4);
+    const float h_6 = h * (1.0f / 6.0f);
+    for (int i = 0; i < 3; ++i) {
+      s_[i] += h_6 * (d_[i] + 2.0f * (k2[i] + k3[i]) + k4[i]);
+    }
+    System::Derivative(s_, b, d_);
+    COUNT_OPS(OP_FLOAT, 35);
+  }
+
+  float s_[3];
+  float d_[3];
+  float x_;
+  float delta_[3];
+  int counter_;
+  bool primed_;
+
+  DISALLOW_COPY_AND_ASSIGN(Attractor);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_ATTRACTOR_H_
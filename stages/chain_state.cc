@@ -29,12 +29,12 @@
 #include "stages/chain_state.h"
 
 #include <algorithm>
+#include <cstdlib>
 
 #include "stages/quantizer_scales.h"
 #include "stages/drivers/serial_link.h"
 #include "stages/segment_generator.h"
 #include "stages/settings.h"
-#include "stages/ui.h"
 
 namespace stages {
 
@@ -49,6 +49,24 @@ const uint32_t kAdvancedRightKey = stmlib::FourCC<'s', 'g', 'a', 'r'>::value;
 const uint32_t kUnpatchedInputDelay = 2000;
 const int32_t kLongPressDuration = 500;
 
+const uint8_t kChannelUpdatesHeader = 0xc0;
+// Size of each type of update, including the type/channel byte.
+const size_t kChannelUpdateSize[] = { 3, 2, 5 };
+// Bytes of a packet to the left covered by its checksum.
+const size_t kChecksummedSize = kPacketSize - 2;
+
+// Fletcher checksum, modulo 256. Unlike a plain sum, it changes when the
+// bytes are shifted, as they are when a byte has been lost on the link.
+static inline uint16_t PacketChecksum(const uint8_t* bytes) {
+  uint8_t a = 0;
+  uint8_t b = 0;
+  for (size_t i = 0; i < kChecksummedSize; ++i) {
+    a += bytes[i];
+    b += a;
+  }
+  return (b << 8) | a;
+}
+
 void ChainState::Init(SerialLink* left, SerialLink* right, const Settings& settings) {
 
   left_ = left;
@@ -74,6 +92,7 @@ void ChainState::Init(SerialLink* left, SerialLink* right, const Settings& setti
       115200 * 8,
       right_rx_packet_[0].bytes,
       kPacketSize);
+  right_rx_offset_ = 0;
 
   Reinit(settings);
 }
@@ -85,6 +104,8 @@ void ChainState::Reinit(const Settings& settings) {
   ChannelState c = { .flags = 0b11100000, .pot = 128, .cv_slider = 32768 };
 
   fill(&channel_state_[0], &channel_state_[kMaxNumChannels], c);
+  fill(&tx_channel_state_[0], &tx_channel_state_[kMaxNumChannels], c);
+  refresh_channel_ = 0;
   fill(&last_local_config_[0], &last_local_config_[kNumChannels], 0);
   fill(&unpatch_counter_[0], &unpatch_counter_[kNumChannels], 0);
   fill(&loop_status_[0], &loop_status_[kNumChannels], LOOP_STATUS_NONE);
@@ -184,8 +205,42 @@ void ChainState::TransmitRight() {
   right_->Transmit(right_tx_packet_);
 }
 
+// The RX DMA channel writes the bytes received from the right in a ring of
+// two packets, and flags each half as it is filled. Once a byte has been lost,
+// packets no longer start at the beginning of a half. This returns the last
+// complete packet with a valid checksum in the ring, trying the alignment of
+// the previous one first, or NULL if there is none.
+const ChainState::Packet* ChainState::FindRightPacket(
+    const uint8_t* rx_buffer) {
+  const uint8_t* ring = right_rx_packet_[0].bytes;
+  const size_t ring_size = 2 * kPacketSize;
+  const size_t half = rx_buffer - ring;
+  Packet* p = &right_rx_aligned_packet_;
+  for (size_t i = 0; i < ring_size; ++i) {
+    size_t offset = (right_rx_offset_ + i) % ring_size;
+    size_t start = half + offset;
+    // Both updates and requests have their 2 MSBs set in the first byte, and
+    // so does the key of a reinit packet.
+    if (ring[start % ring_size] < kChannelUpdatesHeader) {
+      continue;
+    }
+    for (size_t j = 0; j < kPacketSize; ++j) {
+      p->bytes[j] = ring[(start + j) % ring_size];
+    }
+    uint16_t checksum = p->to_left.checksum[0] | \
+        (p->to_left.checksum[1] << 8);
+    if (check_reinit(p) || checksum == PacketChecksum(p->bytes)) {
+      right_rx_offset_ = offset;
+      return p;
+    }
+  }
+  return NULL;
+}
+
 void ChainState::ReceiveRight() {
-  const RightToLeftPacket* p = right_->available_rx_buffer<RightToLeftPacket>();
+  const uint8_t* rx_buffer = right_->available_rx_buffer();
+  const Packet* packet = rx_buffer ? FindRightPacket(rx_buffer) : NULL;
+  const RightToLeftPacket* p = packet ? &packet->to_left : NULL;
   if (p && check_reinit<RightToLeftPacket>(p)) {
     start_reinit();
     return;
@@ -194,22 +249,12 @@ void ChainState::ReceiveRight() {
   }
 
   if (p) {
-    size_t rx_index = p->channel[0].index();
-    if (rx_index > index_ && rx_index < size_) {
-      // This packet contains the state of a module on the right.
-      // Check if some settings have been changed on the remote modules,
-      // then update our local copy of its state.
-      for (size_t i = 0; i < kNumChannels; ++i) {
-        dirty_[remote_channel_index(rx_index, i)] = \
-            remote_channel(rx_index, i)->flags != p->channel[i].flags;
+    if (p->header >> 5 == kChannelUpdatesHeader >> 5) {
+      // This packet contains the state of modules on the right.
+      if (DecodeChannelUpdates(*p)) {
+        request_.request = REQUEST_NONE;
       }
-      copy(
-          &p->channel[0],
-          &p->channel[kNumChannels],
-          remote_channel(rx_index, 0));
-      request_.request = REQUEST_NONE;
-    // rx_index is only 3 bits now, so check if 0x7 instead of 0xf
-    } else if (rx_index == 0x7) {
+    } else if (p->header >> 5 == 0x7) {
       // This suspiciously looks like a state change request packet!
       // We will take care of it later.
       request_ = *(const RequestPacket*)(p);
@@ -250,17 +295,166 @@ void ChainState::TransmitLeft() {
       }
     }
   found:
-    // In the example above, module 1 will alternate between sending to module
-    // 0 its own state, and the state of module 2.
-    size_t tx_index = index_ + ((counter_ >> 2) % (last - index_ + 1));
-    copy(
-        remote_channel(tx_index, 0),
-        remote_channel(tx_index, kNumChannels),
-        &left_tx_packet_.to_left.channel[0]);
+    // In the example above, module 1 will send to module 0 its own state,
+    // and the state of module 2.
+    EncodeChannelUpdates(
+        local_channel_index(0),
+        remote_channel_index(last, kNumChannels - 1),
+        &left_tx_packet_.to_left);
   }
+  uint16_t checksum = PacketChecksum(left_tx_packet_.bytes);
+  left_tx_packet_.to_left.checksum[0] = checksum & 0xff;
+  left_tx_packet_.to_left.checksum[1] = checksum >> 8;
   left_->Transmit(left_tx_packet_);
 }
 
+void ChainState::EncodeChannelUpdates(
+    size_t first_channel,
+    size_t last_channel,
+    RightToLeftPacket* packet) {
+  uint8_t* updates = packet->updates;
+  size_t size = 0;
+  size_t num_updates = 0;
+
+  // Room is kept for at least one full update, so that the module on the left
+  // eventually gets the state of every channel, even if it has missed a
+  // packet.
+  const size_t full_update_size = kChannelUpdateSize[CHANNEL_UPDATE_ALL];
+  const size_t capacity = sizeof(packet->updates) - full_update_size;
+
+  // The channels that have changed the most since they were last sent.
+  // Configuration changes come first. A step of the pot is worth 64 steps of
+  // the CV/slider, the same fraction of their range.
+  while (true) {
+    size_t channel = kMaxNumChannels;
+    uint32_t largest_change = 0;
+    for (size_t i = first_channel; i <= last_channel; ++i) {
+      const ChannelState& s = channel_state_[i];
+      const ChannelState& sent = tx_channel_state_[i];
+      uint32_t change = s.flags != sent.flags
+          ? 0xffffffff
+          : abs(int32_t(s.cv_slider) - int32_t(sent.cv_slider)) + \
+            (abs(int32_t(s.pot) - int32_t(sent.pot)) << 6);
+      if (change > largest_change) {
+        channel = i;
+        largest_change = change;
+      }
+    }
+    if (channel == kMaxNumChannels) {
+      break;
+    }
+
+    const ChannelState& s = channel_state_[channel];
+    ChannelState* sent = &tx_channel_state_[channel];
+    ChannelUpdateType type = CHANNEL_UPDATE_ALL;
+    if (s.flags == sent->flags) {
+      if (s.pot == sent->pot) {
+        type = CHANNEL_UPDATE_CV_SLIDER;
+      } else if (s.cv_slider == sent->cv_slider) {
+        type = CHANNEL_UPDATE_POT;
+      }
+    }
+    if (size + kChannelUpdateSize[type] > capacity) {
+      break;
+    }
+
+    uint8_t* u = &updates[size];
+    *u++ = (type << 6) | channel;
+    if (type == CHANNEL_UPDATE_ALL) {
+      *u++ = s.flags;
+    }
+    if (type != CHANNEL_UPDATE_CV_SLIDER) {
+      *u++ = s.pot;
+    }
+    if (type != CHANNEL_UPDATE_POT) {
+      *u++ = s.cv_slider & 0xff;
+      *u++ = s.cv_slider >> 8;
+    }
+    *sent = s;
+    size += kChannelUpdateSize[type];
+    ++num_updates;
+  }
+
+  // Fill the rest of the packet with full updates, in turn.
+  size_t num_channels = last_channel - first_channel + 1;
+  for (size_t i = 0;
+       i < num_channels && size + full_update_size <= sizeof(packet->updates);
+       ++i) {
+    if (refresh_channel_ < first_channel || refresh_channel_ > last_channel) {
+      refresh_channel_ = first_channel;
+    }
+    const ChannelState& s = channel_state_[refresh_channel_];
+    uint8_t* u = &updates[size];
+    *u++ = (CHANNEL_UPDATE_ALL << 6) | refresh_channel_;
+    *u++ = s.flags;
+    *u++ = s.pot;
+    *u++ = s.cv_slider & 0xff;
+    *u++ = s.cv_slider >> 8;
+    tx_channel_state_[refresh_channel_] = s;
+    size += full_update_size;
+    ++num_updates;
+    ++refresh_channel_;
+  }
+
+  packet->header = kChannelUpdatesHeader | num_updates;
+}
+
+bool ChainState::DecodeChannelUpdates(const RightToLeftPacket& packet) {
+  size_t num_updates = packet.header & 0x1f;
+
+  // The packet is checked as a whole before any update is applied.
+  size_t size = 0;
+  for (size_t i = 0; i < num_updates; ++i) {
+    const uint8_t* u = &packet.updates[size];
+    ChannelUpdateType type = ChannelUpdateType(*u >> 6);
+    size_t channel = *u & 0x3f;
+    if (type > CHANNEL_UPDATE_ALL ||
+        size + kChannelUpdateSize[type] > sizeof(packet.updates)) {
+      return false;
+    }
+    if (type == CHANNEL_UPDATE_ALL) {
+      // The module index in the flags is the one the channel belongs to, or
+      // 0b111 if its state has not been received yet.
+      size_t index = u[1] >> 5;
+      if (index != channel / kNumChannels && index != 0x7) {
+        return false;
+      }
+    }
+    size += kChannelUpdateSize[type];
+  }
+
+  // Only the state of the modules on the right is taken from the packet.
+  size_t first_channel = remote_channel_index(index_ + 1, 0);
+  size_t last_channel = remote_channel_index(size_, 0);
+  fill(&dirty_[first_channel], &dirty_[last_channel], false);
+
+  size = 0;
+  while (num_updates--) {
+    const uint8_t* u = &packet.updates[size];
+    ChannelUpdateType type = ChannelUpdateType(*u >> 6);
+    size_t channel = *u++ & 0x3f;
+    size += kChannelUpdateSize[type];
+    if (channel < first_channel || channel >= last_channel) {
+      continue;
+    }
+
+    // Check if some settings have been changed on the remote modules, then
+    // update our local copy of their state.
+    ChannelState* s = &channel_state_[channel];
+    if (type == CHANNEL_UPDATE_ALL) {
+      dirty_[channel] = s->flags != *u;
+      s->flags = *u++;
+    }
+    if (type != CHANNEL_UPDATE_CV_SLIDER) {
+      s->pot = *u++;
+    }
+    if (type != CHANNEL_UPDATE_POT) {
+      s->cv_slider = u[0] | (u[1] << 8);
+    }
+  }
+  return true;
+}
+
 void ChainState::ReceiveLeft() {
   const LeftToRightPacket* p = left_->available_rx_buffer<LeftToRightPacket>();
   if (p && check_reinit(p)) {
@@ -45,6 +45,9 @@ const size_t kPacketSize = 24;
 const uint32_t kReinitKey = 0xffffffff;
 const uint32_t kReinitCount = 0xff;
 
+// Shared with the UI, which handles the multi-mode toggle.
+const int32_t kLongPressDurationForMultiModeToggle = 5000;
+
 
 class SerialLink;
 class Settings;
@@ -253,8 +256,26 @@ class ChainState {
     ChannelBitmask input_patched[kMaxChainSize];
   };
 
+  // State of the channels on the right, sent as a list of updates: the
+  // channels whose state has changed the most since they were last sent to
+  // the left come first, then full updates of the other channels in turn.
+  // Each update starts with a byte holding its type (2 MSBs) and the index
+  // of the channel in the chain (6 LSBs).
+  enum ChannelUpdateType {
+    CHANNEL_UPDATE_CV_SLIDER,  // cv_slider (2 bytes).
+    CHANNEL_UPDATE_POT,        // pot (1 byte).
+    CHANNEL_UPDATE_ALL         // flags, pot, cv_slider (4 bytes).
+  };
+
   struct RightToLeftPacket {
-    ChannelState channel[kNumChannels];
+    // 0b110nnnnn for a packet of n updates. The 3 MSBs are at the same
+    // place as the module index in the flags of a ChannelState: 0b111 is a
+    // request.
+    uint8_t header;
+    uint8_t updates[kPacketSize - 3];
+    // Checksum of all the bytes above, requests included (see
+    // PacketChecksum in chain_state.cc).
+    uint8_t checksum[2];
   };
 
   enum Request {
@@ -318,6 +339,13 @@ class ChainState {
 
   RequestPacket MakeLoopChangeRequest(size_t loop_start, size_t loop_end);
 
+  void EncodeChannelUpdates(
+      size_t first_channel,
+      size_t last_channel,
+      RightToLeftPacket* packet);
+  bool DecodeChannelUpdates(const RightToLeftPacket& packet);
+  const Packet* FindRightPacket(const uint8_t* rx_buffer);
+
   Quantizer quantizers_[kNumChannels];
 
   size_t index_;
@@ -330,6 +358,9 @@ class ChainState {
   uint32_t rightKey;
 
   ChannelState channel_state_[kMaxNumChannels];
+  // What the module on the left has last been sent about each channel.
+  ChannelState tx_channel_state_[kMaxNumChannels];
+  size_t refresh_channel_;
   uint16_t last_local_config_[kNumChannels];
   bool dirty_[kMaxNumChannels];
 
@@ -359,6 +390,10 @@ class ChainState {
   Packet right_tx_packet_;
   Packet left_rx_packet_[2];
   Packet right_rx_packet_[2];
+  // Last packet found in right_rx_packet_, and where it started, relative to
+  // the half of the buffer just received.
+  Packet right_rx_aligned_packet_;
+  size_t right_rx_offset_;
 
   size_t num_internal_bindings_;
   size_t num_bindings_;
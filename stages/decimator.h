@@ -0,0 +1,121 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// FIR decimator bringing a 2x or 4x oversampled signal back to the sample
+// rate. Windowed-sinc lowpass (Blackman window) with its cutoff at half the
+// output sample rate, and 12 taps per output sample. Everything that would
+// fold below a quarter of the output sample rate is attenuated by more than
+// 70dB.
+//
+// The group delay is (12 * factor - 1) / 2 oversampled samples, that is
+// to say half an oversampled sample less than 6 output samples.
+
+#ifndef STAGES_DECIMATOR_H_
+#define STAGES_DECIMATOR_H_
+
+#include "stmlib/stmlib.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace stages {
+
+const int kMaxOversampling = 4;
+const int kDecimatorTapsPerSample = 12;
+const int kMaxDecimatorTaps = kDecimatorTapsPerSample * kMaxOversampling;
+// Group delay rounded to whole output samples.
+const int kDecimatorDelay = kDecimatorTapsPerSample / 2;
+
+class Decimator {
+ public:
+  Decimator() { }
+  ~Decimator() { }
+
+  // Computes the filter for a factor of 2 or 4. The history is filled with
+  // value, so that switching on oversampling does not make the output jump.
+  void Init(int factor, float value) {
+    factor_ = factor;
+    num_taps_ = kDecimatorTapsPerSample * factor;
+    const float cutoff = 0.5f / float(factor);
+    const float center = 0.5f * float(num_taps_ - 1);
+    float sum = 0.0f;
+    for (int i = 0; i < num_taps_ / 2; ++i) {
+      const float t = float(i) - center;
+      const float x = float(i) / float(num_taps_ - 1);
+      const float window = 0.42f - 0.5f * cosf(2.0f * M_PI * x) + \
+          0.08f * cosf(4.0f * M_PI * x);
+      const float sinc = sinf(2.0f * M_PI * cutoff * t) / (M_PI * t);
+      h_[i] = window * sinc;
+      sum += 2.0f * h_[i];
+    }
+    // Unity gain at DC, so that envelopes reach their levels exactly.
+    for (int i = 0; i < num_taps_ / 2; ++i) {
+      h_[i] /= sum;
+    }
+    std::fill(&history_[0], &history_[num_taps_], value);
+    write_ptr_ = 0;
+  }
+
+  inline void Write(float sample) {
+    history_[write_ptr_] = sample;
+    ++write_ptr_;
+    if (write_ptr_ == num_taps_) {
+      write_ptr_ = 0;
+    }
+  }
+
+  // Filtered value, (12 * factor - 1) / 2 oversampled samples behind the last
+  // sample written.
+  inline float Read() const {
+    // The filter is symmetric: the oldest and newest samples share the first
+    // coefficient, and so on.
+    int oldest = write_ptr_;
+    int newest = write_ptr_ == 0 ? num_taps_ - 1 : write_ptr_ - 1;
+    float y = 0.0f;
+    for (int i = 0; i < num_taps_ / 2; ++i) {
+      y += h_[i] * (history_[oldest] + history_[newest]);
+      oldest = oldest == num_taps_ - 1 ? 0 : oldest + 1;
+      newest = newest == 0 ? num_taps_ - 1 : newest - 1;
+    }
+    return y;
+  }
+
+  inline int factor() const { return factor_; }
+
+ private:
+  int factor_;
+  int num_taps_;
+  int write_ptr_;
+
+  float h_[kMaxDecimatorTaps / 2];
+  float history_[kMaxDecimatorTaps];
+
+  DISALLOW_COPY_AND_ASSIGN(Decimator);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_DECIMATOR_H_
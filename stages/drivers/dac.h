@@ -39,8 +39,6 @@ namespace stages {
 
 const size_t kMaxDacBlockSize = 8;
 
-class IOBuffer;
-
 const size_t kFrameSize = kNumChannels * 4;
   
 class Dac {
@@ -117,12 +117,17 @@ void GateInputs::ReadNormalization(IOBuffer::Block* block) {
 }
 
 void GateInputs::Read(const IOBuffer::Slice& slice, size_t size) {
+  uint8_t edges = slice.frame_index ? slice.block->input_edges : 0;
   for (size_t i = 0; i < kNumChannels; ++i) {
     previous_flags_[i] = ExtractGateFlags(
         previous_flags_[i],
         !(gate_input_definition[i].gpio->IDR & gate_input_definition[i].pin));
     slice.block->input[i][slice.frame_index] = previous_flags_[i];
+    if (previous_flags_[i] & (GATE_FLAG_RISING | GATE_FLAG_FALLING)) {
+      edges |= 1 << i;
+    }
   }
+  slice.block->input_edges = edges;
   
   // Extend gate input data to the next samples.
   for (size_t j = 1; j < size; ++j) {
@@ -31,10 +31,16 @@
 
 #include "stmlib/stmlib.h"
 
+#ifndef TEST
 #include <stm32f37x_conf.h>
+#endif  // TEST
 
 namespace stages {
 
+#ifdef TEST
+class VirtualWire;
+#endif  // TEST
+
 enum SerialLinkDirection {
   SERIAL_LINK_DIRECTION_LEFT,
   SERIAL_LINK_DIRECTION_RIGHT
@@ -75,11 +81,33 @@ class SerialLink {
     return static_cast<const T*>(
         static_cast<const void*>(available_rx_buffer()));
   }
+
+#ifdef TEST
+  // On the host, the UART is replaced by an in-memory wire (see
+  // stages/test/virtual_chain.h). Transmit() hands the bytes to tx_wire,
+  // which later delivers them to the link at the other end with
+  // ReceiveByte(), playing the part of the RX DMA channel. A NULL wire is an
+  // unplugged cable.
+  inline void set_tx_wire(VirtualWire* tx_wire) { tx_wire_ = tx_wire; }
+  void ReceiveByte(uint8_t byte);
+#endif  // TEST
   
  private:
   SerialLinkDirection direction_;
   size_t rx_block_size_;
   uint8_t* rx_buffer_;
+
+#ifdef TEST
+  uint32_t baud_rate_;
+  VirtualWire* tx_wire_;
+
+  uint8_t* rx_destination_;
+  size_t rx_size_;
+  size_t rx_position_;
+  bool rx_circular_;
+  bool rx_half_complete_;
+  bool rx_complete_;
+#endif  // TEST
   
   DISALLOW_COPY_AND_ASSIGN(SerialLink);
 };
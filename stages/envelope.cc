@@ -21,6 +21,10 @@ namespace stages {
     sustainLevel = 0.0f;
     releaseLength = 0L;
     
+    attackIncrement = 0.0f;
+    decayIncrement = 0.0f;
+    releaseIncrement = 0.0f;
+    
     attackCurve = 0.5f;
     decayCurve = 0.5f;
     releaseCurve = 0.5f;
@@ -80,7 +84,7 @@ namespace stages {
     switch (stage) {
       
       case ATTACK:
-        value = Interpolate(stageStartValue, 1.0f, stageTime, attackLength, attackCurve);
+        value = Interpolate(stageStartValue, 1.0f, stageTime, attackIncrement, attackCurve);
         break;
       
       case HOLD:
@@ -88,7 +92,7 @@ namespace stages {
         break;
       
       case DECAY:
-        value = Interpolate(1.0f, sustainLevel, stageTime, decayLength, decayCurve);
+        value = Interpolate(1.0f, sustainLevel, stageTime, decayIncrement, decayCurve);
         break;
       
       case SUSTAIN:
@@ -96,7 +100,7 @@ namespace stages {
         break;
       
       case RELEASE:
-        value = Interpolate(stageStartValue, 0.0f, stageTime, releaseLength, releaseCurve);
+        value = Interpolate(stageStartValue, 0.0f, stageTime, releaseIncrement, releaseCurve);
         break;
         
       default:
@@ -109,6 +113,19 @@ namespace stages {
     
   }
   
+  void Envelope::Render(float* out, size_t size) {
+    
+    // Stage transitions and curves are only evaluated once per tick; the
+    // samples in between are linearly interpolated.
+    float start = value;
+    float step = (Value() - start) / size;
+    for (size_t i = 0; i < size - 1; ++i) {
+      out[i] = start + step * float(i + 1);
+    }
+    out[size - 1] = value;
+    
+  }
+  
   void Envelope::SetStage(EnvelopeStage s) {
     
     // Set stage (if different than current) and restart the stage timer
@@ -120,15 +137,28 @@ namespace stages {
     
   }
   
-  void Envelope::SetStageLength(float f, long *field) {
+  void Envelope::SetStageLength(float f, long *field, float *increment) {
+    
+    long length = StageLength(f);
+    
+    // Lengths are set on every block from the sliders, but rarely change:
+    // only recompute the phase increment when they do.
+    if (increment && length != *field) {
+      *increment = length ? 1.0f / length : 0.0f;
+    }
+    *field = length;
+    
+  }
+  
+  long Envelope::StageLength(float f) {
     
     // If factor is above threshold, set the length in time units, according to time scale.
     // Use a curve so smaller values can be dialed in more precisely, despite big time scales.
     if (f >= kMinStageLength) {
       float ff = WarpPhase(f - kMinStageLength, 0.25f);
-      *field = std::max(0L, (long)(ff * timeScale));
+      return std::max(0L, (long)(ff * timeScale));
     } else {
-      *field = 0L;
+      return 0L;
     }
     
   }
@@ -147,11 +177,11 @@ namespace stages {
     
   }
   
-  float Envelope::Interpolate(float from, float to, long time, long length, float curve) {
+  float Envelope::Interpolate(float from, float to, long time, float increment, float curve) {
     
     // Interpolate values depending on the amount of time elapsed in respoet to total length.
     // Interpolation is linear for curve = 0.5, ease-in for curve < 0.5, ease-out for curve > 0.5.
-    float t = WarpPhase((float)time / length, curve);
+    float t = WarpPhase((float)time * increment, curve);
     return from + (to - from) * t;
     
   }
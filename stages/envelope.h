@@ -1,6 +1,8 @@
 #ifndef STAGES_6EG_ENVELOPE_H_
 #define STAGES_6EG_ENVELOPE_H_
 
+#include <cstddef>
+
 namespace stages {
 
 enum EnvelopeStage {
@@ -23,11 +25,11 @@ class Envelope {
     void Init();
     
     inline void SetDelayLength  (float f) { SetStageLength(f, &delayLength  ); };
-    inline void SetAttackLength (float f) { SetStageLength(f, &attackLength ); };
+    inline void SetAttackLength (float f) { SetStageLength(f, &attackLength,  &attackIncrement ); };
     inline void SetHoldLength   (float f) { SetStageLength(f, &holdLength   ); };
-    inline void SetDecayLength  (float f) { SetStageLength(f, &decayLength  ); };
+    inline void SetDecayLength  (float f) { SetStageLength(f, &decayLength,   &decayIncrement  ); };
     inline void SetSustainLevel (float f) { sustainLevel = f - 0.001f;         };
-    inline void SetReleaseLength(float f) { SetStageLength(f, &releaseLength); };
+    inline void SetReleaseLength(float f) { SetStageLength(f, &releaseLength, &releaseIncrement); };
     
     inline void SetAttackCurve (float f) { SetStageCurve(f, &attackCurve);  };
     inline void SetDecayCurve  (float f) { SetStageCurve(f, &decayCurve);   };
@@ -45,6 +47,14 @@ class Envelope {
     void Gate(bool high);
     
     float Value();
+    
+    // Advances the envelope by one tick, like Value(), and renders it over
+    // size samples by ramping from the previous value, instead of holding
+    // the new value for the whole block.
+    void Render(float* out, size_t size);
+    
+    // Length, in ticks, of a stage set to f.
+    static long StageLength(float f);
 	
   private:
     
@@ -59,6 +69,11 @@ class Envelope {
     float sustainLevel;
     long releaseLength;
     
+    // Phase increment per tick (1 / length) of the interpolated stages.
+    float attackIncrement;
+    float decayIncrement;
+    float releaseIncrement;
+    
     float attackCurve;
     float decayCurve;
     float releaseCurve;
@@ -67,12 +82,12 @@ class Envelope {
     float value;
   
     void SetStage(EnvelopeStage stage);
-    void SetStageLength(float f, long *field);
+    void SetStageLength(float f, long *field, float *increment = NULL);
     void SetStageCurve(float f, float *field);
     bool HasStageLength(long *field);
     
-    float Interpolate(float from, float to, long time, long length, float curve = 0.5f);
-    float WarpPhase(float t, float curve);
+    float Interpolate(float from, float to, long time, float increment, float curve = 0.5f);
+    static float WarpPhase(float t, float curve);
     
 };
 
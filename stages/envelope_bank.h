@@ -0,0 +1,288 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Bank of DAHDSR envelopes, advanced in lock-step.
+//
+// This does exactly what Envelope::Gate and Envelope::Render do, but the
+// state of the six envelopes is stored as a structure of arrays and all the
+// envelopes run through the same instructions on SIMD lanes (see lanes.h):
+// gate edges and stage transitions are applied with masks, and the three
+// interpolated stages share a single curve evaluation. The cost of a block
+// does not depend on how many envelopes are changing stage.
+
+#ifndef STAGES_ENVELOPE_BANK_H_
+#define STAGES_ENVELOPE_BANK_H_
+
+#include "stmlib/stmlib.h"
+
+#include <algorithm>
+
+#include "stages/envelope.h"
+#include "stages/io_buffer.h"
+#include "stages/lanes.h"
+
+namespace stages {
+
+// Rounded up to a whole number of SIMD lanes.
+const size_t kNumEnvelopeBankLanes = \
+    (kNumChannels + lanes::kWidth - 1) / lanes::kWidth * lanes::kWidth;
+
+class EnvelopeBank {
+ public:
+  EnvelopeBank() { }
+  ~EnvelopeBank() { }
+
+  void Init() {
+    Fill(stage_, float(IDLE));
+    Fill(stage_time_, 0.0f);
+    Fill(stage_start_value_, 0.0f);
+    Fill(value_, 0.0f);
+    Fill(gate_, 0.0f);
+    Fill(gate_input_, 0.0f);
+    Fill(delay_length_, 0.0f);
+    Fill(attack_length_, 0.0f);
+    Fill(hold_length_, 0.0f);
+    Fill(decay_length_, 0.0f);
+    Fill(release_length_, 0.0f);
+    Fill(attack_increment_, 0.0f);
+    Fill(decay_increment_, 0.0f);
+    Fill(release_increment_, 0.0f);
+    Fill(sustain_level_, 0.0f);
+    Fill(attack_curve_, 0.5f);
+    Fill(decay_curve_, 0.5f);
+    Fill(release_curve_, 0.5f);
+  }
+
+  inline void SetDelayLength(size_t i, float f) {
+    delay_length_[i] = float(Envelope::StageLength(f));
+  }
+  inline void SetAttackLength(size_t i, float f) {
+    SetStageLength(f, &attack_length_[i], &attack_increment_[i]);
+  }
+  inline void SetHoldLength(size_t i, float f) {
+    hold_length_[i] = float(Envelope::StageLength(f));
+  }
+  inline void SetDecayLength(size_t i, float f) {
+    SetStageLength(f, &decay_length_[i], &decay_increment_[i]);
+  }
+  inline void SetSustainLevel(size_t i, float f) {
+    sustain_level_[i] = f - 0.001f;
+  }
+  inline void SetReleaseLength(size_t i, float f) {
+    SetStageLength(f, &release_length_[i], &release_increment_[i]);
+  }
+
+  inline void SetAttackCurve(size_t i, float f) { attack_curve_[i] = f; }
+  inline void SetDecayCurve(size_t i, float f) { decay_curve_[i] = f; }
+  inline void SetReleaseCurve(size_t i, float f) { release_curve_[i] = f; }
+
+  inline bool HasDelay(size_t i) const { return delay_length_[i] > 0.0f; }
+  inline bool HasAttack(size_t i) const { return attack_length_[i] > 0.0f; }
+  inline bool HasHold(size_t i) const { return hold_length_[i] > 0.0f; }
+  inline bool HasDecay(size_t i) const { return decay_length_[i] > 0.0f; }
+  inline bool HasSustain(size_t i) const { return sustain_level_[i] > 0.001f; }
+  inline bool HasRelease(size_t i) const { return release_length_[i] > 0.0f; }
+
+  inline EnvelopeStage stage(size_t i) const {
+    return static_cast<EnvelopeStage>(int(stage_[i]));
+  }
+
+  // The gate is applied at the beginning of the next Render.
+  inline void Gate(size_t i, bool high) {
+    gate_input_[i] = high ? 1.0f : 0.0f;
+  }
+
+  // Advances all the envelopes by one tick, and renders size samples for
+  // each of them. The output is interleaved: out[sample][envelope].
+  void Render(float (*out)[kNumEnvelopeBankLanes], size_t size) {
+    for (size_t i = 0; i < kNumEnvelopeBankLanes; i += lanes::kWidth) {
+      RenderLanes(i, out, size);
+    }
+  }
+
+ private:
+  static inline void Fill(float* lanes, float value) {
+    std::fill(&lanes[0], &lanes[kNumEnvelopeBankLanes], value);
+  }
+
+  static inline void SetStageLength(float f, float* length, float* increment) {
+    long l = Envelope::StageLength(f);
+    if (float(l) != *length) {
+      *increment = l ? 1.0f / l : 0.0f;
+    }
+    *length = float(l);
+  }
+
+  // Equivalent of Envelope::SetStage, for the lanes in m.
+  static inline void SetStage(
+      lanes::Mask m,
+      lanes::Float s,
+      lanes::Float value,
+      lanes::Float* stage,
+      lanes::Float* stage_time,
+      lanes::Float* stage_start_value) {
+    using namespace lanes;
+    m = And(m, Ne(*stage, s));
+    *stage = Select(m, s, *stage);
+    *stage_time = Select(m, Set(0.0f), *stage_time);
+    *stage_start_value = Select(m, value, *stage_start_value);
+  }
+
+  // Same expression as Envelope::WarpPhase, so that the results are
+  // identical.
+  static inline lanes::Float WarpPhase(lanes::Float t, lanes::Float curve) {
+    using namespace lanes;
+    const Float one = Set(1.0f);
+    curve = Sub(curve, Set(0.5f));
+    Mask flip = Lt(curve, Set(0.0f));
+    t = Select(flip, Sub(one, t), t);
+    Float a = Mul(Mul(Set(128.0f), curve), curve);
+    t = Div(Mul(Add(one, a), t), Add(one, Mul(a, t)));
+    return Select(flip, Sub(one, t), t);
+  }
+
+  void RenderLanes(
+      size_t first,
+      float (*out)[kNumEnvelopeBankLanes],
+      size_t size) {
+    using namespace lanes;
+    const Float zero = Set(0.0f);
+    const Float one = Set(1.0f);
+    const Float idle = Set(float(IDLE));
+    const Float delay = Set(float(DELAY));
+    const Float attack = Set(float(ATTACK));
+    const Float hold = Set(float(HOLD));
+    const Float decay = Set(float(DECAY));
+    const Float sustain = Set(float(SUSTAIN));
+    const Float release = Set(float(RELEASE));
+
+    Float stage = Load(&stage_[first]);
+    Float stage_time = Load(&stage_time_[first]);
+    Float start = Load(&stage_start_value_[first]);
+    Float value = Load(&value_[first]);
+    const Float previous_value = value;
+
+    const Float delay_length = Load(&delay_length_[first]);
+    const Float attack_length = Load(&attack_length_[first]);
+    const Float hold_length = Load(&hold_length_[first]);
+    const Float decay_length = Load(&decay_length_[first]);
+    const Float release_length = Load(&release_length_[first]);
+    const Float sustain_level = Load(&sustain_level_[first]);
+
+    // Gate edges (Envelope::Gate).
+    Mask high = Gt(Load(&gate_input_[first]), Set(0.5f));
+    Mask was_high = Gt(Load(&gate_[first]), Set(0.5f));
+    Mask rising = AndNot(high, was_high);
+    Mask falling = AndNot(was_high, high);
+    Float on = Select(Gt(delay_length, zero), delay, attack);
+    Float off = Select(
+        Or(Le(stage, delay), Le(value, Set(0.001f))), idle, release);
+    SetStage(
+        Or(rising, falling), Select(rising, on, off), value,
+        &stage, &stage_time, &start);
+    Store(&gate_[first], Select(high, one, zero));
+
+    // Cascading stage transitions (Envelope::Value).
+    SetStage(
+        And(Eq(stage, delay), Ge(stage_time, delay_length)), attack, value,
+        &stage, &stage_time, &start);
+    SetStage(
+        And(Eq(stage, attack), Ge(stage_time, attack_length)), hold, value,
+        &stage, &stage_time, &start);
+    SetStage(
+        And(Eq(stage, hold), Ge(stage_time, hold_length)), decay, value,
+        &stage, &stage_time, &start);
+    SetStage(
+        And(Eq(stage, decay), Ge(stage_time, decay_length)), sustain, value,
+        &stage, &stage_time, &start);
+    SetStage(
+        And(Eq(stage, release), Ge(stage_time, release_length)), idle, value,
+        &stage, &stage_time, &start);
+    stage_time = Add(stage_time, Select(Gt(stage, idle), one, zero));
+
+    // The attack, decay and release stages are all an interpolation between
+    // two values: pick each lane's endpoints and curve, and interpolate once.
+    Mask is_attack = Eq(stage, attack);
+    Mask is_decay = Eq(stage, decay);
+    Mask is_release = Eq(stage, release);
+    Float from = Select(is_decay, one, start);
+    Float to = Select(is_attack, one, Select(is_decay, sustain_level, zero));
+    Float increment = Select(
+        is_attack, Load(&attack_increment_[first]), Select(
+            is_decay, Load(&decay_increment_[first]),
+            Load(&release_increment_[first])));
+    Float curve = Select(
+        is_attack, Load(&attack_curve_[first]), Select(
+            is_decay, Load(&decay_curve_[first]),
+            Load(&release_curve_[first])));
+    Float t = WarpPhase(Mul(stage_time, increment), curve);
+    Float ramp = Add(from, Mul(Sub(to, from), t));
+
+    value = Select(Eq(stage, hold), one, zero);
+    value = Select(Eq(stage, sustain), sustain_level, value);
+    value = Select(Or(Or(is_attack, is_decay), is_release), ramp, value);
+
+    Store(&stage_[first], stage);
+    Store(&stage_time_[first], stage_time);
+    Store(&stage_start_value_[first], start);
+    Store(&value_[first], value);
+
+    // Ramp from the previous value (Envelope::Render).
+    Float step = Div(Sub(value, previous_value), Set(float(size)));
+    for (size_t i = 0; i < size - 1; ++i) {
+      Store(&out[i][first], Add(previous_value, Mul(step, Set(float(i + 1)))));
+    }
+    Store(&out[size - 1][first], value);
+  }
+
+  // Per-lane state.
+  float stage_[kNumEnvelopeBankLanes];
+  float stage_time_[kNumEnvelopeBankLanes];
+  float stage_start_value_[kNumEnvelopeBankLanes];
+  float value_[kNumEnvelopeBankLanes];
+  float gate_[kNumEnvelopeBankLanes];
+  float gate_input_[kNumEnvelopeBankLanes];
+
+  // Per-lane settings. Lengths are in ticks.
+  float delay_length_[kNumEnvelopeBankLanes];
+  float attack_length_[kNumEnvelopeBankLanes];
+  float hold_length_[kNumEnvelopeBankLanes];
+  float decay_length_[kNumEnvelopeBankLanes];
+  float release_length_[kNumEnvelopeBankLanes];
+  float attack_increment_[kNumEnvelopeBankLanes];
+  float decay_increment_[kNumEnvelopeBankLanes];
+  float release_increment_[kNumEnvelopeBankLanes];
+  float sustain_level_[kNumEnvelopeBankLanes];
+  float attack_curve_[kNumEnvelopeBankLanes];
+  float decay_curve_[kNumEnvelopeBankLanes];
+  float release_curve_[kNumEnvelopeBankLanes];
+
+  DISALLOW_COPY_AND_ASSIGN(EnvelopeBank);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_ENVELOPE_BANK_H_
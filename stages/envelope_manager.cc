@@ -50,122 +50,119 @@ namespace stages {
   }
 
   void EnvelopeManager::ReInit() {
-    for (size_t i = 0; i < kNumChannels; ++i) {
-      get_envelope(i).Init();
-    }
+    bank_.Init();
     if (settings_->state().multimode == MULTI_MODE_SIX_INDEPENDENT_EGS) {
       for (size_t i = 0; i < kNumChannels; ++i) {
         const uint8_t* eg_state = settings_->state().independent_eg_state[i];
-        Envelope& envelope = get_envelope(i);
-        envelope.SetDelayLength(Uint8ToPotOrSlider(eg_state[IEG_DELAY_LENGTH]));
-        envelope.SetAttackLength(Uint8ToPotOrSlider(eg_state[IEG_ATTACK_LENGTH]));
-        envelope.SetAttackCurve(Uint8ToPotOrSlider(eg_state[IEG_ATTACK_CURVE]));
-        envelope.SetHoldLength(Uint8ToPotOrSlider(eg_state[IEG_HOLD_LENGTH]));
-        envelope.SetDecayLength(Uint8ToPotOrSlider(eg_state[IEG_DECAY_LENGTH]));
-        envelope.SetDecayCurve(Uint8ToPotOrSlider(eg_state[IEG_DECAY_CURVE]));
-        envelope.SetSustainLevel(Uint8ToPotOrSlider(eg_state[IEG_SUSTAIN_LEVEL]));
-        envelope.SetReleaseLength(Uint8ToPotOrSlider(eg_state[IEG_RELEASE_LENGTH]));
-        envelope.SetReleaseCurve(Uint8ToPotOrSlider(eg_state[IEG_RELEASE_CURVE]));
+        bank_.SetDelayLength(i, Uint8ToPotOrSlider(eg_state[IEG_DELAY_LENGTH]));
+        bank_.SetAttackLength(i, Uint8ToPotOrSlider(eg_state[IEG_ATTACK_LENGTH]));
+        bank_.SetAttackCurve(i, Uint8ToPotOrSlider(eg_state[IEG_ATTACK_CURVE]));
+        bank_.SetHoldLength(i, Uint8ToPotOrSlider(eg_state[IEG_HOLD_LENGTH]));
+        bank_.SetDecayLength(i, Uint8ToPotOrSlider(eg_state[IEG_DECAY_LENGTH]));
+        bank_.SetDecayCurve(i, Uint8ToPotOrSlider(eg_state[IEG_DECAY_CURVE]));
+        bank_.SetSustainLevel(i, Uint8ToPotOrSlider(eg_state[IEG_SUSTAIN_LEVEL]));
+        bank_.SetReleaseLength(i, Uint8ToPotOrSlider(eg_state[IEG_RELEASE_LENGTH]));
+        bank_.SetReleaseCurve(i, Uint8ToPotOrSlider(eg_state[IEG_RELEASE_CURVE]));
       }
     }
   }
 
   void EnvelopeManager::SetAllDelayLength(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetDelayLength(value);
+      bank_.SetDelayLength(envelope, value);
     }
   }
 
   void EnvelopeManager::SetAllAttackLength(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetAttackLength(value);
+      bank_.SetAttackLength(envelope, value);
     }
   }
 
   void EnvelopeManager::SetAllAttackCurve(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetAttackCurve(value);
+      bank_.SetAttackCurve(envelope, value);
     }
   }
 
   void EnvelopeManager::SetAllHoldLength(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetHoldLength(value);
+      bank_.SetHoldLength(envelope, value);
     }
   }
 
   void EnvelopeManager::SetAllDecayLength(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetDecayLength(value);
+      bank_.SetDecayLength(envelope, value);
     }
   }
 
   void EnvelopeManager::SetAllDecayCurve(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetDecayCurve(value);
+      bank_.SetDecayCurve(envelope, value);
     }
   }
 
   void EnvelopeManager::SetAllSustainLevel(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetSustainLevel(value);
+      bank_.SetSustainLevel(envelope, value);
     }
   }
 
   void EnvelopeManager::SetAllReleaseLength(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetReleaseLength(value);
+      bank_.SetReleaseLength(envelope, value);
     }
   }
 
   void EnvelopeManager::SetAllReleaseCurve(float value) {
     for (uint8_t envelope = 0; envelope < kNumChannels; ++envelope) {
-      get_envelope(envelope).SetReleaseCurve(value);
+      bank_.SetReleaseCurve(envelope, value);
     }
   }
 
   bool EnvelopeManager::SetDelayLength(uint8_t channel, float value) {
-    get_envelope(channel).SetDelayLength(value);
+    bank_.SetDelayLength(channel, value);
     return SetIndependentEGState(channel, IEG_DELAY_LENGTH, value);
   }
 
   bool EnvelopeManager::SetAttackLength(uint8_t channel, float value) {
-    get_envelope(channel).SetAttackLength(value);
+    bank_.SetAttackLength(channel, value);
     return SetIndependentEGState(channel, IEG_ATTACK_LENGTH, value);
   }
 
   bool EnvelopeManager::SetAttackCurve(uint8_t channel, float value) {
-    get_envelope(channel).SetAttackCurve(value);
+    bank_.SetAttackCurve(channel, value);
     return SetIndependentEGState(channel, IEG_ATTACK_CURVE, value);
   }
 
   bool EnvelopeManager::SetHoldLength(uint8_t channel, float value) {
-    get_envelope(channel).SetHoldLength(value);
+    bank_.SetHoldLength(channel, value);
     return SetIndependentEGState(channel, IEG_HOLD_LENGTH, value);
   }
 
   bool EnvelopeManager::SetDecayLength(uint8_t channel, float value) {
-    get_envelope(channel).SetDecayLength(value);
+    bank_.SetDecayLength(channel, value);
     return SetIndependentEGState(channel, IEG_DECAY_LENGTH, value);
   }
 
   bool EnvelopeManager::SetDecayCurve(uint8_t channel, float value) {
-    get_envelope(channel).SetDecayCurve(value);
+    bank_.SetDecayCurve(channel, value);
     return SetIndependentEGState(channel, IEG_DECAY_CURVE, value);
   }
 
   bool EnvelopeManager::SetSustainLevel(uint8_t channel, float value) {
-    get_envelope(channel).SetSustainLevel(value);
+    bank_.SetSustainLevel(channel, value);
     return SetIndependentEGState(channel, IEG_SUSTAIN_LEVEL, value);
   }
 
   bool EnvelopeManager::SetReleaseLength(uint8_t channel, float value) {
-    get_envelope(channel).SetReleaseLength(value);
+    bank_.SetReleaseLength(channel, value);
     return SetIndependentEGState(channel, IEG_RELEASE_LENGTH, value);
   }
 
   bool EnvelopeManager::SetReleaseCurve(uint8_t channel, float value) {
-    get_envelope(channel).SetReleaseCurve(value);
+    bank_.SetReleaseCurve(channel, value);
     return SetIndependentEGState(channel, IEG_RELEASE_CURVE, value);
   }
 
@@ -36,7 +36,7 @@
 
 #include "stmlib/stmlib.h"
 
-#include "stages/envelope.h"
+#include "stages/envelope_bank.h"
 #include "stages/io_buffer.h"
 
 namespace stages {
@@ -86,11 +86,11 @@ class EnvelopeManager {
   bool SetReleaseLength(uint8_t channel, float value);
   bool SetReleaseCurve(uint8_t channel, float value);
 
-  Envelope& get_envelope(uint8_t channel) { return eg_[channel]; }
+  EnvelopeBank& bank() { return bank_; }
 
  private:
   Settings* settings_;
-  Envelope eg_[kNumChannels];
+  EnvelopeBank bank_;
 
   bool SetIndependentEGState(uint8_t channel, uint8_t state_offset, float value);
 
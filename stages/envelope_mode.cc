@@ -179,6 +179,7 @@ namespace stages {
     }
 
     // Process each channel
+    EnvelopeBank& bank = envelope_manager_.bank();
     bool gate = false;
     for (size_t ch = 0; ch < kNumChannels; ch++) {
 
@@ -203,11 +204,16 @@ namespace stages {
         }
       }
 
-      Envelope& envelope = envelope_manager_.get_envelope(ch);
-      envelope.Gate(gate);
+      bank.Gate(ch, gate);
+    }
+
+    // Compute output values for all envelopes at once
+    float values[kBlockSize][kNumEnvelopeBankLanes];
+    bank.Render(values, size);
 
+    for (size_t ch = 0; ch < kNumChannels; ch++) {
       // Set LED to indicate stage of the channel's envelope. Active channel is lit rather than off when idle.
-      switch (envelope.CurrentStage()) {
+      switch (bank.stage(ch)) {
         case DELAY:
         case ATTACK:
         case HOLD:
@@ -225,10 +231,8 @@ namespace stages {
           break;
       }
 
-      // Compute output values for each envelope
-      float value = envelope.Value();
       for (size_t i = 0; i < size; i++) {
-        block->output[ch][i] = settings_->dac_code(ch, value);
+        block->output[ch][i] = settings_->dac_code(ch, values[i][ch]);
       }
     }
 
@@ -254,12 +258,13 @@ namespace stages {
     }
 
     // Slider LEDs
-    ui_->set_slider_led(0, envelope_manager_.get_envelope(0).HasDelay  (), 1);
-    ui_->set_slider_led(1, envelope_manager_.get_envelope(0).HasAttack (), 1);
-    ui_->set_slider_led(2, envelope_manager_.get_envelope(0).HasHold   (), 1);
-    ui_->set_slider_led(3, envelope_manager_.get_envelope(0).HasDecay  (), 1);
-    ui_->set_slider_led(4, envelope_manager_.get_envelope(0).HasSustain(), 1);
-    ui_->set_slider_led(5, envelope_manager_.get_envelope(0).HasRelease(), 1);
+    EnvelopeBank& bank = envelope_manager_.bank();
+    ui_->set_slider_led(0, bank.HasDelay  (0), 1);
+    ui_->set_slider_led(1, bank.HasAttack (0), 1);
+    ui_->set_slider_led(2, bank.HasHold   (0), 1);
+    ui_->set_slider_led(3, bank.HasDecay  (0), 1);
+    ui_->set_slider_led(4, bank.HasSustain(0), 1);
+    ui_->set_slider_led(5, bank.HasRelease(0), 1);
 
     // Set pots params
     envelope_manager_.SetAllAttackCurve (block->pot[1]);
@@ -285,18 +290,20 @@ namespace stages {
           }
         }
       }
-      Envelope& envelope = envelope_manager_.get_envelope(ch);
-      envelope.Gate(gate);
-      ui_->set_led(ch, gate ? LED_COLOR_RED : LED_COLOR_OFF);
+      bank.Gate(ch, gate);
+    }
+
+    // Compute values for all envelopes at once
+    float values[kBlockSize][kNumEnvelopeBankLanes];
+    bank.Render(values, size);
 
-      // Compute value and set as output
-      float value = envelope.Value();
+    for (size_t ch = 0; ch < kNumChannels; ++ch) {
       for (size_t i = 0; i < size; i++) {
-        block->output[ch][i] = settings_->dac_code(ch, value);
+        block->output[ch][i] = settings_->dac_code(ch, values[i][ch]);
       }
 
       // Display current stage
-      switch (envelope.CurrentStage()) {
+      switch (bank.stage(ch)) {
         case DELAY:
         case ATTACK:
         case HOLD:
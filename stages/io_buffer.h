@@ -40,7 +40,18 @@ const size_t kNumBlocks = 2;
 const size_t kBlockSize = 8;
 const size_t kNumChannels = 6;
 
-class IOBuffer {
+// Lock-free single-producer/single-consumer ring of blocks. The producer is
+// the DAC interrupt (or a host simulation thread), which fills the inputs of
+// a block and plays its outputs slice by slice through NextSlice(). The
+// consumer is the render loop, which calls Process() to render every block
+// completed by the producer.
+//
+// The outputs rendered in a block are played when the producer comes back to
+// it, num_blocks blocks later, so the render loop can lag behind by up to
+// num_blocks - 1 blocks without any glitch. Deeper rings trade latency for
+// robustness against render overruns.
+template<size_t num_blocks, size_t block_size>
+class IOBufferRing {
  public:
   struct Block {
     float cv[kNumChannels];
@@ -49,8 +60,10 @@ class IOBuffer {
     float pot[kNumChannels];
     bool input_patched[kNumChannels];
 
-    stmlib::GateFlags input[kNumChannels][kBlockSize];
-    uint16_t output[kNumChannels][kBlockSize];
+    stmlib::GateFlags input[kNumChannels][block_size];
+    // Bit i is set if input[i] contains a rising or falling edge.
+    uint8_t input_edges;
+    uint16_t output[kNumChannels][block_size];
 
     inline float cv_slider_alt(size_t i, float slider_min, float slider_range, float cv_min, float cv_range) const {
       float combined_value = (cv_range * cv[i] + cv_min)
@@ -67,48 +80,110 @@ class IOBuffer {
 
   typedef void ProcessFn(Block* block, size_t size);
 
-  IOBuffer() { }
-  ~IOBuffer() { }
+  IOBufferRing() { }
+  ~IOBufferRing() { }
 
   void Init() {
-    io_block_ = 0;
-    render_block_ = kNumBlocks / 2;
+    STATIC_ASSERT(
+        num_blocks >= 2 && !(num_blocks & (num_blocks - 1)),
+        NUM_BLOCKS_MUST_BE_A_POWER_OF_TWO);
     io_frame_ = 0;
+    io_count_ = 0;
+    // The second half of the ring is rendered right away (from empty
+    // inputs), so that the producer has something to play while the first
+    // blocks are being filled.
+    render_count_ = io_count_ - num_blocks / 2;
+    overruns_ = 0;
+    underruns_ = 0;
+    high_water_mark_ = 0;
   }
 
+  // Consumer side. Renders all the blocks completed by the producer.
   inline void Process(ProcessFn* fn) {
-    while (render_block_ != io_block_) {
-      (*fn)(&block_[render_block_], kBlockSize);
-      render_block_ = (render_block_ + 1) % kNumBlocks;
+    uint32_t io_count = io_count_;
+    MemoryBarrier();
+
+    uint32_t pending = io_count - render_count_;
+    if (pending > high_water_mark_) {
+      high_water_mark_ = pending;
+    }
+    if (pending >= num_blocks) {
+      // The producer has caught up with the oldest blocks and is overwriting
+      // them: their inputs are lost. Resume from the oldest intact block.
+      overruns_ += pending - (num_blocks - 1);
+      render_count_ = io_count - (num_blocks - 1);
+    }
+
+    while (render_count_ != io_count) {
+      (*fn)(&block_[render_count_ & (num_blocks - 1)], block_size);
+      MemoryBarrier();
+      render_count_ = render_count_ + 1;
     }
   }
 
+  // Producer side. Returns the next size frames of the block being filled.
+  // A block is handed over to the render loop only when the slice following
+  // its last slice is requested, since the outputs of the last slice are
+  // still being read until then.
   inline Slice NextSlice(size_t size) {
+    if (io_frame_ >= block_size) {
+      io_frame_ -= block_size;
+      MemoryBarrier();
+      io_count_ = io_count_ + 1;
+    }
+    if (io_frame_ == 0 && io_count_ - render_count_ >= num_blocks) {
+      // This block has not been rendered since the last time it was played.
+      ++underruns_;
+    }
     Slice s;
-    s.block = &block_[io_block_];
+    s.block = &block_[io_count_ & (num_blocks - 1)];
     s.frame_index = io_frame_;
     io_frame_ += size;
-    if (io_frame_ >= kBlockSize) {
-      io_frame_ -= kBlockSize;
-      io_block_ = (io_block_ + 1) % kNumBlocks;
-    }
     return s;
   }
 
+  // True if the last slice returned by NextSlice completes its block.
   inline bool new_block() const {
-    return io_frame_ == 0;
+    return io_frame_ >= block_size;
   }
 
+  // Number of blocks whose inputs were overwritten before being rendered.
+  inline uint32_t overruns() const { return overruns_; }
+
+  // Number of blocks played before their outputs were rendered.
+  inline uint32_t underruns() const { return underruns_; }
+
+  // Largest number of blocks found waiting to be rendered by Process().
+  inline uint32_t high_water_mark() const { return high_water_mark_; }
+
+  inline size_t latency() const { return num_blocks * block_size; }
+
  private:
-  Block block_[kNumBlocks];
+  static inline void MemoryBarrier() {
+    // Makes the contents of a block visible to the other side before the
+    // index handing it over is. A compiler barrier is enough between the
+    // DAC interrupt and the main loop, but not between host threads.
+    __sync_synchronize();
+  }
+
+  Block block_[num_blocks];
 
   size_t io_frame_;
-  volatile size_t io_block_;
-  volatile size_t render_block_;
 
-  DISALLOW_COPY_AND_ASSIGN(IOBuffer);
+  // Free-running block counters, owned by the producer and the consumer
+  // respectively. Their difference is the number of blocks awaiting render.
+  volatile uint32_t io_count_;
+  volatile uint32_t render_count_;
+
+  volatile uint32_t underruns_;
+  uint32_t overruns_;
+  uint32_t high_water_mark_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOBufferRing);
 };
 
+typedef IOBufferRing<kNumBlocks, kBlockSize> IOBuffer;
+
 }  // namespace stages
 
 #endif  // STAGES_IO_BUFFER_H_
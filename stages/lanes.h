@@ -0,0 +1,152 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Portable 4-wide float lanes (SSE, NEON, or a plain loop elsewhere), for
+// the banks rendering several channels in lock-step.
+
+#ifndef STAGES_LANES_H_
+#define STAGES_LANES_H_
+
+#include "stmlib/stmlib.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define LANES_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LANES_NEON
+#endif
+
+namespace stages {
+
+namespace lanes {
+
+const size_t kWidth = 4;
+
+#if defined(LANES_SSE)
+
+typedef __m128 Float;
+typedef __m128 Mask;
+
+inline Float Load(const float* p) { return _mm_loadu_ps(p); }
+inline void Store(float* p, Float x) { _mm_storeu_ps(p, x); }
+inline Float Set(float x) { return _mm_set1_ps(x); }
+inline Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+inline Float Sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+inline Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+inline Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+inline Mask Lt(Float a, Float b) { return _mm_cmplt_ps(a, b); }
+inline Mask Le(Float a, Float b) { return _mm_cmple_ps(a, b); }
+inline Mask Gt(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+inline Mask Ge(Float a, Float b) { return _mm_cmpge_ps(a, b); }
+inline Mask Eq(Float a, Float b) { return _mm_cmpeq_ps(a, b); }
+inline Mask Ne(Float a, Float b) { return _mm_cmpneq_ps(a, b); }
+inline Mask And(Mask a, Mask b) { return _mm_and_ps(a, b); }
+inline Mask Or(Mask a, Mask b) { return _mm_or_ps(a, b); }
+inline Mask AndNot(Mask a, Mask b) { return _mm_andnot_ps(b, a); }
+inline Float Select(Mask m, Float a, Float b) {
+  return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+
+#elif defined(LANES_NEON)
+
+typedef float32x4_t Float;
+typedef uint32x4_t Mask;
+
+inline Float Load(const float* p) { return vld1q_f32(p); }
+inline void Store(float* p, Float x) { vst1q_f32(p, x); }
+inline Float Set(float x) { return vdupq_n_f32(x); }
+inline Float Add(Float a, Float b) { return vaddq_f32(a, b); }
+inline Float Sub(Float a, Float b) { return vsubq_f32(a, b); }
+inline Float Mul(Float a, Float b) { return vmulq_f32(a, b); }
+#if defined(__aarch64__)
+inline Float Div(Float a, Float b) { return vdivq_f32(a, b); }
+#else
+inline Float Div(Float a, Float b) {
+  // No division on 32-bit NEON: reciprocal estimate and two Newton steps.
+  Float r = vrecpeq_f32(b);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  return vmulq_f32(a, r);
+}
+#endif
+inline Mask Lt(Float a, Float b) { return vcltq_f32(a, b); }
+inline Mask Le(Float a, Float b) { return vcleq_f32(a, b); }
+inline Mask Gt(Float a, Float b) { return vcgtq_f32(a, b); }
+inline Mask Ge(Float a, Float b) { return vcgeq_f32(a, b); }
+inline Mask Eq(Float a, Float b) { return vceqq_f32(a, b); }
+inline Mask Ne(Float a, Float b) { return vmvnq_u32(vceqq_f32(a, b)); }
+inline Mask And(Mask a, Mask b) { return vandq_u32(a, b); }
+inline Mask Or(Mask a, Mask b) { return vorrq_u32(a, b); }
+inline Mask AndNot(Mask a, Mask b) { return vbicq_u32(a, b); }
+inline Float Select(Mask m, Float a, Float b) { return vbslq_f32(m, a, b); }
+
+#else
+
+struct Float {
+  float x[kWidth];
+};
+
+struct Mask {
+  bool x[kWidth];
+};
+
+#define LANES_MAP(result, expression) \
+  for (size_t i = 0; i < kWidth; ++i) { \
+    result.x[i] = expression; \
+  }
+
+inline Float Load(const float* p) { Float r; LANES_MAP(r, p[i]); return r; }
+inline void Store(float* p, Float a) { for (size_t i = 0; i < kWidth; ++i) { p[i] = a.x[i]; } }
+inline Float Set(float a) { Float r; LANES_MAP(r, a); return r; }
+inline Float Add(Float a, Float b) { Float r; LANES_MAP(r, a.x[i] + b.x[i]); return r; }
+inline Float Sub(Float a, Float b) { Float r; LANES_MAP(r, a.x[i] - b.x[i]); return r; }
+inline Float Mul(Float a, Float b) { Float r; LANES_MAP(r, a.x[i] * b.x[i]); return r; }
+inline Float Div(Float a, Float b) { Float r; LANES_MAP(r, a.x[i] / b.x[i]); return r; }
+inline Mask Lt(Float a, Float b) { Mask r; LANES_MAP(r, a.x[i] < b.x[i]); return r; }
+inline Mask Le(Float a, Float b) { Mask r; LANES_MAP(r, a.x[i] <= b.x[i]); return r; }
+inline Mask Gt(Float a, Float b) { Mask r; LANES_MAP(r, a.x[i] > b.x[i]); return r; }
+inline Mask Ge(Float a, Float b) { Mask r; LANES_MAP(r, a.x[i] >= b.x[i]); return r; }
+inline Mask Eq(Float a, Float b) { Mask r; LANES_MAP(r, a.x[i] == b.x[i]); return r; }
+inline Mask Ne(Float a, Float b) { Mask r; LANES_MAP(r, a.x[i] != b.x[i]); return r; }
+inline Mask And(Mask a, Mask b) { Mask r; LANES_MAP(r, a.x[i] && b.x[i]); return r; }
+inline Mask Or(Mask a, Mask b) { Mask r; LANES_MAP(r, a.x[i] || b.x[i]); return r; }
+inline Mask AndNot(Mask a, Mask b) { Mask r; LANES_MAP(r, a.x[i] && !b.x[i]); return r; }
+inline Float Select(Mask m, Float a, Float b) {
+  Float r;
+  LANES_MAP(r, m.x[i] ? a.x[i] : b.x[i]);
+  return r;
+}
+
+#undef LANES_MAP
+
+#endif
+
+}  // namespace lanes
+
+}  // namespace stages
+
+#endif  // STAGES_LANES_H_
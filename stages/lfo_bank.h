@@ -0,0 +1,228 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Bank of free-running LFOs, rendered several channels at a time.
+//
+// This does exactly what SegmentGenerator::ProcessFreeRunningLFO does, but
+// the state of all the LFOs is stored as a structure of arrays, so that the
+// per-sample work (phase increment and spline waveshaping) runs on SIMD lanes
+// (see lanes.h). The per-block work (frequency and waveshape breakpoints) is
+// shared with SegmentGenerator.
+//
+// Audio-rate LFOs use the variable shape oscillator instead, and are not
+// handled here.
+
+#ifndef STAGES_LFO_BANK_H_
+#define STAGES_LFO_BANK_H_
+
+#include "stmlib/stmlib.h"
+
+#include <algorithm>
+
+#include "stages/lanes.h"
+#include "stages/modes.h"
+#include "stages/segment_generator.h"
+
+namespace stages {
+
+// Rounded up to a whole number of SIMD lanes.
+const int kMaxNumLfoBankLanes = \
+    (kMaxNumSegments + lanes::kWidth - 1) / lanes::kWidth * lanes::kWidth;
+
+class LfoBank {
+ public:
+  LfoBank() { }
+  ~LfoBank() { }
+
+  void Init(MultiMode multimode, float sample_rate = kSampleRate) {
+    multimode_ = multimode;
+    sample_rate_ = sample_rate;
+    num_lanes_ = 0;
+    std::fill(&phase_[0], &phase_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&frequency_[0], &frequency_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&attack_[0], &attack_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&attack_slope_[0], &attack_slope_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&attack_end_[0], &attack_end_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&release_[0], &release_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&release_slope_[0], &release_slope_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&up_slope_[0], &up_slope_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&down_slope_[0], &down_slope_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&amplitude_[0], &amplitude_[kMaxNumLfoBankLanes], 0.0f);
+    std::fill(&offset_[0], &offset_[kMaxNumLfoBankLanes], 0.0f);
+  }
+
+  // Returns the index of the new lane, or -1 if the bank is full or if the
+  // configuration is not a free-running LFO this bank can render.
+  int AddLane(const segment::Configuration& configuration) {
+    if (num_lanes_ == kMaxNumLfoBankLanes ||
+        configuration.type != segment::TYPE_RAMP ||
+        !configuration.loop ||
+        configuration.range == segment::RANGE_AUDIO) {
+      return -1;
+    }
+    int lane = num_lanes_++;
+    range_[lane] = configuration.range;
+    bool bipolar = configuration.bipolar;
+    amplitude_[lane] = bipolar ? 10.0f / 16.0f : 0.5f;
+    offset_[lane] = bipolar ? 0.0f : 0.5f;
+    primary_[lane] = secondary_[lane] = 0.0f;
+    return lane;
+  }
+
+  inline void set_parameters(int lane, float primary, float secondary) {
+    primary_[lane] = primary;
+    secondary_[lane] = secondary;
+  }
+
+  inline int num_lanes() const { return num_lanes_; }
+
+  // Renders size samples for each lane, to out[lane].
+  void Process(SegmentGenerator::Output* const* out, size_t size) {
+    for (int lane = 0; lane < num_lanes_; ++lane) {
+      ComputeShape(lane);
+    }
+    for (int lane = 0; lane < num_lanes_; lane += lanes::kWidth) {
+      ProcessLanes(lane, out, size);
+    }
+  }
+
+ private:
+  void ComputeShape(int lane) {
+    float frequency = SegmentGenerator::LFOFrequency(
+        primary_[lane], range_[lane], multimode_, sample_rate_);
+    SegmentGenerator::SplineLFOShape s;
+    if (SegmentGenerator::IsAudioRate(frequency, sample_rate_)) {
+      SegmentGenerator::ComputeSplineLFOShape<true>(
+          secondary_[lane], frequency, &s);
+    } else {
+      SegmentGenerator::ComputeSplineLFOShape<false>(
+          secondary_[lane], frequency, &s);
+    }
+    frequency_[lane] = frequency;
+    attack_[lane] = s.attack;
+    attack_slope_[lane] = s.attack_slope;
+    attack_end_[lane] = s.attack + s.pw;
+    release_[lane] = s.release;
+    release_slope_[lane] = s.release_slope;
+    up_slope_[lane] = s.up_slope;
+    down_slope_[lane] = s.down_slope;
+  }
+
+  // Same expression as spline() in segment_generator.cc, so that the results
+  // are identical.
+  static inline lanes::Float Spline(
+      lanes::Float y1, lanes::Float k1, lanes::Float y2, lanes::Float k2,
+      lanes::Float t) {
+    using namespace lanes;
+    Float r = Sub(Set(1.0f), t);
+    Float d = Sub(y2, y1);
+    return Add(
+        Add(Mul(r, y1), Mul(t, y2)),
+        Mul(Mul(t, r), Add(Mul(r, Sub(k1, d)), Mul(t, Sub(d, k2)))));
+  }
+
+  void ProcessLanes(
+      int first_lane,
+      SegmentGenerator::Output* const* out,
+      size_t size) {
+    using namespace lanes;
+    const Float one = Set(1.0f);
+    const Float minus_one = Set(-1.0f);
+
+    const Float frequency = Load(&frequency_[first_lane]);
+    const Float attack = Load(&attack_[first_lane]);
+    const Float attack_slope = Load(&attack_slope_[first_lane]);
+    const Float attack_end = Load(&attack_end_[first_lane]);
+    const Float release = Load(&release_[first_lane]);
+    const Float release_slope = Load(&release_slope_[first_lane]);
+    const Float up_slope = Load(&up_slope_[first_lane]);
+    const Float down_slope = Load(&down_slope_[first_lane]);
+    const Float amplitude = Load(&amplitude_[first_lane]);
+    const Float offset = Load(&offset_[first_lane]);
+    Float phase = Load(&phase_[first_lane]);
+
+    const size_t num_lanes = std::min(
+        size_t(num_lanes_ - first_lane), kWidth);
+    float phase_out[kWidth];
+    float value_out[kWidth];
+
+    for (size_t i = 0; i < size; ++i) {
+      phase = Add(phase, frequency);
+      phase = Select(Ge(phase, one), Sub(phase, one), phase);
+
+      // Both sides of spline_lfo() are evaluated, and the lanes pick theirs.
+      Float rise = Spline(
+          minus_one, up_slope, one, up_slope, Mul(phase, attack_slope));
+      rise = Select(Gt(phase, attack), one, rise);
+
+      Float t = Sub(phase, attack_end);
+      Float fall = Spline(
+          one, down_slope, minus_one, down_slope, Mul(t, release_slope));
+      fall = Select(Ge(t, release), minus_one, fall);
+
+      Float value = Select(Le(phase, attack_end), rise, fall);
+      value = Add(Mul(amplitude, value), offset);
+
+      Store(phase_out, phase);
+      Store(value_out, value);
+      for (size_t lane = 0; lane < num_lanes; ++lane) {
+        SegmentGenerator::Output* o = &out[first_lane + lane][i];
+        o->phase = phase_out[lane];
+        o->value = value_out[lane];
+        o->segment = phase_out[lane] < 0.5f ? 0 : 1;
+      }
+    }
+    Store(&phase_[first_lane], phase);
+  }
+
+  MultiMode multimode_;
+  float sample_rate_;
+  int num_lanes_;
+
+  // Per-lane settings.
+  segment::FreqRange range_[kMaxNumLfoBankLanes];
+  float primary_[kMaxNumLfoBankLanes];
+  float secondary_[kMaxNumLfoBankLanes];
+
+  // Per-lane state, and per-block values, in the layout used by the lanes.
+  float phase_[kMaxNumLfoBankLanes];
+  float frequency_[kMaxNumLfoBankLanes];
+  float attack_[kMaxNumLfoBankLanes];
+  float attack_slope_[kMaxNumLfoBankLanes];
+  float attack_end_[kMaxNumLfoBankLanes];
+  float release_[kMaxNumLfoBankLanes];
+  float release_slope_[kMaxNumLfoBankLanes];
+  float up_slope_[kMaxNumLfoBankLanes];
+  float down_slope_[kMaxNumLfoBankLanes];
+  float amplitude_[kMaxNumLfoBankLanes];
+  float offset_[kMaxNumLfoBankLanes];
+
+  DISALLOW_COPY_AND_ASSIGN(LfoBank);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_LFO_BANK_H_
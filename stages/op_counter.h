@@ -0,0 +1,155 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Operation counter, for estimating the cost of the process functions on the
+// Cortex-M4 from a host build (see test/stages_budget.cc).
+//
+// When STAGES_COUNT_OPS is not defined (firmware and regular test builds),
+// this compiles to nothing. When it is defined, the stmlib helpers used in
+// the process functions are shadowed, in the stages namespace, by versions
+// that count their invocations, ONE_POLE is redefined to count its
+// arithmetic, and the COUNT_OP macros scattered in segment_generator.cc
+// account for the arithmetic done inline.
+
+#ifndef STAGES_OP_COUNTER_H_
+#define STAGES_OP_COUNTER_H_
+
+#include "stmlib/stmlib.h"
+
+#ifdef STAGES_COUNT_OPS
+
+#include <algorithm>
+
+#include "stmlib/dsp/dsp.h"
+#include "stmlib/dsp/parameter_interpolator.h"
+#include "stmlib/dsp/units.h"
+
+#endif  // STAGES_COUNT_OPS
+
+namespace stages {
+
+enum Op {
+  OP_BLOCK,  // Call to a process function.
+  OP_SAMPLE,  // Loop overhead and stores to the output, per sample.
+  OP_FLOAT,  // Single precision add, multiply or compare.
+  OP_DIVISION,  // Single precision division (including by a constant).
+  OP_LUT,  // Table lookup, with or without interpolation.
+  OP_SEMITONES_TO_RATIO,
+  OP_RANDOM,
+  OP_BRANCH,  // Data-dependent branch (segment change, gate edge...).
+  OP_LAST
+};
+
+#ifdef STAGES_COUNT_OPS
+
+class OpCounter {
+ public:
+  static inline void Reset() {
+    std::fill(&count()[0], &count()[OP_LAST], 0);
+    *instrumented() = false;
+  }
+
+  static inline void Add(Op op, size_t n) {
+    count()[op] += n;
+    if (op != OP_BLOCK && op != OP_SAMPLE) {
+      *instrumented() = true;
+    }
+  }
+
+  static inline size_t Get(Op op) {
+    return count()[op];
+  }
+
+  // True if anything besides the call and per-sample overhead was counted
+  // since the last reset, even zero operations.
+  static inline bool Instrumented() {
+    return *instrumented();
+  }
+
+ private:
+  static inline size_t* count() {
+    static size_t count_[OP_LAST];
+    return count_;
+  }
+
+  static inline bool* instrumented() {
+    static bool instrumented_;
+    return &instrumented_;
+  }
+};
+
+#define COUNT_OP(op) OpCounter::Add(op, 1)
+#define COUNT_OPS(op, n) OpCounter::Add(op, n)
+
+// Counting versions of the stmlib helpers. Unqualified calls from the stages
+// namespace pick these instead of the ones brought by "using namespace".
+
+inline float SemitonesToRatio(float semitones) {
+  COUNT_OP(OP_SEMITONES_TO_RATIO);
+  return stmlib::SemitonesToRatio(semitones);
+}
+
+template<typename T>
+inline float Interpolate(const T* table, float index, float size) {
+  COUNT_OP(OP_LUT);
+  return stmlib::Interpolate(table, index, size);
+}
+
+class ParameterInterpolator : public stmlib::ParameterInterpolator {
+ public:
+  ParameterInterpolator(float* state, float new_value, size_t size)
+      : stmlib::ParameterInterpolator(state, new_value, size) {
+    COUNT_OP(OP_FLOAT);
+    COUNT_OP(OP_DIVISION);
+  }
+
+  inline float Next() {
+    COUNT_OP(OP_FLOAT);
+    return stmlib::ParameterInterpolator::Next();
+  }
+
+  inline float subsample(float t) {
+    COUNT_OPS(OP_FLOAT, 2);
+    return stmlib::ParameterInterpolator::subsample(t);
+  }
+};
+
+// A subtraction, a multiplication and an addition.
+#undef ONE_POLE
+#define ONE_POLE(out, in, coefficient) \
+    out += (::stages::OpCounter::Add(::stages::OP_FLOAT, 3), \
+            (coefficient) * ((in) - out));
+
+#else
+
+#define COUNT_OP(op)
+#define COUNT_OPS(op, n)
+
+#endif  // STAGES_COUNT_OPS
+
+}  // namespace stages
+
+#endif  // STAGES_OP_COUNTER_H_
@@ -0,0 +1,180 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Delay line with a fixed amount of memory, storing its samples with 16 bits,
+// 12 bits (two samples packed in three bytes), or 8 bits (mu-law). The lower
+// the resolution, the longer the delay. The format is a template parameter,
+// as in clouds/dsp/audio_buffer.h, so that reads and writes do not test it.
+//
+// Same interface as DelayLine16Bits: the samples are in [-1, 1], and Read()
+// interpolates linearly between the two samples around the delay.
+
+#ifndef STAGES_PACKED_DELAY_LINE_H_
+#define STAGES_PACKED_DELAY_LINE_H_
+
+#include "stmlib/stmlib.h"
+#include "stmlib/dsp/dsp.h"
+
+namespace stages {
+
+enum DelayLineFormat {
+  DELAY_LINE_FORMAT_16_BIT,
+  DELAY_LINE_FORMAT_12_BIT,
+  DELAY_LINE_FORMAT_MU_LAW,
+  DELAY_LINE_FORMAT_LAST
+};
+
+// G.711 mu-law, on the 14 most significant bits of a 16-bit sample. The
+// quantization step goes from 8 LSBs around 0 to 1024 LSBs at full scale.
+inline uint8_t Lin2MuLaw(int16_t sample) {
+  int32_t pcm = sample >> 2;
+  uint8_t mask = 0xff;
+  if (pcm < 0) {
+    pcm = -pcm;
+    mask = 0x7f;
+  }
+  // Keeps the biased value below 0x2000, in the last segment.
+  if (pcm > 8158) {
+    pcm = 8158;
+  }
+  pcm += 0x84 >> 2;
+  int32_t segment = 0;
+  while (segment < 7 && pcm >= (0x40 << segment)) {
+    ++segment;
+  }
+  return static_cast<uint8_t>(
+      ((segment << 4) | ((pcm >> (segment + 1)) & 0x0f)) ^ mask);
+}
+
+inline int16_t MuLaw2Lin(uint8_t u) {
+  u = ~u;
+  int32_t t = (((u & 0x0f) << 3) + 0x84) << ((u & 0x70) >> 4);
+  return static_cast<int16_t>(u & 0x80 ? 0x84 - t : t - 0x84);
+}
+
+template<size_t size, DelayLineFormat format>
+class PackedDelayLine {
+ public:
+  PackedDelayLine() { }
+  ~PackedDelayLine() { }
+
+  // Fills the line with value.
+  void Init(float value) {
+    int16_t word = Quantize(value);
+    for (size_t i = 0; i < capacity(); ++i) {
+      Store(i, word);
+    }
+    write_ptr_ = 0;
+  }
+
+  // Same, without the cost of filling the line: only the samples written
+  // after this can be read.
+  inline void Restart() {
+    write_ptr_ = 0;
+  }
+
+  // Number of samples stored.
+  static inline size_t capacity() {
+    return format == DELAY_LINE_FORMAT_16_BIT
+        ? size / 2
+        : (format == DELAY_LINE_FORMAT_12_BIT ? size / 3 * 2 : size);
+  }
+
+  inline void Write(const float sample) {
+    Store(write_ptr_, Quantize(sample));
+    write_ptr_ = write_ptr_ == 0 ? capacity() - 1 : write_ptr_ - 1;
+  }
+
+  // delay is at most capacity() - 1.
+  inline float Read(float delay) const {
+    MAKE_INTEGRAL_FRACTIONAL(delay)
+    // Read(1.0f) is the last sample written.
+    size_t read_ptr = write_ptr_ + delay_integral;
+    if (read_ptr >= capacity()) {
+      read_ptr -= capacity();
+    }
+    size_t next_ptr = read_ptr + 1;
+    if (next_ptr >= capacity()) {
+      next_ptr -= capacity();
+    }
+    float a = static_cast<float>(Load(read_ptr)) / 32768.0f;
+    float b = static_cast<float>(Load(next_ptr)) / 32768.0f;
+    return a + (b - a) * delay_fractional;
+  }
+
+ private:
+  static inline int16_t Quantize(float sample) {
+    int32_t word = static_cast<int32_t>(sample * 32768.0f);
+    CONSTRAIN(word, -32768, 32767);
+    return word;
+  }
+
+  inline void Store(size_t index, int16_t word) {
+    if (format == DELAY_LINE_FORMAT_16_BIT) {
+      line_.s16[index] = word;
+    } else if (format == DELAY_LINE_FORMAT_12_BIT) {
+      // Samples 2n and 2n + 1 share the middle byte of bytes 3n to 3n + 2.
+      uint16_t u = static_cast<uint16_t>(word) >> 4;
+      uint8_t* p = &line_.u8[(index >> 1) * 3];
+      if (index & 1) {
+        p[1] = (p[1] & 0x0f) | ((u & 0x0f) << 4);
+        p[2] = u >> 4;
+      } else {
+        p[0] = u & 0xff;
+        p[1] = (p[1] & 0xf0) | (u >> 8);
+      }
+    } else {
+      line_.u8[index] = Lin2MuLaw(word);
+    }
+  }
+
+  inline int16_t Load(size_t index) const {
+    if (format == DELAY_LINE_FORMAT_16_BIT) {
+      return line_.s16[index];
+    } else if (format == DELAY_LINE_FORMAT_12_BIT) {
+      const uint8_t* p = &line_.u8[(index >> 1) * 3];
+      uint16_t u = index & 1
+          ? (p[1] >> 4) | (p[2] << 4)
+          : p[0] | ((p[1] & 0x0f) << 8);
+      return static_cast<int16_t>(u << 4);
+    } else {
+      return MuLaw2Lin(line_.u8[index]);
+    }
+  }
+
+  size_t write_ptr_;
+
+  union {
+    int16_t s16[size / 2];
+    uint8_t u8[size];
+  } line_;
+
+  DISALLOW_COPY_AND_ASSIGN(PackedDelayLine);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_PACKED_DELAY_LINE_H_
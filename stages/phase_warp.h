@@ -0,0 +1,119 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Curve applied to the phase of the segments. The shape only depends on the
+// curve parameter, which changes at control rate: Init() does the per-block
+// work, and Warp() the per-sample work.
+//
+// Warp() has one division per sample. When STAGES_FAST_PHASE_WARP is defined,
+// it is replaced by a reciprocal estimate refined by two Newton-Raphson
+// iterations. The error on the warped phase is then below 1e-5 over the
+// whole range of phase and curve (see TestPhaseWarp in stages_test.cc).
+// The firmware makefile defines it, since the division is the slower option
+// on the Cortex-M4. The host builds keep the exact division, which is faster
+// on x86; only the op-count budget uses the fast path, to match the firmware.
+
+#ifndef STAGES_PHASE_WARP_H_
+#define STAGES_PHASE_WARP_H_
+
+#include "stmlib/stmlib.h"
+
+#include "stages/op_counter.h"
+
+namespace stages {
+
+const float kMaxPhaseWarpError = 1e-5f;
+
+class PhaseWarp {
+ public:
+  PhaseWarp() { }
+  ~PhaseWarp() { }
+
+  inline void Init(float curve) {
+    curve -= 0.5f;
+    flip_ = curve < 0.0f;
+    a_ = 128.0f * curve * curve;
+    one_plus_a_ = 1.0f + a_;
+    COUNT_OPS(OP_FLOAT, 4);
+  }
+
+  inline float Warp(float t) const {
+#ifdef STAGES_FAST_PHASE_WARP
+    return WarpFast(t);
+#else
+    return WarpExact(t);
+#endif  // STAGES_FAST_PHASE_WARP
+  }
+
+  inline float WarpExact(float t) const {
+    if (flip_) {
+      t = 1.0f - t;
+    }
+    t = one_plus_a_ * t / (1.0f + a_ * t);
+    COUNT_OPS(OP_FLOAT, 3);
+    COUNT_OP(OP_DIVISION);
+    if (flip_) {
+      t = 1.0f - t;
+    }
+    return t;
+  }
+
+  inline float WarpFast(float t) const {
+    if (flip_) {
+      t = 1.0f - t;
+    }
+    t = one_plus_a_ * t * Reciprocal(1.0f + a_ * t);
+    COUNT_OPS(OP_FLOAT, 10);
+    if (flip_) {
+      t = 1.0f - t;
+    }
+    return t;
+  }
+
+ private:
+  // x is between 1 and 33. Over that range, the initial estimate is within
+  // 5.1% of 1 / x. Each Newton iteration squares the relative error: 2.6e-3
+  // after the first one, 6.7e-6 after the second, below kMaxPhaseWarpError.
+  static inline float Reciprocal(float x) {
+    union {
+      float f;
+      uint32_t i;
+    } y;
+    y.f = x;
+    y.i = 0x7ef311c7 - y.i;
+    y.f = y.f * (2.0f - x * y.f);
+    y.f = y.f * (2.0f - x * y.f);
+    return y.f;
+  }
+
+  bool flip_;
+  float a_;
+  float one_plus_a_;
+};
+
+}  // namespace stages
+
+#endif  // STAGES_PHASE_WARP_H_
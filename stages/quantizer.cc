@@ -40,12 +40,74 @@ void Quantizer::Init() {
   next_boundary_ = 0;
 }
 
+void Quantizer::Configure(const Scale& scale) {
+  notes_ = scale.notes;
+  span_ = scale.span;
+  num_notes_ = scale.num_notes;
+  enabled_ = notes_ != NULL && num_notes_ != 0 && span_ != 0;
+  if (!enabled_) {
+    return;
+  }
+
+  span_reciprocal_ = (0x7fffffff / span_) + 1;
+  bucket_scale_ = (kNumQuantizerBuckets << 16) / (span_ + 1);
+
+  const int32_t n = num_notes_;
+  for (int32_t i = -2; i < n + 2; ++i) {
+    int32_t octave = (i + 2 * n) / n - 2;
+    note_[i + 2] = notes_[i - octave * n] + octave * span_;
+  }
+
+  // Between two notes, the pitch at equal distance goes to the lower one.
+  for (int32_t i = 2; i < n + 3; ++i) {
+    threshold_[i] = ((note_[i - 1] + note_[i]) >> 1) + 1;
+  }
+  threshold_[n + 3] = 0x7fffffff;
+
+  // All the pitches of bucket b are above b * (span_ + 1) /
+  // kNumQuantizerBuckets, whose nearest note is the first one to try.
+  size_t i = 1;
+  for (int32_t b = 0; b < kNumQuantizerBuckets; ++b) {
+    int32_t pitch = b * (span_ + 1) / kNumQuantizerBuckets;
+    while (pitch >= threshold_[i + 1]) {
+      ++i;
+    }
+    bucket_[b] = i;
+  }
+}
+
 int16_t Quantizer::Process(int16_t pitch, int16_t root) {
   if (!enabled_) {
     return pitch;
   }
   pitch -= root;
 
+  if (pitch >= previous_boundary_ && pitch <= next_boundary_) {
+    pitch = codeword_;
+  } else {
+    int32_t offset = Octave(pitch) * span_;
+    int32_t rel_pitch = pitch - offset;
+    size_t i = bucket_[(rel_pitch * bucket_scale_) >> 16];
+    while (rel_pitch >= threshold_[i + 1]) {
+      ++i;
+    }
+    codeword_ = note_[i] + offset;
+    int16_t previous = note_[i - 1] + offset;
+    int16_t next = note_[i + 1] + offset;
+    previous_boundary_ = (9 * previous + 7 * codeword_) >> 4;
+    next_boundary_ = (9 * next + 7 * codeword_) >> 4;
+    pitch = codeword_;
+  }
+  pitch += root;
+  return pitch;
+}
+
+int16_t Quantizer::ProcessScan(int16_t pitch, int16_t root) {
+  if (!enabled_) {
+    return pitch;
+  }
+  pitch -= root;
+
   if (pitch >= previous_boundary_ && pitch <= next_boundary_) {
     pitch = codeword_;
   } else {
@@ -25,7 +25,17 @@
 //
 // -----------------------------------------------------------------------------
 //
-// Note quantizer
+// Note quantizer.
+//
+// When the pitch leaves the hysteresis window of the current note, the nearest
+// note is looked up in tables built by Configure(): the notes of the scale
+// extended by two notes of the previous and next octaves, the pitches at
+// which the nearest note changes, and, for kNumQuantizerBuckets slices of the
+// octave, the first note to try. With the scales of quantizer_scales.h, there
+// is at most one change of note per slice, so a miss costs a table lookup and
+// one or two comparisons, whatever the number of notes. ProcessScan() is the
+// original linear scan of the notes, kept as a reference for the tests.
+
 #ifndef STAGES_QUANTIZER_H_
 #define STAGES_QUANTIZER_H_
 
@@ -33,11 +43,15 @@
 
 namespace stages {
 
+const size_t kMaxNumNotes = 16;
+const int kNumQuantizerBuckets = 32;
+
+// The notes are in ascending order, between 0 and span.
 struct Scale {
   int16_t span;
   //uint8_t num_notes;
   size_t num_notes;
-  int16_t notes[16];
+  int16_t notes[kMaxNumNotes];
 };
 
 const float eight_octaves = static_cast<float>((12 << 7) * 8);
@@ -58,14 +72,23 @@ class Quantizer {
 
   int16_t Process(int16_t pitch, int16_t root);
 
-  void Configure(const Scale& scale) {
-    notes_ = scale.notes;
-    span_ = scale.span;
-    num_notes_ = scale.num_notes;
-    enabled_ = notes_ != NULL && num_notes_ != 0 && span_ != 0;
-  }
+  // Same output as Process(), with a linear scan of the notes on each miss.
+  int16_t ProcessScan(int16_t pitch, int16_t root);
+
+  // Builds the lookup tables: only call it when the scale changes.
+  void Configure(const Scale& scale);
 
  private:
+  // pitch / span_ - (pitch < 0 ? 1 : 0), with a multiplication by the
+  // reciprocal of span_. Exact for all 16-bit pitches.
+  inline int32_t Octave(int32_t pitch) const {
+    return pitch >= 0
+        ? static_cast<int32_t>(
+              (static_cast<uint64_t>(pitch) * span_reciprocal_) >> 31)
+        : -static_cast<int32_t>(
+              (static_cast<uint64_t>(-pitch) * span_reciprocal_) >> 31) - 1;
+  }
+
   bool enabled_;
   int16_t codeword_;
   int16_t previous_boundary_;
@@ -74,6 +97,16 @@ class Quantizer {
   int16_t span_;
   uint8_t num_notes_;
 
+  uint32_t span_reciprocal_;
+  int32_t bucket_scale_;
+  // note_[i + 2] is the i-th note of the scale, for i from -2 to num_notes_
+  // + 1. Notes -1 to num_notes_ can be the nearest note of a pitch.
+  int16_t note_[kMaxNumNotes + 4];
+  // Pitch, relative to the octave, from which note_[i] is nearer than
+  // note_[i - 1], for i from 2 to num_notes_ + 2, followed by a sentinel.
+  int32_t threshold_[kMaxNumNotes + 4];
+  uint8_t bucket_[kNumQuantizerBuckets];
+
   DISALLOW_COPY_AND_ASSIGN(Quantizer);
 };
 
@@ -0,0 +1,216 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Random number stream of a segment generator. Each generator has its own
+// stream, so that a render only depends on the seed of its generator, and not
+// on the order in which the channels are processed.
+//
+// The stream is the LCG of stmlib::Random: seeded with the same value, it
+// gives the same words, in the same order.
+//
+// The noise segments take their values by blocks. The LCG is then split into
+// kRandomLanes interleaved lanes, which all start from the current state and
+// jump kRandomLanes steps at a time. The lanes don't depend on each other, so
+// the compiler puts them in vector registers on the host.
+
+#ifndef STAGES_RANDOM_STREAM_H_
+#define STAGES_RANDOM_STREAM_H_
+
+#include "stmlib/stmlib.h"
+
+#include "stages/op_counter.h"
+
+namespace stages {
+
+const size_t kRandomLanes = 8;
+
+// x[n + k] = a^k x[n] + c (a^(k - 1) + ... + a + 1), for k = 1 to 8, with
+// a = 1664525 and c = 1013904223.
+const uint32_t kLaneMultiplier[kRandomLanes] = {
+  0x0019660d, 0x17385ca9, 0xaf490a95, 0x0979e791,
+  0xaa9d885d, 0xbf69fab9, 0x6e587165, 0xea890021
+};
+
+const uint32_t kLaneIncrement[kRandomLanes] = {
+  0x3c6ef35f, 0x47502932, 0xd1ccf6e9, 0xaaf95334,
+  0x6252e503, 0x9f2ec686, 0x57fe6c2d, 0xa3d95fa8
+};
+
+// The sum of four uniform 16-bit values has a mean of 2 * 65536 and a standard
+// deviation of 0.57735 * 65536. Almost normal values have a mean of 0 and a
+// standard deviation of 1.
+const float kAlmostNormalOffset = 3.4641032f;
+const float kAlmostNormalScale = 1.0f / 37837.21f;
+
+// Is it normal? Almost! This gives a shockingly good approximation of a normal
+// distribution, doesn't use any exps, logs, cos, etc., and doesn't
+// occasionally take a bunch of iterations. a and b are two random words.
+inline float AlmostNormal(uint32_t a, uint32_t b) {
+  // The sum fits in 18 bits: the signed conversion is exact, and can be
+  // vectorized on the host.
+  int32_t sum = (a >> 16) + (a & 0xffff) + (b >> 16) + (b & 0xffff);
+  return static_cast<float>(sum) * kAlmostNormalScale - kAlmostNormalOffset;
+}
+
+// Seed of the stream of a channel, when all the channels are seeded from the
+// same value. Channel 0 uses the seed itself.
+inline uint32_t ChannelSeed(uint32_t seed, int channel) {
+  return seed ^ (static_cast<uint32_t>(channel) * 0x9e3779b9);
+}
+
+// Seed of a module of a chain, when all the modules are seeded from the same
+// value (host simulations). The first module uses the seed itself.
+inline uint32_t UnitSeed(uint32_t seed, int position) {
+  return seed ^ (static_cast<uint32_t>(position) * 0x85ebca6b);
+}
+
+class RandomStream {
+ public:
+  RandomStream() { }
+  ~RandomStream() { }
+
+  inline void Seed(uint32_t seed) {
+    state_ = seed;
+  }
+
+  inline uint32_t state() const { return state_; }
+
+  inline uint32_t GetWord() {
+    COUNT_OP(OP_RANDOM);
+    state_ = state_ * 1664525L + 1013904223L;
+    return state_;
+  }
+
+  inline int16_t GetSample() {
+    return static_cast<int16_t>(GetWord() >> 16);
+  }
+
+  inline float GetFloat() {
+    return ToFloat(GetWord());
+  }
+
+  // Same value as GetFloat() * scale + offset. The conversion and the scale
+  // are folded into a single multiplication.
+  inline float GetFloat(float scale, float offset) {
+    COUNT_OPS(OP_FLOAT, 2);
+    return static_cast<float>(GetWord()) * (scale / 4294967296.0f) + offset;
+  }
+
+  // Same words as size successive calls to GetWord().
+  void GetWords(uint32_t* out, size_t size) {
+    if (!size) {
+      return;
+    }
+    uint32_t lane[kRandomLanes];
+    Load(lane);
+    COUNT_OPS(OP_RANDOM, size);
+    for (; size > kRandomLanes; size -= kRandomLanes) {
+      for (size_t i = 0; i < kRandomLanes; ++i) {
+        out[i] = lane[i];
+      }
+      Advance(lane);
+      out += kRandomLanes;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = lane[i];
+    }
+    state_ = lane[size - 1];
+  }
+
+  // Same values as GetFloat() * scale + offset.
+  void GetFloats(float* out, size_t size, float scale, float offset) {
+    if (!size) {
+      return;
+    }
+    uint32_t lane[kRandomLanes];
+    Load(lane);
+    COUNT_OPS(OP_RANDOM, size);
+    COUNT_OPS(OP_FLOAT, 2 * size);
+    for (; size > kRandomLanes; size -= kRandomLanes) {
+      for (size_t i = 0; i < kRandomLanes; ++i) {
+        out[i] = ToFloat(lane[i]) * scale + offset;
+      }
+      Advance(lane);
+      out += kRandomLanes;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = ToFloat(lane[i]) * scale + offset;
+    }
+    state_ = lane[size - 1];
+  }
+
+  // Same values as successive calls to AlmostNormal(GetWord(), GetWord()).
+  void GetAlmostNormals(float* out, size_t size) {
+    if (!size) {
+      return;
+    }
+    const size_t kValuesPerStep = kRandomLanes / 2;
+    uint32_t lane[kRandomLanes];
+    Load(lane);
+    COUNT_OPS(OP_RANDOM, 2 * size);
+    COUNT_OPS(OP_FLOAT, 2 * size);
+    for (; size > kValuesPerStep; size -= kValuesPerStep) {
+      for (size_t i = 0; i < kValuesPerStep; ++i) {
+        out[i] = AlmostNormal(lane[2 * i], lane[2 * i + 1]);
+      }
+      Advance(lane);
+      out += kValuesPerStep;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = AlmostNormal(lane[2 * i], lane[2 * i + 1]);
+    }
+    state_ = lane[2 * size - 1];
+  }
+
+ private:
+  static inline float ToFloat(uint32_t word) {
+    return static_cast<float>(word) / 4294967296.0f;
+  }
+
+  // The next kRandomLanes words, all computed from the current state.
+  inline void Load(uint32_t* lane) const {
+    const uint32_t state = state_;
+    for (size_t i = 0; i < kRandomLanes; ++i) {
+      lane[i] = state * kLaneMultiplier[i] + kLaneIncrement[i];
+    }
+  }
+
+  static inline void Advance(uint32_t* lane) {
+    const uint32_t a = kLaneMultiplier[kRandomLanes - 1];
+    const uint32_t c = kLaneIncrement[kRandomLanes - 1];
+    for (size_t i = 0; i < kRandomLanes; ++i) {
+      lane[i] = lane[i] * a + c;
+    }
+  }
+
+  uint32_t state_;
+
+  DISALLOW_COPY_AND_ASSIGN(RandomStream);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_RANDOM_STREAM_H_
@@ -33,7 +33,6 @@
 #include "stmlib/dsp/dsp.h"
 #include "stmlib/dsp/parameter_interpolator.h"
 #include "stmlib/dsp/units.h"
-#include "stmlib/utils/random.h"
 
 #include <cassert>
 #include <cmath>
@@ -43,7 +42,6 @@
 #include "stages/resources.h"
 #include "stmlib/stmlib.h"
 #include "stmlib/utils/gate_flags.h"
-#include "stmlib/utils/random.h"
 
 namespace stages {
 
@@ -51,22 +49,64 @@ using namespace stmlib;
 using namespace std;
 using namespace segment;
 
+// The durations below are in samples at kSampleRate, and scaled in Init().
+
 // Duration of the "tooth" in the output when a trigger is received while the
 // output is high.
-const int kRetrigDelaySamples = 32;
+const float kRetrigDelaySamples = 32.0f;
 
 // S&H delay (for all those sequencers whose CV and GATE outputs are out of
 // sync).
-const size_t kSampleAndHoldDelay = kSampleRate * 2 / 1000;
+const float kSampleAndHoldDelay = kSampleRate * 2 / 1000;
 
 // Clock inhibition following a rising edge on the RESET input
-const size_t kClockInhibitDelay = kSampleRate * 5 / 1000;
+const float kClockInhibitDelay = kSampleRate * 5 / 1000;
 
-void SegmentGenerator::Init(MultiMode multimode, stmlib::HysteresisQuantizer2* step_quantizer) {
-  process_fn_ = &SegmentGenerator::ProcessMultiSegment;
+// Time given to the PLL before switching to or from audio-rate tracking.
+const float kPllCountdown = kSampleRate * 0.25f;
+
+const float default_root_note = 2.0439497f;
+const float root_notes[] = {default_root_note, default_root_note / 16.0f,
+                            default_root_note * 64.0f,
+                            default_root_note * 128.0f};
+
+// Above 16 times the default root note, LFOs are considered to be running at
+// audio rate.
+const float kAudioRateThreshold = 16.0f * default_root_note;
+
+void SegmentGenerator::Init(
+    MultiMode multimode,
+    stmlib::HysteresisQuantizer2* step_quantizer,
+    Pool* pool,
+    int channel,
+    float sample_rate) {
+  process_fn_ = &SegmentGenerator::ProcessMultiSegment<false, false>;
+  gate_edges_ = true;
+  edge_offsets_ = NULL;
 
   multimode_ = multimode;
 
+  // The lookup tables give frequencies and coefficients for kSampleRate.
+  // At 31.25kHz all the scale factors are exactly 1.
+  sample_rate_ = sample_rate;
+  rate_scale_ = kSampleRate / sample_rate;
+  retrig_delay_samples_ = static_cast<int>(
+      kRetrigDelaySamples * sample_rate / kSampleRate);
+  sample_and_hold_delay_ = static_cast<size_t>(
+      kSampleAndHoldDelay * sample_rate / kSampleRate);
+  CONSTRAIN(sample_and_hold_delay_, size_t(1), kMaxSampleAndHoldDelay - 1);
+  clock_inhibit_delay_ = static_cast<int>(
+      kClockInhibitDelay * sample_rate / kSampleRate);
+  pll_countdown_ = static_cast<int>(kPllCountdown * sample_rate / kSampleRate);
+  audio_rate_threshold_ = kAudioRateThreshold / sample_rate;
+  oversampling_ = 1;
+  polyblep_ = false;
+  recorder_decimation_ = static_cast<int>(sample_rate / kRecorderSampleRate);
+  recorder_counter_ = 0;
+  recorder_sum_ = 0.0f;
+  recorder_num_samples_ = 0;
+  recorder_length_ = 0;
+
   phase_ = 0.0f;
   aux_ = 0.0f;
 
@@ -76,8 +116,10 @@ void SegmentGenerator::Init(MultiMode multimode, stmlib::HysteresisQuantizer2* s
 
   start_ = 0.0f;
   value_ = 0.0f;
-  next_ = Random::GetFloat();
+  random_.Seed(ChannelSeed(global_random_seed_, channel));
+  next_ = random_.GetFloat();
   lp_ = 0.0f;
+  previous_ramp_ = 0.0f;
 
   monitored_segment_ = 0;
   active_segment_ = 0;
@@ -99,33 +141,56 @@ void SegmentGenerator::Init(MultiMode multimode, stmlib::HysteresisQuantizer2* s
   s.retrig = true;
   s.range = RANGE_DEFAULT;
   s.quant_scale = 0;
-  s.shift_register = Random::GetSample();
-  s.register_value = Random::GetFloat();
-  fill(&segments_[0], &segments_[kMaxNumSegments + 1], s);
+  s.advance_tm = false;
+
+  ShiftRegister r;
+  r.shift_register = random_.GetSample();
+  r.register_value = random_.GetFloat();
+  r.tm_steps = 0;
 
   Parameters p;
   p.primary = 0.0f;
   p.secondary = 0.0f;
-  fill(&parameters_[0], &parameters_[kMaxNumSegments], p);
+
+  DerivedParameters d;
+  d.secondary = 0.0f;
+  d.stale = DERIVED_ALL;
+
+  // Everything from our first slot to the end of the pool might end up in
+  // one of our groups.
+  int first = 2 * channel;
+  segments_ = &pool->segment[first];
+  shift_registers_ = &pool->shift_register[first];
+  parameters_ = &pool->parameters[first];
+  derived_parameters_ = &pool->derived_parameters[first];
+  fill(&segments_[0], &pool->segment[kSegmentPoolSize], s);
+  fill(&shift_registers_[0], &pool->shift_register[kSegmentPoolSize], r);
+  fill(&parameters_[0], &pool->parameters[kSegmentPoolSize], p);
+  fill(&derived_parameters_[0],
+       &pool->derived_parameters[kSegmentPoolSize], d);
 
   ramp_extractor_.Init(
-      kSampleRate,
-      1000.0f / kSampleRate);
+      sample_rate,
+      1000.0f / sample_rate);
 
-  delay_line_.Init();
+  delay_line_.Init(0.0f);
   gate_delay_.Init();
 
   function_quantizer_.Init(2, 0.025f, false);
   address_quantizer_.Init(2, 0.025f, false);
 
   num_segments_ = 0;
+  smooth_audio_rate_tracking_ = false;
+  ResetPllCounter();
 
   first_step_ = 1;
   last_step_ = 1;
 
-  x_ = Random::GetFloat();
-  y_ = Random::GetFloat();
-  z_ = Random::GetFloat();
+  float x = random_.GetFloat();
+  float y = random_.GetFloat();
+  float z = random_.GetFloat();
+  double_scroll_.Init(x, y, z);
+  thomas_symmetric_.Init(x, y, z);
 
   quantized_output_ = false;
   up_down_counter_ = inhibit_clock_ = 0;
@@ -136,29 +201,19 @@ void SegmentGenerator::Init(MultiMode multimode, stmlib::HysteresisQuantizer2* s
   audio_osc_.Init();
 }
 
-inline float SegmentGenerator::WarpPhase(float t, float curve) const {
-  curve -= 0.5f;
-  const bool flip = curve < 0.0f;
-  if (flip) {
-    t = 1.0f - t;
-  }
-  const float a = 128.0f * curve * curve;
-  t = (1.0f + a) * t / (1.0f + a * t);
-  if (flip) {
-    t = 1.0f - t;
-  }
-  return t;
-}
-
 inline float SegmentGenerator::RateToFrequency(float rate) const {
   int32_t i = static_cast<int32_t>(rate * 2048.0f);
   CONSTRAIN(i, 0, LUT_ENV_FREQUENCY_SIZE);
-  return lut_env_frequency[i];
+  COUNT_OP(OP_LUT);
+  COUNT_OP(OP_FLOAT);
+  return lut_env_frequency[i] * rate_scale_;
 }
 
 inline float SegmentGenerator::PortamentoRateToLPCoefficient(float rate) const {
   int32_t i = static_cast<int32_t>(rate * 512.0f);
-  return lut_portamento_coefficient[i];
+  COUNT_OP(OP_LUT);
+  COUNT_OP(OP_FLOAT);
+  return lut_portamento_coefficient[i] * rate_scale_;
 }
 
 static size_t tm_steps(const float param) {
@@ -167,12 +222,46 @@ static size_t tm_steps(const float param) {
   return steps;
 }
 
+const DerivedParameters& SegmentGenerator::DeriveParameters(
+    int index, uint8_t values) {
+  DerivedParameters* d = &derived_parameters_[index];
+  values &= d->stale;
+  COUNT_OP(OP_BRANCH);
+  if (!values) {
+    return *d;
+  }
+  d->stale &= ~values;
+  if (values & DERIVED_LP_COEFFICIENT) {
+    d->lp_coefficient = PortamentoRateToLPCoefficient(d->secondary);
+  }
+  if (values & DERIVED_DELAY) {
+    d->delay_time = SemitonesToRatio(
+        2.0f * (d->secondary - 0.5f) * 36.0f) * 0.5f * sample_rate_;
+    d->clock_frequency = 1.0f;
+    d->delay_frequency = 1.0f / d->delay_time;
+    COUNT_OP(OP_DIVISION);
+
+    // When the delay is too long for the line, the line is written at a
+    // lower rate.
+    const float max_delay = static_cast<float>(delay_line_.capacity() - 1);
+    if (d->delay_time >= max_delay) {
+      d->clock_frequency = max_delay * d->delay_frequency;
+      d->delay_time = max_delay;
+    }
+  }
+  if (values & DERIVED_TM_STEPS) {
+    d->tm_steps = tm_steps(d->secondary);
+  }
+  return *d;
+}
+
 static float tm_prob(const float param) {
   // Ensures registers lock at extremes
   return 1.02f * param - 0.01f;
 }
 
 static void advance_tm(
+    RandomStream* random,
     size_t steps,
     float prob,
     uint16_t& shift_register,
@@ -180,25 +269,75 @@ static void advance_tm(
     bool bipolar) {
   uint16_t sr = shift_register;
   uint16_t copied_bit = (sr << (steps - 1)) & (1 << 15);
-  uint16_t mutated = copied_bit ^ ((Random::GetFloat() < prob) << 15);
+  uint16_t mutated = copied_bit ^ ((random->GetFloat() < prob) << 15);
   sr = (sr >> 1) | mutated;
   shift_register = sr;
   register_value = (float)(shift_register) / 65535.0f;
+  COUNT_OP(OP_DIVISION);
   if (bipolar) {
     register_value = (10.0f / 8.0f) * (register_value - 0.5f);
   }
 }
 
+// Blocks without gate edges go to a version of the process function compiled
+// without the edge tests, as ProcessMultiSegment does.
+#define DEFINE_PROCESS_FN_WITH_EDGES(X) \
+void SegmentGenerator::Process ## X( \
+    const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) { \
+  if (gate_edges_) { \
+    Render ## X<true>(gate_flags, out, size); \
+  } else { \
+    Render ## X<false>(gate_flags, out, size); \
+  } \
+}
+
 // Seems popular enough :)
 #define TRACK_PREVIOUS_SEGMENT
 
+template<bool ramps_only, bool has_turing>
 void SegmentGenerator::ProcessMultiSegment(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
+  if (oversampling_ != 1) {
+    RenderOversampledMultiSegment<ramps_only, has_turing>(
+        gate_flags, out, size);
+  } else if (gate_edges_) {
+    RenderMultiSegment<ramps_only, has_turing, true>(gate_flags, out, size);
+  } else {
+    // Segments can only be left when they are complete.
+    RenderMultiSegment<ramps_only, has_turing, false>(gate_flags, out, size);
+  }
+}
+
+// The parameters only change between blocks, so that the coefficients of the
+// active segment are only computed at the beginning of the block, and when
+// the active segment changes.
+template<bool ramps_only>
+inline void SegmentGenerator::LoadActiveSegment(ActiveSegment* a) const {
+  const Segment& segment = segments_[active_segment_];
+  a->frequency = ramps_only || segment.time
+      ? RateToFrequency(*segment.time)
+      : 0.0f;
+  a->lp_coefficient = PortamentoRateToLPCoefficient(*segment.portamento);
+  // Ramps are not tracked.
+  a->previous_lp_coefficient = ramps_only
+      ? 0.0f
+      : PortamentoRateToLPCoefficient(*segments_[previous_segment_].portamento);
+  a->warp.Init(*segment.curve);
+}
+
+template<bool ramps_only, bool has_turing, bool gate_edges>
+void SegmentGenerator::RenderMultiSegment(
+    const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
+  const GateFlags* first_gate_flag = gate_flags;
+  Output* const first_out = out;
   float phase = phase_;
   float start = start_;
   float lp = lp_;
   float value = value_;
 
+  ActiveSegment a;
+  LoadActiveSegment<ramps_only>(&a);
+
   while (size--) {
     const Segment& segment = segments_[active_segment_];
 
@@ -208,57 +347,69 @@ void SegmentGenerator::ProcessMultiSegment(
     // If previous.start == previous.end and segment.end = previous.start we
     // can end up with start and end tracking the same value, which would do
     // nothing.
-    if (!segment.start && previous.phase && segment.end != previous.end) {
+    // Ramps don't have phase, so there is nothing to track in a group made
+    // only of ramps.
+    if (!ramps_only &&
+        !segment.start && previous.phase && segment.end != previous.end) {
       // Just setting start to the previous segment's end would cause a jump
       // when, e.g., going from a slewed step to a ramp before the step
       // finishes. In the case where the current segment does not have a start
       // it's set to the last value of the previous segment. Thus, slewing
       // between that and the end tracks what that segment would have done.
-      ONE_POLE(
-          start,
-          *previous.end,
-          PortamentoRateToLPCoefficient(*previous.portamento));
+      ONE_POLE(start, *previous.end, a.previous_lp_coefficient);
     }
 #endif  // TRACK_PREVIOUS_SEGMENT
 
-    if (segment.time) {
-      phase += RateToFrequency(*segment.time);
+    if (ramps_only || segment.time) {
+      phase += a.frequency;
     }
 
     bool complete = phase >= 1.0f;
+    // How far past its end the segment went, in samples.
+    float overshoot = 0.0f;
     if (complete) {
+      if (a.frequency > 0.0f) {
+        overshoot = (phase - 1.0f) / a.frequency;
+        COUNT_OP(OP_DIVISION);
+      }
       phase = 1.0f;
     }
     value = Crossfade(
         start,
         *segment.end,
-        WarpPhase(segment.phase ? *segment.phase : phase, *segment.curve));
+        a.warp.Warp(!ramps_only && segment.phase ? *segment.phase : phase));
 
-    ONE_POLE(lp, value, PortamentoRateToLPCoefficient(*segment.portamento));
+    ONE_POLE(lp, value, a.lp_coefficient);
+    COUNT_OPS(OP_FLOAT, 5);
 
     // Decide what to do next.
     int go_to_segment = -1;
+    bool edge = false;
     // It would probably be better to do retrig with go_to_segments, but that
     // makes single decay segments harder.
-    if ((*gate_flags & GATE_FLAG_RISING) && segment.retrig) {
+    if (gate_edges && (*gate_flags & GATE_FLAG_RISING) && segment.retrig) {
       go_to_segment = segment.if_rising;
-    } else if (*gate_flags & GATE_FLAG_FALLING) {
+      edge = true;
+    } else if (gate_edges && (*gate_flags & GATE_FLAG_FALLING)) {
       go_to_segment = segment.if_falling;
+      edge = true;
     } else if (complete) {
       go_to_segment = segment.if_complete;
     }
 
     if (go_to_segment != -1) {
-      if (previous.advance_tm) {
+      COUNT_OP(OP_BRANCH);
+      if (has_turing && previous.advance_tm) {
         const float steps_param = parameters_[previous_segment_].secondary;
         const float prob_param = parameters_[previous_segment_].primary;
         advance_tm(
-            tm_steps(steps_param), tm_prob(prob_param),
-            (&segments_[previous_segment_])->shift_register,
-            (&segments_[previous_segment_])->register_value,
+            &random_, tm_steps(steps_param), tm_prob(prob_param),
+            shift_registers_[previous_segment_].shift_register,
+            shift_registers_[previous_segment_].register_value,
             previous.bipolar);
       }
       phase = 0.0f;
+      const float lp_coefficient = a.lp_coefficient;
       const Segment& destination = segments_[go_to_segment];
       start = destination.start
           ? *destination.start
@@ -267,6 +418,35 @@ void SegmentGenerator::ProcessMultiSegment(
         previous_segment_ = active_segment_;
       }
       active_segment_ = go_to_segment;
+      LoadActiveSegment<ramps_only>(&a);
+      if (gate_edges && edge && edge_offsets_ && destination.time) {
+        // The segment actually started a fraction of a sample ago.
+        phase = edge_offsets_[gate_flags - first_gate_flag] * a.frequency;
+      } else if (!edge) {
+        // The next segment started when the previous one completed, so that
+        // the duration of a loop is not rounded to a whole number of samples.
+        phase = min(overshoot * a.frequency, 1.0f);
+        if (polyblep_) {
+          // The value jumped overshoot samples ago, but the naive output
+          // only jumps at the next sample. The one-pole filter is fed a
+          // band-limited step instead: the residual of the polyBLEP is added
+          // to the previous sample, and the current one gets the rest of
+          // the step, through the filter.
+          float jump = Crossfade(
+              start,
+              *destination.end,
+              a.warp.Warp(
+                  !ramps_only && destination.phase ? *destination.phase : 0.0f))
+              - value;
+          float t = min(overshoot, 1.0f);
+          float before = 0.5f * t * t * jump;
+          float after = (1.0f - 0.5f * (1.0f - t) * (1.0f - t)) * jump;
+          Output* previous = out == first_out ? &polyblep_previous_ : out - 1;
+          previous->value += lp_coefficient * before;
+          lp += lp_coefficient * ((1.0f - lp_coefficient) * before + after);
+          COUNT_OPS(OP_FLOAT, 16);
+        }
+      }
     }
 
     out->value = lp;
@@ -279,14 +459,107 @@ void SegmentGenerator::ProcessMultiSegment(
   start_ = start;
   lp_ = lp;
   value_ = value;
+
+  if (polyblep_ && out != first_out) {
+    // Delay the output by one sample.
+    Output last = out[-1];
+    copy_backward(first_out, out - 1, out);
+    *first_out = polyblep_previous_;
+    polyblep_previous_ = last;
+    COUNT_OPS(OP_SAMPLE, out - first_out);
+  }
+}
+
+// Longer blocks are rendered in several passes.
+const size_t kMaxOversampledBlockSize = 8;
+
+template<bool ramps_only, bool has_turing>
+void SegmentGenerator::RenderOversampledMultiSegment(
+    const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
+  const int factor = oversampling_;
+  const float rate_scale = rate_scale_;
+  const float* edge_offsets = edge_offsets_;
+
+  GateFlags sub_gate_flags[kMaxOversampledBlockSize * kMaxOversampling];
+  float sub_edge_offsets[kMaxOversampledBlockSize * kMaxOversampling];
+  Output sub_out[kMaxOversampledBlockSize * kMaxOversampling];
+
+  // The group runs at factor times the sample rate.
+  rate_scale_ = rate_scale / float(factor);
+  edge_offsets_ = edge_offsets ? sub_edge_offsets : NULL;
+
+  while (size) {
+    const size_t n = min(size, kMaxOversampledBlockSize);
+    if (gate_edges_) {
+      // An edge goes to the last sub-sample of its sample, or to the
+      // sub-sample in which it occurred when it is timestamped.
+      for (size_t i = 0; i < n; ++i) {
+        const GateFlags flags = gate_flags[i];
+        const bool edge = flags & (GATE_FLAG_RISING | GATE_FLAG_FALLING);
+        int edge_position = factor - 1;
+        if (edge && edge_offsets) {
+          float offset = edge_offsets[i] * float(factor);
+          MAKE_INTEGRAL_FRACTIONAL(offset);
+          CONSTRAIN(offset_integral, 0, factor - 1);
+          edge_position -= offset_integral;
+          sub_edge_offsets[i * factor + edge_position] = offset_fractional;
+        }
+        const GateFlags level = flags & GATE_FLAG_HIGH;
+        const GateFlags before = edge ? level ^ GATE_FLAG_HIGH : level;
+        GateFlags* sub = &sub_gate_flags[i * factor];
+        for (int j = 0; j < factor; ++j) {
+          sub[j] = j < edge_position
+              ? before
+              : (j == edge_position ? flags : level);
+        }
+      }
+      RenderMultiSegment<ramps_only, has_turing, true>(
+          sub_gate_flags, sub_out, n * factor);
+    } else {
+      RenderMultiSegment<ramps_only, has_turing, false>(
+          sub_gate_flags, sub_out, n * factor);
+    }
+
+    const Output* sub = sub_out;
+    for (size_t i = 0; i < n; ++i) {
+      for (int j = 0; j < factor; ++j) {
+        decimator_.Write(sub[j].value);
+      }
+      sub += factor;
+      out[i].value = decimator_.Read();
+      out[i].phase = delayed_phase_[delay_ptr_];
+      out[i].segment = delayed_segment_[delay_ptr_];
+      delayed_phase_[delay_ptr_] = sub[-1].phase;
+      delayed_segment_[delay_ptr_] = sub[-1].segment;
+      delay_ptr_ = delay_ptr_ == kDecimatorDelay - 1 ? 0 : delay_ptr_ + 1;
+    }
+    COUNT_OPS(OP_FLOAT, 3 * kDecimatorTapsPerSample * factor / 2 * n);
+
+    gate_flags += n;
+    if (edge_offsets) {
+      edge_offsets += n;
+    }
+    out += n;
+    size -= n;
+  }
+
+  rate_scale_ = rate_scale;
+  edge_offsets_ = edge_offsets;
 }
 
-void SegmentGenerator::ProcessDecayEnvelope(
+template<bool gate_edges>
+void SegmentGenerator::RenderDecayEnvelope(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   const float frequency = RateToFrequency(parameters_[0].primary);
+  const GateFlags* first_gate_flag = gate_flags;
+  PhaseWarp warp;
+  warp.Init(parameters_[0].secondary);
   while (size--) {
-    if ((*gate_flags & GATE_FLAG_RISING) && (active_segment_ != 0 || segments_[0].retrig)) {
-      phase_ = 0.0f;
+    if (gate_edges && (*gate_flags & GATE_FLAG_RISING) &&
+        (active_segment_ != 0 || segments_[0].retrig)) {
+      phase_ = edge_offsets_
+          ? edge_offsets_[gate_flags - first_gate_flag] * frequency
+          : 0.0f;
       active_segment_ = 0;
     }
 
@@ -295,7 +568,8 @@ void SegmentGenerator::ProcessDecayEnvelope(
       phase_ = 1.0f;
       active_segment_ = 1;
     }
-    lp_ = value_ = 1.0f - WarpPhase(phase_, parameters_[0].secondary);
+    lp_ = value_ = 1.0f - warp.Warp(phase_);
+    COUNT_OPS(OP_FLOAT, 3);
     out->value = lp_;
     out->phase = phase_;
     out->segment = active_segment_;
@@ -304,10 +578,12 @@ void SegmentGenerator::ProcessDecayEnvelope(
   }
 }
 
+DEFINE_PROCESS_FN_WITH_EDGES(DecayEnvelope)
+
 void SegmentGenerator::ProcessRiseAndFall(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   float fall = PortamentoRateToLPCoefficient(local_parameters_[0].slider);
-  float rise = PortamentoRateToLPCoefficient(parameters_[0].secondary);
+  float rise = DeriveParameters(0, DERIVED_LP_COEFFICIENT).lp_coefficient;
   ParameterInterpolator primary(&primary_, local_parameters_[0].cv, size);
   switch (segments_[0].range) {
     // enum is frequency ranges, so flipped for time...
@@ -329,6 +605,7 @@ void SegmentGenerator::ProcessRiseAndFall(
 
   while (size--) {
     value_ = segments_[0].bipolar ? primary.Next() : fabsf(primary.Next());
+    COUNT_OPS(OP_FLOAT, 3);
     if (value_ > lp_) {
       ONE_POLE(lp_, value_, rise);
       phase_ = 0;
@@ -343,14 +620,16 @@ void SegmentGenerator::ProcessRiseAndFall(
   }
 }
 
-void SegmentGenerator::ProcessTimedPulseGenerator(
+template<bool gate_edges>
+void SegmentGenerator::RenderTimedPulseGenerator(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   const float frequency = RateToFrequency(parameters_[0].secondary);
 
   ParameterInterpolator primary(&primary_, parameters_[0].primary, size);
   while (size--) {
-    if ((*gate_flags & GATE_FLAG_RISING) && (active_segment_ != 0 || segments_[0].retrig)) {
-      retrig_delay_ = active_segment_ == 0 ? kRetrigDelaySamples : 0;
+    if (gate_edges && (*gate_flags & GATE_FLAG_RISING) &&
+        (active_segment_ != 0 || segments_[0].retrig)) {
+      retrig_delay_ = active_segment_ == 0 ? retrig_delay_samples_ : 0;
       phase_ = 0.0f;
       active_segment_ = 0;
     }
@@ -362,6 +641,7 @@ void SegmentGenerator::ProcessTimedPulseGenerator(
       phase_ = 1.0f;
       active_segment_ = 1;
     }
+    COUNT_OPS(OP_FLOAT, 2);
 
     const float p = primary.Next();
     lp_ = value_ = active_segment_ == 0 && !retrig_delay_ ? p : 0.0f;
@@ -373,12 +653,16 @@ void SegmentGenerator::ProcessTimedPulseGenerator(
   }
 }
 
-void SegmentGenerator::ProcessGateGenerator(
+DEFINE_PROCESS_FN_WITH_EDGES(TimedPulseGenerator)
+
+template<bool gate_edges>
+void SegmentGenerator::RenderGateGenerator(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   ParameterInterpolator primary(&primary_, parameters_[0].primary, size);
   while (size--) {
-    if (*gate_flags & GATE_FLAG_RISING) {
-      accepted_gate_ = Random::GetFloat() < parameters_[0].secondary * 1.01f;
+    if (gate_edges && (*gate_flags & GATE_FLAG_RISING)) {
+      accepted_gate_ = random_.GetFloat() < parameters_[0].secondary * 1.01f;
+      COUNT_OPS(OP_FLOAT, 2);
     }
     active_segment_ = (*gate_flags & GATE_FLAG_HIGH) && accepted_gate_ ? 0 : 1;
 
@@ -392,13 +676,18 @@ void SegmentGenerator::ProcessGateGenerator(
   }
 }
 
-void SegmentGenerator::ProcessProbabilisticGateGenerator(
+DEFINE_PROCESS_FN_WITH_EDGES(GateGenerator)
+
+template<bool gate_edges>
+void SegmentGenerator::RenderProbabilisticGateGenerator(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   ParameterInterpolator primary(&primary_, parameters_[0].primary, size);
   const float prob = 1.02f * parameters_[0].secondary - 0.01f;
+  COUNT_OPS(OP_FLOAT, 2);
   while (size--) {
-    if (*gate_flags & GATE_FLAG_RISING) {
-      active_segment_ = Random::GetFloat() < prob ? 0 : 1;
+    if (gate_edges && (*gate_flags & GATE_FLAG_RISING)) {
+      active_segment_ = random_.GetFloat() < prob ? 0 : 1;
+      COUNT_OP(OP_FLOAT);
     }
     active_segment_ = (*gate_flags & GATE_FLAG_HIGH) && (active_segment_ == 0) ? 0 : 1;
 
@@ -412,10 +701,12 @@ void SegmentGenerator::ProcessProbabilisticGateGenerator(
   }
 }
 
+DEFINE_PROCESS_FN_WITH_EDGES(ProbabilisticGateGenerator)
+
 void SegmentGenerator::ProcessSampleAndHold(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
-  const float coefficient = PortamentoRateToLPCoefficient(
-      parameters_[0].secondary);
+  const float coefficient = DeriveParameters(
+      0, DERIVED_LP_COEFFICIENT).lp_coefficient;
 
   // If quantizing, interpolation can cause holding the wrong value.
   if (segments_[0].quant_scale > 0) primary_ = parameters_[0].primary;
@@ -424,7 +715,7 @@ void SegmentGenerator::ProcessSampleAndHold(
   while (size--) {
     const float p = primary.Next();
     gate_delay_.Write(*gate_flags);
-    if (gate_delay_.Read(kSampleAndHoldDelay) & GATE_FLAG_RISING) {
+    if (gate_delay_.Read(sample_and_hold_delay_) & GATE_FLAG_RISING) {
       value_ = p;
     }
     active_segment_ = *gate_flags & GATE_FLAG_HIGH ? 0 : 1;
@@ -448,7 +739,7 @@ void SegmentGenerator::ProcessAttSampleAndHold(
   while (size--) {
     const float p = primary.Next();
     gate_delay_.Write(*gate_flags);
-    if (gate_delay_.Read(kSampleAndHoldDelay) & GATE_FLAG_RISING) {
+    if (gate_delay_.Read(sample_and_hold_delay_) & GATE_FLAG_RISING) {
       value_ = p;
     }
     active_segment_ = *gate_flags & GATE_FLAG_HIGH ? 0 : 1;
@@ -464,14 +755,14 @@ void SegmentGenerator::ProcessAttSampleAndHold(
 
 void SegmentGenerator::ProcessTrackAndHold(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
-  const float coefficient = PortamentoRateToLPCoefficient(
-      parameters_[0].secondary);
+  const float coefficient = DeriveParameters(
+      0, DERIVED_LP_COEFFICIENT).lp_coefficient;
   ParameterInterpolator primary(&primary_, parameters_[0].primary, size);
 
   while (size--) {
     const float p = primary.Next();
     gate_delay_.Write(*gate_flags);
-    if (gate_delay_.Read(kSampleAndHoldDelay) & GATE_FLAG_HIGH) {
+    if (gate_delay_.Read(sample_and_hold_delay_) & GATE_FLAG_HIGH) {
       value_ = p;
     }
     active_segment_ = *gate_flags & GATE_FLAG_HIGH ? 0 : 1;
@@ -496,9 +787,12 @@ void SegmentGenerator::ProcessClockedSampleAndHold(
 
       const float reset_time = phase_ / frequency;
       value_ = primary.subsample(1.0f - reset_time);
+      COUNT_OPS(OP_FLOAT, 2);
+      COUNT_OP(OP_DIVISION);
     }
     primary.Next();
     active_segment_ = phase_ < 0.5f ? 0 : 1;
+    COUNT_OPS(OP_FLOAT, 3);
     out->value = value_;
     out->phase = phase_;
     out->segment = active_segment_;
@@ -560,11 +854,22 @@ inline float Log2Fast(float x) {
   return log2f;
 }
 
-const float default_root_note = 2.0439497f;
-const float root_notes[] = {default_root_note, default_root_note / 16.0f,
-                            default_root_note * 64.0f,
-                            default_root_note * 128.0f};
-const float audio_rate_threshold = 16.0f * default_root_note / kSampleRate;
+/* static */
+float SegmentGenerator::LFOFrequency(
+    float primary, FreqRange range, MultiMode multimode, float sample_rate) {
+  float f = 96.0f * (primary - 0.5f);
+  CONSTRAIN(f, -128.0f, 127.0f);
+  float frequency = SemitonesToRatio(f) * root_notes[range] / sample_rate;
+  if (range != RANGE_AUDIO && multimode == MULTI_MODE_STAGES_SLOW_LFO) {
+    frequency /= 8.0f;
+  }
+  return frequency;
+}
+
+/* static */
+bool SegmentGenerator::IsAudioRate(float frequency, float sample_rate) {
+  return frequency > kAudioRateThreshold / sample_rate;
+}
 
 void SegmentGenerator::ProcessOscillator(
     const GateFlags* gate_flags,
@@ -573,7 +878,6 @@ void SegmentGenerator::ProcessOscillator(
 
   float frequency = 0.0f;
   bool freq_is_ar = false;
-  const float root_note = root_notes[segments_[0].range];
   float ramp[size];
   // true: Use triangle -> saw -> square -> pwm pulse fully bandlimited osc
   // false: Use saw -> triangle -> sine -> triangle -> square osc but still
@@ -587,15 +891,21 @@ void SegmentGenerator::ProcessOscillator(
   if (gate_flags && !reset_on_gate_) {
     r = function_quantizer_.Lookup(divider_ratios + divider_ratios_start[range],
                                    parameters_[0].primary * 1.03f);
-    frequency = ramp_extractor_.Process(pll, false, r, gate_flags, ramp, size);
+    frequency = ramp_extractor_.Process(
+        pll, false, r, gate_flags, ramp, size, edge_offsets_);
+    // Not instrumented. Rough figure for the per-sample work of the ramp
+    // extractor outside of gate edges.
+    COUNT_OPS(OP_FLOAT, 12 * size);
     // Check if the phase is actually changing. If its not, then frequency will
     // be positive even though we're missing expected gates. Without this, the
     // segment can flip to audio rate when the user unplugs a patch cable until
     // the module figures out the cable is gone.
-    if (ramp[size - 2] == ramp[size - 1])
+    const float previous_ramp = size > 1 ? ramp[size - 2] : previous_ramp_;
+    if (previous_ramp == ramp[size - 1])
       frequency = 0.0f;
+    previous_ramp_ = ramp[size - 1];
 
-    freq_is_ar = frequency > audio_rate_threshold;
+    freq_is_ar = frequency > audio_rate_threshold_;
     if (smooth_audio_rate_tracking_ != freq_is_ar) {
       pll_counter_ -= size;
       if (pll_counter_ <= 0) {
@@ -605,17 +915,15 @@ void SegmentGenerator::ProcessOscillator(
       ResetPllCounter();
     }
   } else {
-    float f = 96.0f * (parameters_[0].primary - 0.5f);
-    CONSTRAIN(f, -128.0f, 127.0f);
-    frequency = SemitonesToRatio(f) * root_note / kSampleRate;
-    if (!audio_rate && multimode_ == MULTI_MODE_STAGES_SLOW_LFO) {
-      frequency /= 8.0f;
-    }
-    freq_is_ar = frequency > audio_rate_threshold;
+    frequency = LFOFrequency(
+        parameters_[0].primary, range, multimode_, sample_rate_);
+    freq_is_ar = frequency > audio_rate_threshold_;
   }
 
   if (audio_rate) {
     audio_osc_.Render(frequency, parameters_[0].secondary, ramp, size);
+    // Not instrumented either.
+    COUNT_OPS(OP_FLOAT, 30 * size);
 
     // This is really cool, but induces a pretty big performance hit.
     // // Blinking rate follows the distance to the nearest C.
@@ -653,6 +961,7 @@ void SegmentGenerator::ProcessOscillator(
         }
         ramp[i] = phase_;
       }
+      COUNT_OPS(OP_FLOAT, 2 * size);
     } else if (reset_on_gate_) {
       for (size_t i = 0; i < size; ++i) {
         if (*gate_flags & GATE_FLAG_RISING) {
@@ -679,17 +988,10 @@ void SegmentGenerator::ProcessOscillator(
 
 void SegmentGenerator::ProcessDelay(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
-  const float max_delay = static_cast<float>(kMaxDelay - 1);
-
-  float delay_time = SemitonesToRatio(
-      2.0f * (parameters_[0].secondary - 0.5f) * 36.0f) * 0.5f * kSampleRate;
-  float clock_frequency = 1.0f;
-  float delay_frequency = 1.0f / delay_time;
-
-  if (delay_time >= max_delay) {
-    clock_frequency = max_delay * delay_frequency;
-    delay_time = max_delay;
-  }
+  const DerivedParameters& d = DeriveParameters(0, DERIVED_DELAY);
+  const float delay_time = d.delay_time;
+  const float clock_frequency = d.clock_frequency;
+  const float delay_frequency = d.delay_frequency;
   ParameterInterpolator primary(&primary_, parameters_[0].primary, size);
 
   active_segment_ = 0;
@@ -711,6 +1013,8 @@ void SegmentGenerator::ProcessDelay(
         value_,
         delay_line_.Read(delay_time - phase_),
         clock_frequency);
+    COUNT_OPS(OP_FLOAT, 5);
+    COUNT_OP(OP_LUT);
     out->value = value_;
     out->phase = aux_;
     out->segment = active_segment_;
@@ -718,6 +1022,79 @@ void SegmentGenerator::ProcessDelay(
   }
 }
 
+void SegmentGenerator::ProcessRecorder(
+    const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
+  const float coefficient = DeriveParameters(
+      0, DERIVED_LP_COEFFICIENT).lp_coefficient;
+  // The slider sets the replay speed, from 1/4x to 4x, 1x at the center.
+  const float speed = SemitonesToRatio(
+      48.0f * (local_parameters_[0].slider - 0.5f));
+  const float scale = 1.0f / float(recorder_decimation_);
+  float length = static_cast<float>(recorder_length_);
+  float increment = recorder_length_ ? speed * scale / length : 0.0f;
+  COUNT_OPS(OP_FLOAT, 4);
+  COUNT_OPS(OP_DIVISION, 2);
+
+  // One sample is kept for the copy of the first sample of the take, which
+  // makes the interpolation seamless at the end of the loop.
+  const size_t max_length = delay_line_.capacity() - 2;
+  ParameterInterpolator cv(&primary_, local_parameters_[0].cv, size);
+
+  while (size--) {
+    const float input = cv.Next();
+    if (*gate_flags & GATE_FLAG_RISING) {
+      recorder_counter_ = 0;
+      recorder_sum_ = 0.0f;
+      recorder_num_samples_ = 0;
+    }
+
+    if (*gate_flags & GATE_FLAG_HIGH) {
+      // Recording. The input is averaged over each recorder sample.
+      recorder_sum_ += input;
+      if (++recorder_counter_ == recorder_decimation_) {
+        delay_line_.Write(recorder_sum_ * scale);
+        recorder_counter_ = 0;
+        recorder_sum_ = 0.0f;
+        ++recorder_num_samples_;
+      }
+      value_ = input;
+      active_segment_ = 0;
+      COUNT_OPS(OP_FLOAT, 2);
+    } else {
+      if (*gate_flags & GATE_FLAG_FALLING) {
+        // End of the take. A take shorter than two recorder samples (a
+        // trigger) erases the loop.
+        size_t n = std::min(recorder_num_samples_, max_length);
+        recorder_length_ = n >= 2 ? n : 0;
+        if (recorder_length_) {
+          delay_line_.Write(delay_line_.Read(static_cast<float>(n)));
+          length = static_cast<float>(n);
+          increment = speed * scale / length;
+        }
+        phase_ = 0.0f;
+      }
+      if (recorder_length_) {
+        phase_ += increment;
+        if (phase_ >= 1.0f) {
+          phase_ -= 1.0f;
+        }
+        value_ = delay_line_.Read(length + 1.0f - phase_ * length);
+        COUNT_OPS(OP_FLOAT, 5);
+        COUNT_OP(OP_LUT);
+      } else {
+        value_ = input;
+      }
+      active_segment_ = 1;
+    }
+    ONE_POLE(lp_, value_, coefficient);
+    out->value = lp_;
+    out->phase = phase_;
+    out->segment = active_segment_;
+    ++gate_flags;
+    ++out;
+  }
+}
+
 void SegmentGenerator::ProcessAttOff(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   ParameterInterpolator primary(&primary_, parameters_[0].primary, size);
@@ -732,8 +1109,8 @@ void SegmentGenerator::ProcessAttOff(
 
 void SegmentGenerator::ProcessPortamento(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
-  const float coefficient = PortamentoRateToLPCoefficient(
-      parameters_[0].secondary);
+  const float coefficient = DeriveParameters(
+      0, DERIVED_LP_COEFFICIENT).lp_coefficient;
   ParameterInterpolator primary(&primary_, parameters_[0].primary, size);
 
   active_segment_ = 0;
@@ -754,37 +1131,38 @@ void SegmentGenerator::ProcessPortamento(
 float spline(float y1, float k1, float y2, float k2, float t) {
   float r = 1.0f - t;
   float d = y2 - y1;
+  COUNT_OPS(OP_FLOAT, 12);
   return r * y1 + t * y2 + t * r * (r * (k1 - d) + t * (d - k2));
 }
 
-// Is it normal? Almost! This gives a shockingly good approximation of a normal
-// distribution, doesn't use any exps, logs, cos, etc., and doesn't
-// occasionally take a bunch of iterations. Output is 16bit.
-float almost_normal() {
-  // 37837.21 and 3.4641032 are 65536 and 2 divided by 0.57735 respectively
-  // 0.57735 is the std of the sum of the four uniform distributions, giving us
-  // a std of 1. This isn't really necessary, but is kinda convenient for
-  // thinking about range.
-  uint32_t a = Random::GetWord();
-  uint32_t b = Random::GetWord();
-  return static_cast<float>(
-    (a >> 16) + (a & 0xffff) + (b >> 16) + (b & 0xffff)
-    ) / 37837.21f - 3.4641032f;
+// Almost normal value with a standard deviation of 1 (see AlmostNormal).
+float almost_normal(RandomStream* random) {
+  uint32_t a = random->GetWord();
+  uint32_t b = random->GetWord();
+  COUNT_OPS(OP_FLOAT, 2);
+  return AlmostNormal(a, b);
 }
 
-// Brownian modulo accuracy of almost_normal. Also constrained to [0, 1].
-// Constraint is imposed by "bouncing" off the edges.
-inline float almost_brownian(float last, float std_dev, float min, float max) {
-  float width = max - min;
-  last += width * std_dev * almost_normal();
-  if (last > max) {
-    last = 2 * max - last;
+// Constrains a random walk to [min, max] by "bouncing" off the edges.
+inline float bounce(float x, float min, float max) {
+  if (x > max) {
+    x = 2 * max - x;
   }
-  if (last < min) {
-    last = 2 * min - last;
+  if (x < min) {
+    x = 2 * min - x;
   }
-  CONSTRAIN(last, min, max);
-  return last;
+  CONSTRAIN(x, min, max);
+  COUNT_OPS(OP_FLOAT, 4);
+  return x;
+}
+
+// Brownian modulo accuracy of almost_normal.
+inline float almost_brownian(
+    RandomStream* random, float last, float std_dev, float min, float max) {
+  float width = max - min;
+  last += width * std_dev * almost_normal(random);
+  COUNT_OPS(OP_FLOAT, 4);
+  return bounce(last, min, max);
 }
 
 void SegmentGenerator::ProcessFreeRunningRandomLFO(
@@ -793,7 +1171,7 @@ void SegmentGenerator::ProcessFreeRunningRandomLFO(
   CONSTRAIN(f, -128.0f, 127.0f);
 
   const float root_note = root_notes[segments_[0].range];
-  float frequency = SemitonesToRatio(f) * root_note / kSampleRate;
+  float frequency = SemitonesToRatio(f) * root_note / sample_rate_;
   if (segments_[0].range == RANGE_FAST) {
     // This is so we can more smoothly transition into full noise
     frequency *= 4.0f;
@@ -811,21 +1189,33 @@ void SegmentGenerator::ProcessFreeRunningRandomLFO(
     std_dev = 0.5f * std_dev * std_dev + 0.01f;
     float min = segments_[0].bipolar ? -5.0f / 8.0f : 0.0f;
     float max = segments_[0].bipolar ? 5.0f / 8.0f : 1.0f;
+    // The output is one random value late.
+    float next = next_;
     if (parameters_[0].secondary < 0.5f) {
-      while (size--) {
-        out->value = value_ = next_;
-        out->segment = 0;
-        next_ = Random::GetFloat() * (max - min) + min;
-        ++out;
+      // Uniform values are drawn in the output loop: a block pass would only
+      // add loads and stores. The copy of the stream stays in a register,
+      // while random_ would be reloaded after each store to out.
+      RandomStream stream;
+      stream.Seed(random_.state());
+      for (size_t i = 0; i < size; ++i) {
+        out[i].value = next;
+        out[i].segment = 0;
+        next = stream.GetFloat(max - min, min);
       }
+      random_.Seed(stream.state());
     } else {
-      while (size--) {
-        out->value = value_ = next_;
-        out->segment = 0;
-        next_ = almost_brownian(next_, std_dev, min, max);
-        ++out;
+      float noise[size];
+      random_.GetAlmostNormals(noise, size);
+      const float step = (max - min) * std_dev;
+      for (size_t i = 0; i < size; ++i) {
+        out[i].value = next;
+        out[i].segment = 0;
+        next = bounce(next + step * noise[i], min, max);
       }
+      COUNT_OPS(OP_FLOAT, 2 * size);
     }
+    value_ = out[size - 1].value;
+    next_ = next;
   } else {
     // phase_ gets updated in ProcessRandomFromPhase
     float phase = phase_;
@@ -842,6 +1232,7 @@ void SegmentGenerator::ProcessFreeRunningRandomLFO(
         out[i].phase = phase;
         ++gate_flags;
       }
+      COUNT_OPS(OP_FLOAT, 2 * size);
     } else {
       for (size_t i = 0; i < size; ++i) {
         phase += frequency;
@@ -850,6 +1241,7 @@ void SegmentGenerator::ProcessFreeRunningRandomLFO(
         }
         out[i].phase = phase;
       }
+      COUNT_OPS(OP_FLOAT, 2 * size);
     }
     ProcessRandomFromPhase(parameters_[0].secondary, out, size);
   }
@@ -857,7 +1249,7 @@ void SegmentGenerator::ProcessFreeRunningRandomLFO(
 
 void SegmentGenerator::ProcessTapRandomLFO(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
-  float ramp[12];
+  float ramp[size];
   uint8_t range = segments_[0].range;
 
   if (reset_on_gate_) {
@@ -868,6 +1260,8 @@ void SegmentGenerator::ProcessTapRandomLFO(
                                    parameters_[0].primary * 1.03f);
 
     ramp_extractor_.Process( false, false, r, gate_flags, ramp, size);
+    // Same rough figure as in ProcessOscillator.
+    COUNT_OPS(OP_FLOAT, 12 * size);
     for (size_t i = 0; i < size; ++i) {
       out[i].phase = ramp[i];
     }
@@ -886,7 +1280,7 @@ void SegmentGenerator::ProcessRandomFromPhase(
   float phase_mult = 1.0f;
   if (smoothness < 0.25f) {
     if (smoothness <= 0.001f) {
-      phase_mult = float(kSampleRate);
+      phase_mult = sample_rate_;
     }
     phase_mult = 0.25f / smoothness;
   }
@@ -897,7 +1291,7 @@ void SegmentGenerator::ProcessRandomFromPhase(
       start_ = value_;
       value_ = next_;
       if (smoothness <= 0.5f) {
-        next_ = Random::GetFloat();
+        next_ = random_.GetFloat();
         if (segments_[0].bipolar) {
           next_ = 10.0f / 8.0f * (next_ - 0.5f);
         }
@@ -905,12 +1299,14 @@ void SegmentGenerator::ProcessRandomFromPhase(
         float std_dev = 2.0f * (1.0f - smoothness);
         std_dev = 0.5f * std_dev * std_dev + 0.01f;
         next_ = segments_[0].bipolar
-          ? almost_brownian(next_, std_dev, -5.0f / 8.0f, 5.0f / 8.0f)
-          : almost_brownian(next_, std_dev, 0.0f, 1.0f);
+          ? almost_brownian(
+                &random_, next_, std_dev, -5.0f / 8.0f, 5.0f / 8.0f)
+          : almost_brownian(&random_, next_, std_dev, 0.0f, 1.0f);
       }
     }
 
     float p = phase * phase_mult;
+    COUNT_OPS(OP_FLOAT, 5);
     if (p >= 1.0f) {
       lp_ = value_;
     } else {
@@ -926,23 +1322,13 @@ void SegmentGenerator::ProcessRandomFromPhase(
 }
 
 
-inline float tcsa(float  v, const float w, const float b) {
-  v *= 0.159155f; // Convert radians to phase.
-  // need to calc wrap here since InterpolateWrap can't handle negatives
-  // Using floorf is too slow... The ternary is apparently faster
-  v -= static_cast<float>(static_cast<int32_t>(v));
-  v = v < 0.0f ? 1.0f - v : v;
-  return Interpolate(lut_sine, v, 1024.0f) - b * w;
-}
-
-
 void SegmentGenerator::ProcessThomasSymmetricAttractor(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   float f = 96.0f * (parameters_[0].primary - 0.5f);
   CONSTRAIN(f, -128.0f, 127.0f);
 
   active_segment_ = 0;
-  float frequency = SemitonesToRatio(f) * 2.0439497f / kSampleRate;
+  float frequency = SemitonesToRatio(f) * 2.0439497f / sample_rate_;
   switch (segments_[active_segment_].range) {
     case segment::RANGE_SLOW:
       frequency /= 16.0f;
@@ -967,67 +1353,18 @@ void SegmentGenerator::ProcessThomasSymmetricAttractor(
 
   const float offset = bipolar ? 0.0f : 1.0f;
   const float amp = bipolar ? 10.0f / 16.0f : 0.5f;
-  float x = x_;
-  float y = y_;
-  float z = z_;
   while (size--) {
-    // Runge-Kutta version: too slow unfortunately
-    /*
-    const float dx1 = tcsa(y, x, b);
-    const float dy1 = tcsa(z, y, b);
-    const float dz1 = tcsa(x, z, b);
-
-    const float x1 = x + dx1 * dt / 2.0f;
-    const float y1 = y + dy1 * dt / 2.0f;
-    const float z1 = z + dz1 * dt / 2.0f;
-
-    const float dx2 = tcsa(y1, x1, b);
-    const float dy2 = tcsa(z1, y1, b);
-    const float dz2 = tcsa(x1, z1, b);
-
-    const float x2 = x + dx2 * dt / 2.0f;
-    const float y2 = y + dy2 * dt / 2.0f;
-    const float z2 = z + dz2 * dt / 2.0f;
-
-    const float dx3 = tcsa(y2, x2, b);
-    const float dy3 = tcsa(z2, y2, b);
-    const float dz3 = tcsa(x2, z2, b);
-
-    const float x3 = x + dx3 * dt;
-    const float y3 = y + dy3 * dt;
-    const float z3 = z + dz3 * dt;
-
-    const float dx4 = tcsa(y3, x3, b);
-    const float dy4 = tcsa(z3, y3, b);
-    const float dz4 = tcsa(x3, z3, b);
-
-    x += dt * (dx1 + 2.0f * dx2 + 2.0f * dx3 + dx4) / 6.0f;
-    y += dt * (dy1 + 2.0f * dy2 + 2.0f * dy3 + dy4) / 6.0f;
-    z += dt * (dz1 + 2.0f * dz2 + 2.0f * dz3 + dz4) / 6.0f;
-    */
-
-    const float dx = tcsa(y, x, b);
-    const float dy = tcsa(z, y, b);
-    const float dz = tcsa(x, z, b);
-    x += frequency * dx;
-    y += frequency * dy;
-    z += frequency * dz;
-
+    const float x = thomas_symmetric_.Next(frequency, b);
     float squashed = amp * (offset + x / (1.0f + fabsf(x)));
+    COUNT_OPS(OP_FLOAT, 4);
+    COUNT_OP(OP_DIVISION);
 
     out->value = value_ = lp_= squashed;
     out->segment = active_segment_ = 0;
     ++out;
   }
-  x_ = x;
-  y_ = y;
-  z_ = z;
 }
 
-#define DS_DXDT(x,y,z) a * (y - x)
-#define DS_DYDT(x,y,z) (c - a) * x - x * z + c * y
-#define DS_DZDT(x,y,z) x * y - b * z
-
 void SegmentGenerator::ProcessDoubleScrollAttractor(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   float f = 96.0f * (parameters_[0].primary - 0.5f);
@@ -1035,7 +1372,7 @@ void SegmentGenerator::ProcessDoubleScrollAttractor(
 
   active_segment_ = 0;
   // 1.4 gives a similar feel to the LFO speeds here
-  float frequency = SemitonesToRatio(f) * 1.3f * 2.0439497f / kSampleRate;
+  float frequency = SemitonesToRatio(f) * 1.3f * 2.0439497f / sample_rate_;
   switch (segments_[active_segment_].range) {
     case segment::RANGE_SLOW:
       // Range from ~8s to ~30min
@@ -1049,65 +1386,54 @@ void SegmentGenerator::ProcessDoubleScrollAttractor(
       frequency /= 16.0f;
       break;
   }
-  // Could increase to 0.075 if we used runge-kutta
+  // Two RK4 steps per control period at the top of the fast range.
   CONSTRAIN(frequency, 0.0f, 0.01f);
 
 
-  const float a = 42.0f;
   const float max_b = 6.0f;
   const float min_b = 1.0f;
   const float b = ((max_b - min_b) * parameters_[0].secondary + min_b);
   //CONSTRAIN(b, min_b, max_b);
-  const float c = 28.0f;
 
   const bool bipolar = segments_[0].bipolar;
 
   const float offset = bipolar ? -0.5f : 0.0f;
   const float amp = bipolar ? 10.0f / 8.0f : 1.0f;
-  float x = x_;
-  float y = y_;
-  float z = z_;
   while (size--) {
-    // Right now, behavior changes a good bit with dt. Could try runge-kutta to fix
-    const float dx = DS_DXDT(x, y, z);
-    const float dy = DS_DYDT(x, y, z);
-    const float dz = DS_DZDT(x, y, z);
-    x += frequency * dx;
-    y += frequency * dy;
-    z += frequency * dz;
-
-    float output = (x + 18.0f) / 36.0f;
+    const float x = double_scroll_.Next(frequency, b);
+    float output = (x + 18.0f) * (1.0f / 36.0f);
     CONSTRAIN(output, 0.0f, 1.0f);
+    COUNT_OPS(OP_FLOAT, 4);
 
     out->value = value_ = lp_= amp * output + offset;
     out->segment = active_segment_ = output > 0.5f;
     ++out;
   }
-  x_ = x;
-  y_ = y;
-  z_ = z;
 }
 
-void SegmentGenerator::ProcessTuring(
+template<bool gate_edges>
+void SegmentGenerator::RenderTuring(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
-  size_t steps = tm_steps(parameters_[0].secondary);
-  if (segments_[0].tm_steps != steps) {
+  size_t steps = DeriveParameters(0, DERIVED_TM_STEPS).tm_steps;
+  ShiftRegister* r = &shift_registers_[0];
+  if (r->tm_steps != steps) {
     out->changed_segments |= 1;
-    segments_[0].tm_steps = steps;
+    r->tm_steps = steps;
   }
   ParameterInterpolator primary(&primary_, parameters_[0].primary, size);
 
-  Segment* seg = &segments_[0];
+  const bool bipolar = segments_[0].bipolar;
   while (size--) {
     float prob_param = primary.Next();
-    if (*gate_flags & GATE_FLAG_RISING) {
+    if (gate_edges && (*gate_flags & GATE_FLAG_RISING)) {
       advance_tm(
+          &random_,
           steps,
           tm_prob(prob_param),
-          seg->shift_register,
-          seg->register_value,
-          seg->bipolar);
-      value_ = seg->register_value;
+          r->shift_register,
+          r->register_value,
+          bipolar);
+      value_ = r->register_value;
     }
     active_segment_ = *gate_flags & GATE_FLAG_HIGH ? 0 : 1;
     out->value = segments_[0].quant_scale > 0
@@ -1120,13 +1446,15 @@ void SegmentGenerator::ProcessTuring(
   }
 }
 
+DEFINE_PROCESS_FN_WITH_EDGES(Turing)
+
 void SegmentGenerator::ProcessLogistic(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
-  const float coefficient = PortamentoRateToLPCoefficient(
-      parameters_[0].secondary);
+  const float coefficient = DeriveParameters(
+      0, DERIVED_LP_COEFFICIENT).lp_coefficient;
   float r = 0.5f * parameters_[0].primary + 3.5f;
   if (value_ <= 0.0f) {
-    value_ = Random::GetFloat();
+    value_ = random_.GetFloat();
   }
 
   while (size--) {
@@ -1136,6 +1464,7 @@ void SegmentGenerator::ProcessLogistic(
     active_segment_ = *gate_flags & GATE_FLAG_HIGH ? 0 : 1;
 
     ONE_POLE(lp_, value_, coefficient);
+    COUNT_OPS(OP_FLOAT, 2);
     out->value = segments_[0].bipolar ? 10.0f / 8.0f * (lp_ - 0.5f) : lp_;
     out->phase = 0.5f;
     out->segment = active_segment_;
@@ -1148,6 +1477,8 @@ void SegmentGenerator::ProcessZero(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   value_ = 0.0f;
   active_segment_ = 1;
+  // Nothing but the stores to the output.
+  COUNT_OPS(OP_FLOAT, 0);
   while (size--) {
     out->value = 0.0f;
     out->phase = 0.5f;
@@ -1161,6 +1492,7 @@ void SegmentGenerator::ProcessSlave(
   while (size--) {
     active_segment_ = out->segment == monitored_segment_ ? 0 : 1;
     out->value = active_segment_ ? 0.0f : 1.0f - out->phase;
+    COUNT_OP(OP_FLOAT);
     ++out;
   }
 }
@@ -1220,6 +1552,7 @@ float polyblamp(float t, float dt) {
 float spline_lfo(const float attack, const float attack_slope, const float pw,
                  const float release, const float release_slope,
                  const float up_slope, const float down_slope, float t) {
+  COUNT_OPS(OP_FLOAT, 3);
   if (t <= attack + pw) {
     if (t > attack) return 1.0f;
     return spline(-1.0f, up_slope, 1.0f, up_slope, t * attack_slope);
@@ -1230,10 +1563,10 @@ float spline_lfo(const float attack, const float attack_slope, const float pw,
   }
 }
 
+  /* static */
   template <bool bandlimit>
-  void SegmentGenerator::ShapeSplineLFO(
-      float shape, float frequency, const float *input_phase,
-      SegmentGenerator::Output *out, size_t size, bool bipolar) {
+  void SegmentGenerator::ComputeSplineLFOShape(
+      float shape, float frequency, SplineLFOShape* s) {
     const float ramp_boundary = 0.333f;
     const float trap_boundary = 0.667f;
     // The following settings reproduce the response curve of the original LFO
@@ -1296,6 +1629,28 @@ float spline_lfo(const float attack, const float attack_slope, const float pw,
     }
     const float attack_slope = attack == 0.0f ? 0.0f : 1.0f / attack;
     const float release_slope = release == 0.0f ? 0.0f : 1.0f / release;
+    COUNT_OPS(OP_DIVISION, 3);
+
+    s->attack = attack;
+    s->attack_slope = attack_slope;
+    s->pw = pw1;
+    s->release = release;
+    s->release_slope = release_slope;
+    s->up_slope = up_slope;
+    s->down_slope = down_slope;
+  }
+
+  template void SegmentGenerator::ComputeSplineLFOShape<false>(
+      float shape, float frequency, SplineLFOShape* s);
+  template void SegmentGenerator::ComputeSplineLFOShape<true>(
+      float shape, float frequency, SplineLFOShape* s);
+
+  template <bool bandlimit>
+  void SegmentGenerator::ShapeSplineLFO(
+      float shape, float frequency, const float *input_phase,
+      SegmentGenerator::Output *out, size_t size, bool bipolar) {
+    SplineLFOShape s;
+    ComputeSplineLFOShape<bandlimit>(shape, frequency, &s);
 
     const float amplitude = bipolar ? 10.0f / 16.0f : 0.5f;
     const float offset = bipolar ? 0.0f : 0.5f;
@@ -1303,9 +1658,11 @@ float spline_lfo(const float attack, const float attack_slope, const float pw,
       const float phase = *input_phase;
       out->phase = phase;
       out->value =
-          amplitude * spline_lfo(attack, attack_slope, pw1, release,
-                                 release_slope, up_slope, down_slope, phase) +
+          amplitude * spline_lfo(s.attack, s.attack_slope, s.pw, s.release,
+                                 s.release_slope, s.up_slope, s.down_slope,
+                                 phase) +
           offset;
+      COUNT_OPS(OP_FLOAT, 3);
       out->segment = phase < 0.5f ? 0 : 1;
       ++out;
       ++input_phase;
@@ -1328,6 +1685,7 @@ float spline_lfo(const float attack, const float attack_slope, const float pw,
     const float plateau = 0.5f * (1.0f - plateau_width);
     const float normalization = 1.0f / plateau;
     const float phase_shift = plateau_width * 0.25f;
+    COUNT_OPS(OP_DIVISION, 4);
 
     const float amplitude = bipolar ? (10.0f / 16.0f) : 0.5f;
     const float offset = bipolar ? 0.0f : 0.5f;
@@ -1348,6 +1706,7 @@ float spline_lfo(const float attack, const float attack_slope, const float pw,
           lut_sine, phase < 0.25f ? phase + 0.75f : phase - 0.25f, 1024.0f);
       out->phase = *input_phase;
       out->value = amplitude * Crossfade(triangle, sine, sine_amount) + offset;
+      COUNT_OPS(OP_FLOAT, 14);
       out->segment = phase < 0.5f ? 0 : 1;
       ++out;
       ++input_phase;
@@ -1360,7 +1719,8 @@ inline bool is_step(Configuration config) {
     || (config.type == TYPE_TURING && !config.loop);
 }
 
-void SegmentGenerator::ProcessSequencer(
+template<bool gate_edges>
+void SegmentGenerator::RenderSequencer(
     const GateFlags* gate_flags, SegmentGenerator::Output* out, size_t size) {
   // Read the value of the small pot to determine the direction.
   Direction direction = Direction(function_quantizer_.Process(
@@ -1380,7 +1740,7 @@ void SegmentGenerator::ProcessSequencer(
       reset_ = true;
       active_segment_ = direction == DIRECTION_DOWN ? last_step_ : first_step_;
       up_down_counter_ = 0;
-      inhibit_clock_ = kClockInhibitDelay;
+      inhibit_clock_ = clock_inhibit_delay_;
     }
     if (reset_ && parameters_[0].primary < 0.0625f) {
       reset_ = false;
@@ -1394,7 +1754,8 @@ void SegmentGenerator::ProcessSequencer(
     bool clockable = !inhibit_clock_ && !reset_;
 
     // If a rising edge is detected on the gate input, advance to the next step.
-    if ((*gate_flags & GATE_FLAG_RISING) && clockable) {
+    if (gate_edges && (*gate_flags & GATE_FLAG_RISING) && clockable) {
+      COUNT_OP(OP_BRANCH);
       switch (direction) {
         case DIRECTION_ADDRESSABLE:
           hold_address_ = true;
@@ -1449,7 +1810,7 @@ void SegmentGenerator::ProcessSequencer(
 
         case DIRECTION_RANDOM:
           active_segment_ = first_step_ + static_cast<int>(
-              Random::GetFloat() * static_cast<float>(
+              random_.GetFloat() * static_cast<float>(
                   last_step_ - first_step_ + 1));
           break;
 
@@ -1457,7 +1818,7 @@ void SegmentGenerator::ProcessSequencer(
           {
             int n = last_step_ - first_step_ + 1;
             int r = static_cast<int>(
-                Random::GetFloat() * static_cast<float>(n - 1));
+                random_.GetFloat() * static_cast<float>(n - 1));
             active_segment_ = first_step_ + \
                 ((active_segment_ - first_step_ + r + 1) % n);
           }
@@ -1469,7 +1830,7 @@ void SegmentGenerator::ProcessSequencer(
     }
 
     value_ = segments_[active_segment_].advance_tm ?
-      segments_[active_segment_].register_value
+      shift_registers_[active_segment_].register_value
       : parameters_[active_segment_].primary;
     if (quantized_output_) {
       value_ = QuantizeLinear(active_segment_, scales[1], value_, 1);
@@ -1478,9 +1839,9 @@ void SegmentGenerator::ProcessSequencer(
       const float steps_param = parameters_[last_active].secondary;
       const float prob_param = parameters_[last_active].primary;
       advance_tm(
-          steps_param, prob_param,
-          (&segments_[last_active])->shift_register,
-          (&segments_[last_active])->register_value,
+          &random_, steps_param, prob_param,
+          shift_registers_[last_active].shift_register,
+          shift_registers_[last_active].register_value,
           segments_[last_active].bipolar);
     }
     // TODO: Worth using segs.portamento_ instead of branches? If AR ever
@@ -1502,12 +1863,15 @@ void SegmentGenerator::ProcessSequencer(
   }
 }
 
+DEFINE_PROCESS_FN_WITH_EDGES(Sequencer)
+
 void SegmentGenerator::ConfigureSequencer(
     const Configuration* segment_configuration,
     int num_segments) {
   num_segments_ = num_segments;
 
   first_step_ = 0;
+  segments_[0].advance_tm = false;
   for (int i = 1; i < num_segments; ++i) {
     if (segment_configuration[i].loop) {
       if (!first_step_) {
@@ -1567,17 +1931,19 @@ void SegmentGenerator::Configure(
 
   // assert(has_trigger);
 
-  process_fn_ = &SegmentGenerator::ProcessMultiSegment;
-
   // A first pass to collect loop points, and check for STEP segments.
   int loop_start = -1;
   int loop_end = -1;
   bool has_step_segments = false;
+  bool ramps_only = true;
+  bool has_turing = false;
   int last_segment = num_segments - 1;
   int first_ramp_segment = -1;
 
   for (int i = 0; i <= last_segment; ++i) {
     has_step_segments = has_step_segments || is_step(segment_configuration[i]);
+    ramps_only = ramps_only && segment_configuration[i].type == TYPE_RAMP;
+    has_turing = has_turing || segment_configuration[i].type == TYPE_TURING;
     if (segment_configuration[i].loop) {
       if (loop_start == -1) {
         loop_start = i;
@@ -1591,6 +1957,16 @@ void SegmentGenerator::Configure(
     }
   }
 
+  // Pick a version of the process function without the branches this group
+  // will never take.
+  if (ramps_only) {
+    process_fn_ = &SegmentGenerator::ProcessMultiSegment<true, false>;
+  } else if (has_turing) {
+    process_fn_ = &SegmentGenerator::ProcessMultiSegment<false, true>;
+  } else {
+    process_fn_ = &SegmentGenerator::ProcessMultiSegment<false, false>;
+  }
+
   // Check if there are step segments inside the loop.
   bool has_step_segments_inside_loop = false;
   if (loop_start != -1) {
@@ -1618,7 +1994,7 @@ void SegmentGenerator::Configure(
       if (i == last_segment) {
         s->end = &zero_;
       } else if (segment_configuration[i + 1].type == TYPE_TURING) {
-        s->end = &segments_[i+1].register_value;
+        s->end = &shift_registers_[i + 1].register_value;
       } else if (segment_configuration[i + 1].type != TYPE_RAMP) {
         s->end = &parameters_[i + 1].primary;
       } else if (i == first_ramp_segment) {
@@ -1649,7 +2025,7 @@ void SegmentGenerator::Configure(
         // track.
         s->phase = i == loop_start && i == loop_end ? &zero_ : &one_;
       } else if (segment_configuration[i].type == TYPE_TURING) {
-        s->start = s->end = &s->register_value;
+        s->start = s->end = &shift_registers_[i].register_value;
         s->advance_tm = true;
         s->portamento = &zero_;
         s->time = NULL;
@@ -1701,6 +2077,8 @@ void SegmentGenerator::Configure(
   sentinel->time = &zero_;
   sentinel->curve = &half_;
   sentinel->portamento = &zero_;
+  sentinel->phase = NULL;
+  sentinel->advance_tm = false;
   sentinel->if_rising = 0;
   sentinel->if_falling = -1;
   sentinel->if_complete = loop_end == last_segment ? 0 : -1;
@@ -1710,6 +2088,9 @@ void SegmentGenerator::Configure(
   previous_segment_ = active_segment_ = num_segments;
 }
 
+/* static */
+uint32_t SegmentGenerator::global_random_seed_ = 0;
+
 /* static */
 SegmentGenerator::ProcessFn SegmentGenerator::process_fn_table_[16] = {
   // RAMP
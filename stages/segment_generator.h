@@ -34,31 +34,67 @@
 #include "stmlib/utils/gate_flags.h"
 
 #include "tides2/ramp/ramp_extractor.h"
-#include "stages/delay_line_16_bits.h"
+#include "stages/attractor.h"
+#include "stages/decimator.h"
 
 #include "stages/modes.h"
-#include "stmlib/utils/random.h"
 #include "stages/quantizer.h"
 #include "stages/oscillator.h"
+#include "stages/packed_delay_line.h"
+#include "stages/phase_warp.h"
+#include "stages/random_stream.h"
 #include "stages/variable_shape_oscillator.h"
 #include "stages/modes.h"
+#include "stages/op_counter.h"
 
 namespace stages {
 
+// Sample rate of the module. The segment generators can run at other sample
+// rates (see SegmentGenerator::Init).
 const float kSampleRate = 31250.0f;
 
-// Each segment generator can handle up to 36 segments. That's a bit of a waste
-// of RAM because the 6 generators running on a module will never have to deal
-// with 36 segments each. But it was a bit too much to have a shared pool of
-// pre-allocated Segments shared by all SegmentGenerators!
+// Each segment generator can handle up to 36 segments. The 6 generators
+// running on a module will never have to deal with 36 segments each, since
+// groups never overlap: their segments are allocated from a pool shared by
+// all the generators of the module (see SegmentGenerator::Pool).
 const int kMaxNumSegments = 36;
 const int kMaxNumLocalSegments = 6;
 
-const size_t kMaxDelay = 576;
+// 36 segments at most, plus one sentinel per generator.
+const int kSegmentPoolSize = kMaxNumSegments + kMaxNumLocalSegments;
+
+// Memory of the delay line, in bytes: 1152 samples in 16-bit, 1536 in 12-bit
+// and 2304 in mu-law.
+const size_t kDelayLineSize = 2304;
+
+// Format of the delay line for the delay and the CV recorder. The delay time
+// is at least 1/16s (1953 samples), longer than the line in all formats, so
+// the line is always written at a lower rate, and 12-bit gives the fastest
+// rate among the formats fine enough for pitch CVs (mu-law's step reaches 3%
+// of full scale).
+const DelayLineFormat kDelayLineFormat = DELAY_LINE_FORMAT_12_BIT;
+
+// The coefficients derived from the secondary parameter of a segment are
+// recomputed when it moves by more than this (a bit more than the noise on
+// the pots), not every block.
+const float kParameterHysteresis = 1.0f / 1024.0f;
+
+// Rate at which the CV recorder stores its input, in Hz. The 12-bit delay
+// line then holds a bit more than 6s.
+const float kRecorderSampleRate = 250.0f;
+
+// Enough for the 2ms S&H delay at 96kHz.
+const size_t kMaxSampleAndHoldDelay = 256;
 
 #define DECLARE_PROCESS_FN(X) void Process ## X \
       (const stmlib::GateFlags* gate_flags, Output* out, size_t size);
 
+// Process function which only needs to look for edges in the gate flags when
+// the block has some. Process ## X calls Render ## X<gate_edges_>.
+#define DECLARE_PROCESS_FN_WITH_EDGES(X) DECLARE_PROCESS_FN(X) \
+  template<bool gate_edges> void Render ## X \
+      (const stmlib::GateFlags* gate_flags, Output* out, size_t size);
+
 namespace segment {
 
 // High level descriptions / parameters.
@@ -101,6 +137,28 @@ struct LocalParameters {
   float slider;
 };
 
+enum DerivedValue {
+  DERIVED_LP_COEFFICIENT = 1,
+  DERIVED_DELAY = 2,
+  DERIVED_TM_STEPS = 4,
+  DERIVED_ALL = 7
+};
+
+// Cache of the values computed from the secondary parameter of a segment
+// (see SegmentGenerator::DeriveParameters).
+struct DerivedParameters {
+  // Value of the secondary parameter they are derived from.
+  float secondary;
+  // DerivedValues to recompute before use.
+  uint8_t stale;
+
+  float lp_coefficient;
+  float delay_time;
+  float delay_frequency;
+  float clock_frequency;
+  size_t tm_steps;
+};
+
 }  // namespace segment
 
 class SegmentGenerator {
@@ -118,8 +176,21 @@ class SegmentGenerator {
     uint32_t changed_segments;
   };
 
+  // Breakpoints and slopes of the spline LFO waveshape. They only depend on
+  // the shape parameter and frequency, so they are computed once per block.
+  struct SplineLFOShape {
+    float attack;
+    float attack_slope;
+    float pw;
+    float release;
+    float release_slope;
+    float up_slope;
+    float down_slope;
+  };
+
   struct Segment {
-    // Low level state.
+    // Low level state. Everything read by ProcessMultiSegment at each sample
+    // is packed here (32 bytes on the STM32).
 
     float* start;  // NULL if we should start from the current value.
     float* time;  // NULL if the segment has infinite duration.
@@ -135,24 +206,68 @@ class SegmentGenerator {
     bool retrig;
     segment::FreqRange range;
     uint8_t quant_scale;
-
     bool advance_tm;
+  };
+
+  // State of a TURING segment, only touched when the segment is left.
+  struct ShiftRegister {
     uint16_t shift_register;
     float register_value;
     size_t tm_steps;
   };
-  
-  void Init() {
-    Init(MULTI_MODE_STAGES, NULL);
-  }
-  
-  void Init(MultiMode multimode, stmlib::HysteresisQuantizer2* step_quantizer);
+
+  // Storage shared by the generators of a module. Generator i (channel i on
+  // the module) uses the slots 2 * i to 2 * i + num_segments, the last one
+  // being its sentinel. A group starting on channel i spans at most
+  // kMaxNumSegments - i channels, and the next group does not start before
+  // channel i + num_segments, so the generators never step on each other.
+  struct Pool {
+    Segment segment[kSegmentPoolSize];
+    ShiftRegister shift_register[kSegmentPoolSize];
+    segment::Parameters parameters[kSegmentPoolSize];
+    segment::DerivedParameters derived_parameters[kSegmentPoolSize];
+  };
+
+  // Envelope times, LFO frequencies, portamento and delay times, and the
+  // various timeouts are the same in seconds at all sample rates.
+  void Init(
+      MultiMode multimode,
+      stmlib::HysteresisQuantizer2* step_quantizer,
+      Pool* pool,
+      int channel,
+      float sample_rate = kSampleRate);
   
   typedef void (SegmentGenerator::*ProcessFn)(
       const stmlib::GateFlags* gate_flags, Output* out, size_t size);
 
   bool Process(
       const stmlib::GateFlags* gate_flags, Output* out, size_t size) {
+    return Process(gate_flags, true, out, size);
+  }
+
+  // gate_edges can be false when gate_flags has no rising or falling edge,
+  // in which case the process functions skip the per-sample edge detection.
+  bool Process(
+      const stmlib::GateFlags* gate_flags,
+      bool gate_edges,
+      Output* out,
+      size_t size) {
+    return Process(gate_flags, NULL, gate_edges, out, size);
+  }
+
+  // edge_offsets, when not NULL, tells for each sample with a gate edge how
+  // long before the sample (in fraction of a sample) the edge occurred. It is
+  // used by the tap LFOs' PLL and to start segments with the right phase.
+  bool Process(
+      const stmlib::GateFlags* gate_flags,
+      const float* edge_offsets,
+      bool gate_edges,
+      Output* out,
+      size_t size) {
+    COUNT_OP(OP_BLOCK);
+    COUNT_OPS(OP_SAMPLE, size);
+    gate_edges_ = gate_edges;
+    edge_offsets_ = edge_offsets;
     (this->*process_fn_)(gate_flags, out, size);
     return active_segment_ == 0;
   }
@@ -161,6 +276,44 @@ class SegmentGenerator {
     multimode_ = multimode;
   }
 
+  // Renders multi-segment groups at 2 or 4 times the sample rate and filters
+  // them back down (see decimator.h), to suppress the aliasing caused by the
+  // corners and jumps of audio-rate loops. 1 disables it. When enabled, the
+  // output of the group (value, phase and segment) is delayed by
+  // kDecimatorDelay samples.
+  void set_oversampling(int factor) {
+    CONSTRAIN(factor, 1, kMaxOversampling);
+    if (factor != 1 && factor != oversampling_) {
+      decimator_.Init(factor, lp_);
+      std::fill(&delayed_phase_[0], &delayed_phase_[kDecimatorDelay], phase_);
+      std::fill(
+          &delayed_segment_[0],
+          &delayed_segment_[kDecimatorDelay],
+          active_segment_);
+      delay_ptr_ = 0;
+    }
+    oversampling_ = factor;
+  }
+
+  inline int oversampling() const { return oversampling_; }
+
+  // Corrects the jumps of multi-segment groups between timed segments with a
+  // polyBLEP, placed where the segment actually completed between two
+  // samples. This suppresses most of the aliasing of audio-rate loops of
+  // steps, at a much lower cost than oversampling. When enabled, the output
+  // of the group is delayed by one sample, so that the correction can reach
+  // the sample before the jump.
+  void set_polyblep(bool enabled) {
+    if (enabled && !polyblep_) {
+      polyblep_previous_.value = lp_;
+      polyblep_previous_.phase = phase_;
+      polyblep_previous_.segment = active_segment_;
+    }
+    polyblep_ = enabled;
+  }
+
+  inline bool polyblep() const { return polyblep_; }
+
   void Configure(
       bool has_trigger,
       const segment::Configuration* segment_configuration,
@@ -181,10 +334,28 @@ class SegmentGenerator {
     ProcessFn new_process_fn =
         (multimode_ == MULTI_MODE_STAGES_ADVANCED
         ? advanced_process_fn_table_ : process_fn_table_)[i];
+    // Patching the gate of a looping HOLD segment while holding its button
+    // turns it into a CV recorder.
+    if (multimode_ == MULTI_MODE_STAGES_ADVANCED &&
+        has_trigger &&
+        segment_configuration.loop &&
+        segment_configuration.type == segment::TYPE_HOLD &&
+        segment_configuration.reset_on_gate) {
+      new_process_fn = &SegmentGenerator::ProcessRecorder;
+      if (process_fn_ != new_process_fn) {
+        delay_line_.Restart();
+        recorder_length_ = 0;
+      }
+    }
     if (new_process_fn != process_fn_
         || segments_[0].range != segment_configuration.range) {
       ramp_extractor_.Reset();
     }
+    // Configure() is called every few blocks, with the same configuration
+    // most of the time.
+    if (new_process_fn != process_fn_ || num_segments_ != 1) {
+      InvalidateDerivedParameters(0);
+    }
     process_fn_ = new_process_fn;
     segments_[0].range = segment_configuration.range;
     segments_[0].bipolar = segment_configuration.bipolar;
@@ -196,9 +367,14 @@ class SegmentGenerator {
     ResetPllCounter();
   }
 
-  const int kPllCountdown = static_cast<int>(kSampleRate * 0.25f);
+  // The slot may have been used by another group before.
+  inline void InvalidateDerivedParameters(int index) {
+    derived_parameters_[index].secondary = parameters_[index].secondary;
+    derived_parameters_[index].stale = segment::DERIVED_ALL;
+  }
+
   inline void ResetPllCounter() {
-    pll_counter_ = kPllCountdown;
+    pll_counter_ = pll_countdown_;
   }
 
   inline void ConfigureSlave(int i) {
@@ -216,6 +392,9 @@ class SegmentGenerator {
     int ix = step_quantizer_[seg].Process((value + 1.0f) / 2.0f);
     int16_t pitch = scale.notes[ix % scale.num_notes] + (ix / scale.num_notes) * scale.span;
     pitch -= octaves * scale.span;
+    // Scaling, hysteresis and conversions.
+    COUNT_OPS(OP_FLOAT, 6);
+    COUNT_OP(OP_DIVISION);
     return static_cast<float>(pitch) / eight_octaves;
   }
 
@@ -223,7 +402,7 @@ class SegmentGenerator {
     // assert (primary >= -1.0f && primary <= 2.0f)
     // assert (secondary >= 0.0f && secondary <= 1.0f)
     parameters_[index].primary = primary;
-    parameters_[index].secondary = secondary;
+    set_secondary(index, secondary);
   }
 
   void set_segment_parameters(int index,
@@ -232,11 +411,41 @@ class SegmentGenerator {
     // assert (primary >= -1.0f && primary <= 2.0f)
     // assert (secondary >= 0.0f && secondary <= 1.0f)
     parameters_[index].primary = primary;
-    parameters_[index].secondary = secondary;
+    set_secondary(index, secondary);
     local_parameters_[index].slider = slider;
     local_parameters_[index].cv = cv;
   }
 
+  inline void set_secondary(int index, float secondary) {
+    parameters_[index].secondary = secondary;
+    segment::DerivedParameters* d = &derived_parameters_[index];
+    if (fabsf(secondary - d->secondary) > kParameterHysteresis) {
+      d->secondary = secondary;
+      d->stale = segment::DERIVED_ALL;
+    }
+  }
+
+  // Each generator draws its random values from its own stream, seeded by
+  // Init() with ChannelSeed(global_random_seed, channel). Changing the global
+  // seed only affects the generators initialized afterwards. On the module,
+  // it comes from the unique ID of the MCU, so that the units of a chain do
+  // not draw the same values. It is 0 for host renders.
+  static inline void set_global_random_seed(uint32_t seed) {
+    global_random_seed_ = seed;
+  }
+
+  static inline uint32_t global_random_seed() {
+    return global_random_seed_;
+  }
+
+  inline void set_random_seed(uint32_t seed) {
+    random_.Seed(seed);
+  }
+
+  inline uint32_t random_state() const {
+    return random_.state();
+  }
+
   inline int num_segments() {
     return num_segments_;
   }
@@ -245,6 +454,26 @@ class SegmentGenerator {
     return process_fn_ == &SegmentGenerator::ProcessAttOff || process_fn_ == &SegmentGenerator::ProcessAttSampleAndHold;
   }
 
+  inline bool is_free_running_lfo() const {
+    return process_fn_ == &SegmentGenerator::ProcessFreeRunningLFO;
+  }
+
+  // Frequency (in cycles per sample) of a free-running LFO.
+  static float LFOFrequency(
+      float primary,
+      segment::FreqRange range,
+      MultiMode multimode,
+      float sample_rate = kSampleRate);
+
+  // Whether the LFO waveshape needs to be bandlimited at this frequency.
+  static bool IsAudioRate(float frequency, float sample_rate = kSampleRate);
+
+  inline float sample_rate() const { return sample_rate_; }
+
+  template <bool bandlimit>
+  static void ComputeSplineLFOShape(
+      float shape, float frequency, SplineLFOShape* s);
+
   inline bool needs_cv_preprocessing() const {
     return !(
       process_fn_ == &SegmentGenerator::ProcessFreeRunningLFO
@@ -254,14 +483,32 @@ class SegmentGenerator {
   }
 
  private:
-  // Process function for the general case.
+  // Process function for the general case. Configure() picks a version
+  // without tracking and untimed segments for groups made only of ramps, and
+  // one updating the shift registers for groups with TURING segments.
+  template<bool ramps_only, bool has_turing>
   DECLARE_PROCESS_FN(MultiSegment);
+  // Coefficients of the active segment of a multi-segment group.
+  struct ActiveSegment {
+    float frequency;
+    float lp_coefficient;
+    float previous_lp_coefficient;
+    PhaseWarp warp;
+  };
+  template<bool ramps_only>
+  void LoadActiveSegment(ActiveSegment* a) const;
+  template<bool ramps_only, bool has_turing, bool gate_edges>
+  void RenderMultiSegment(
+      const stmlib::GateFlags* gate_flags, Output* out, size_t size);
+  template<bool ramps_only, bool has_turing>
+  void RenderOversampledMultiSegment(
+      const stmlib::GateFlags* gate_flags, Output* out, size_t size);
   DECLARE_PROCESS_FN(RiseAndFall);
-  DECLARE_PROCESS_FN(Sequencer)
-  DECLARE_PROCESS_FN(DecayEnvelope);
-  DECLARE_PROCESS_FN(TimedPulseGenerator);
-  DECLARE_PROCESS_FN(GateGenerator);
-  DECLARE_PROCESS_FN(ProbabilisticGateGenerator);
+  DECLARE_PROCESS_FN_WITH_EDGES(Sequencer);
+  DECLARE_PROCESS_FN_WITH_EDGES(DecayEnvelope);
+  DECLARE_PROCESS_FN_WITH_EDGES(TimedPulseGenerator);
+  DECLARE_PROCESS_FN_WITH_EDGES(GateGenerator);
+  DECLARE_PROCESS_FN_WITH_EDGES(ProbabilisticGateGenerator);
   DECLARE_PROCESS_FN(SampleAndHold);
   DECLARE_PROCESS_FN(TrackAndHold);
   DECLARE_PROCESS_FN(TapLFO);
@@ -269,6 +516,7 @@ class SegmentGenerator {
   // DECLARE_PROCESS_FN(PLLOscillator);
   // DECLARE_PROCESS_FN(FreeRunningOscillator);
   DECLARE_PROCESS_FN(Delay);
+  DECLARE_PROCESS_FN(Recorder);
   DECLARE_PROCESS_FN(AttOff);
   DECLARE_PROCESS_FN(AttSampleAndHold);
   DECLARE_PROCESS_FN(Portamento);
@@ -276,7 +524,7 @@ class SegmentGenerator {
   DECLARE_PROCESS_FN(TapRandomLFO);
   DECLARE_PROCESS_FN(ThomasSymmetricAttractor);
   DECLARE_PROCESS_FN(DoubleScrollAttractor);
-  DECLARE_PROCESS_FN(Turing);
+  DECLARE_PROCESS_FN_WITH_EDGES(Turing);
   DECLARE_PROCESS_FN(Logistic);
   DECLARE_PROCESS_FN(Zero);
   DECLARE_PROCESS_FN(ClockedSampleAndHold);
@@ -293,10 +541,12 @@ class SegmentGenerator {
   static void
   ShapeSplineLFO(float shape, float frequencey, const float *input_phase,
                  SegmentGenerator::Output *out, size_t size, bool bipolar);
-  float WarpPhase(float t, float curve) const;
   float RateToFrequency(float rate) const;
   float PortamentoRateToLPCoefficient(float rate) const;
 
+  // Recomputes the requested DerivedValues of a segment if they are stale.
+  const segment::DerivedParameters& DeriveParameters(int index, uint8_t values);
+
   float phase_;
   float aux_;
   float previous_delay_sample_;
@@ -306,6 +556,7 @@ class SegmentGenerator {
   float next_; // used for spline interpolation in smooth random
   float lp_;
   float primary_;
+  float previous_ramp_;
 
   float zero_;
   float half_;
@@ -320,23 +571,60 @@ class SegmentGenerator {
 
   MultiMode multimode_;
 
+  float sample_rate_;
+  // kSampleRate / sample_rate_, for the frequencies and coefficients read
+  // from the lookup tables.
+  float rate_scale_;
+  int retrig_delay_samples_;
+  size_t sample_and_hold_delay_;
+  int clock_inhibit_delay_;
+  int pll_countdown_;
+  float audio_rate_threshold_;
+
+  int oversampling_;
+  Decimator decimator_;
+  // Phase and segment of the oversampled group, delayed like its value.
+  float delayed_phase_[kDecimatorDelay];
+  uint8_t delayed_segment_[kDecimatorDelay];
+  int delay_ptr_;
+
+  bool polyblep_;
+  // Sample not yet written to the output when polyblep_ is enabled.
+  Output polyblep_previous_;
+
+  // CV recorder. The take is stored in delay_line_, one sample every
+  // recorder_decimation_ samples.
+  int recorder_decimation_;
+  int recorder_counter_;
+  float recorder_sum_;
+  size_t recorder_num_samples_;
+  size_t recorder_length_;
+
   ProcessFn process_fn_;
+  bool gate_edges_;
+  const float* edge_offsets_;
 
   bool smooth_audio_rate_tracking_;
   int pll_counter_;
   tides::RampExtractor ramp_extractor_;
   stmlib::HysteresisQuantizer2 function_quantizer_;
 
-  Segment segments_[kMaxNumSegments + 1];  // There's a sentinel!
-  segment::Parameters parameters_[kMaxNumSegments];
+  // Slices of the pool. There's a sentinel after the last segment!
+  Segment* segments_;
+  ShiftRegister* shift_registers_;
+  segment::Parameters* parameters_;
+  segment::DerivedParameters* derived_parameters_;
   segment::LocalParameters local_parameters_[kMaxNumLocalSegments];
 
-  DelayLine16Bits<kMaxDelay> delay_line_;
-  stmlib::DelayLine<stmlib::GateFlags, 128> gate_delay_;
+  PackedDelayLine<kDelayLineSize, kDelayLineFormat> delay_line_;
+  stmlib::DelayLine<stmlib::GateFlags, kMaxSampleAndHoldDelay> gate_delay_;
 
   static ProcessFn process_fn_table_[16];
   static ProcessFn advanced_process_fn_table_[16];
 
+  static uint32_t global_random_seed_;
+  RandomStream random_;
+
   enum Direction {
     DIRECTION_UP,
     DIRECTION_DOWN,
@@ -361,9 +649,8 @@ class SegmentGenerator {
   stmlib::HysteresisQuantizer2 address_quantizer_;
   stmlib::HysteresisQuantizer2* step_quantizer_;
 
-  float x_;
-  float y_;
-  float z_;
+  Attractor<DoubleScrollSystem> double_scroll_;
+  Attractor<ThomasSymmetricSystem> thomas_symmetric_;
 
   bool reset_on_gate_;
   VariableShapeOscillator audio_osc_;
@@ -31,7 +31,9 @@
 #include <math.h>
 #include <algorithm>
 
+#ifndef TEST
 #include "stmlib/system/storage.h"
+#endif  // TEST
 
 namespace stages {
 
@@ -68,7 +70,12 @@ bool Settings::Init() {
         0);
   }
   
+#ifdef TEST
+  // No flash on the host: start from the defaults, like a new module.
+  bool success = false;
+#else
   bool success = chunk_storage_.Init(&persistent_data_, &state_);
+#endif  // TEST
   
   // Sanitize settings read from flash.
   if (success) {
@@ -87,11 +94,15 @@ bool Settings::Init() {
 }
 
 void Settings::SavePersistentData() {
+#ifndef TEST
   chunk_storage_.SavePersistentData();
+#endif  // TEST
 }
 
 void Settings::SaveState() {
+#ifndef TEST
   chunk_storage_.SaveState();
+#endif  // TEST
 }
 
 }  // namespace stages
@@ -30,7 +30,9 @@
 #define STAGES_SETTINGS_H_
 
 #include "stmlib/stmlib.h"
+#ifndef TEST
 #include "stmlib/system/storage.h"
+#endif  // TEST
 
 #include "stages/io_buffer.h"
 #include "stages/modes.h"
@@ -155,11 +157,13 @@ class Settings {
   PersistentData persistent_data_;
   State state_;
 
+#ifndef TEST
   stmlib::ChunkStorage<
       0x08004000,
       0x08008000,
       PersistentData,
       State> chunk_storage_;
+#endif  // TEST
 
   DISALLOW_COPY_AND_ASSIGN(Settings);
 };
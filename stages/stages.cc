@@ -59,6 +59,7 @@ GateFlags no_gate[kBlockSize];
 GateInputs gate_inputs;
 HysteresisQuantizer2 note_quantizer[kNumChannels + kMaxNumSegments];
 SegmentGenerator segment_generator[kNumChannels];
+SegmentGenerator::Pool segment_pool;
 Oscillator oscillator[kNumChannels];
 IOBuffer io_buffer;
 EnvelopeMode eg_mode;
@@ -67,6 +68,14 @@ SerialLink right_link;
 Settings settings;
 Ui ui;
 
+// 96-bit unique ID of the STM32F37x.
+const uint32_t* const kUniqueId = (const uint32_t*)(0x1ffff7ac);
+
+uint32_t RandomSeedFromUniqueId() {
+  return kUniqueId[0] ^ (kUniqueId[1] * 0x85ebca6b) ^ \
+      (kUniqueId[2] * 0xc2b2ae35);
+}
+
 // Default interrupt handlers.
 extern "C" {
 
@@ -118,8 +127,10 @@ void Process(IOBuffer::Block* block, size_t size) {
     // Doing the shift here was found to have better performance that in the
     // conditional below. wtf...
     out->changed_segments >>= 1;
+    bool patched = block->input_patched[channel];
     bool led_state = segment_generator[channel].Process(
-        block->input_patched[channel] ? block->input[channel] : no_gate,
+        patched ? block->input[channel] : no_gate,
+        patched && (block->input_edges & (1 << channel)),
         out,
         size);
     ui.set_slider_led(channel, led_state, 5);
@@ -332,8 +343,14 @@ void Init() {
   for (size_t i = 0; i < kNumChannels + kMaxNumSegments; ++i) {
     note_quantizer[i].Init(13, 0.03f, false);
   }
+  // Each unit of a chain has its own random streams.
+  SegmentGenerator::set_global_random_seed(RandomSeedFromUniqueId());
   for (size_t i = 0; i < kNumChannels; ++i) {
-    segment_generator[i].Init((MultiMode) settings.state().multimode, &note_quantizer[i]);
+    segment_generator[i].Init(
+        (MultiMode) settings.state().multimode,
+        &note_quantizer[i],
+        &segment_pool,
+        i);
     oscillator[i].Init();
   }
   std::fill(&no_gate[0], &no_gate[kBlockSize], GATE_FLAG_LOW);
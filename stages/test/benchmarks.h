@@ -0,0 +1,301 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Benchmark cases shared by the timing suite (stages_perf) and the Cortex-M4
+// cycle-budget estimator (stages_budget).
+
+#ifndef STAGES_TEST_BENCHMARKS_H_
+#define STAGES_TEST_BENCHMARKS_H_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "stages/io_buffer.h"
+#include "stages/segment_generator.h"
+#include "stages/test/fixtures.h"
+
+namespace stages {
+
+struct GeneratorBenchmark {
+  std::string name;
+  MultiMode multimode;
+  bool has_trigger;
+  int num_segments;
+  segment::Configuration configuration[kNumChannels];
+  float primary[kNumChannels];
+  float secondary[kNumChannels];
+  // Gate pattern. 0 to use a mix of 1500 and 3000 samples periods.
+  int pulse_period;
+  int pulse_width;
+  // Oversampling factor of multi-segment groups.
+  int oversampling;
+  bool polyblep;
+};
+
+// Feeds a SegmentGenerator with the gates and parameters of a benchmark,
+// block by block, as stages.cc does.
+class GeneratorBenchmarkRunner {
+ public:
+  GeneratorBenchmarkRunner() : benchmark_(NULL), test_(NULL) { }
+  ~GeneratorBenchmarkRunner() { delete test_; }
+
+  void Init(const GeneratorBenchmark& b, size_t num_blocks) {
+    benchmark_ = &b;
+    delete test_;
+    test_ = new SegmentGeneratorTest();
+    test_->generator()->SetMode(b.multimode);
+    test_->generator()->Configure(
+        b.has_trigger, b.configuration, b.num_segments);
+    test_->generator()->set_oversampling(b.oversampling);
+    test_->generator()->set_polyblep(b.polyblep);
+
+    // A rising edge on the very first sample would be seen by the ramp
+    // extractor as a zero-length period.
+    PulseGenerator* pulses = test_->pulses();
+    pulses->AddPulses(100, 0, 1);
+    int num_samples = num_blocks * kBlockSize;
+    if (b.pulse_period) {
+      pulses->AddPulses(
+          b.pulse_period, b.pulse_width, num_samples / b.pulse_period + 1);
+    } else {
+      for (int i = 0; i < num_samples / (1500 * 6 + 3000 * 2) + 1; ++i) {
+        pulses->AddPulses(1500, 500, 6);
+        pulses->AddPulses(3000, 500, 2);
+      }
+    }
+    std::fill(&no_gate_[0], &no_gate_[kBlockSize], stmlib::GATE_FLAG_LOW);
+    gate_edges_ = false;
+  }
+
+  // As in ChainState::Update, parameters are bound for every block.
+  void PrepareBlock() {
+    const GeneratorBenchmark& b = *benchmark_;
+    for (int i = 0; i < b.num_segments; ++i) {
+      test_->generator()->set_segment_parameters(
+          i, b.primary[i], b.secondary[i], b.primary[i], b.primary[i]);
+    }
+    test_->pulses()->Render(gate_, kBlockSize);
+    gate_edges_ = benchmark_->has_trigger && HasGateEdges(gate_, kBlockSize);
+  }
+
+  void ProcessBlock(SegmentGenerator::Output* out) {
+    test_->generator()->Process(
+        benchmark_->has_trigger ? gate_ : no_gate_,
+        gate_edges_,
+        out,
+        kBlockSize);
+  }
+
+ private:
+  const GeneratorBenchmark* benchmark_;
+  SegmentGeneratorTest* test_;
+  stmlib::GateFlags gate_[kBlockSize];
+  stmlib::GateFlags no_gate_[kBlockSize];
+  bool gate_edges_;
+
+  DISALLOW_COPY_AND_ASSIGN(GeneratorBenchmarkRunner);
+};
+
+// One benchmark per slot of process_fn_table_ and advanced_process_fn_table_,
+// in the same order as the tables, followed by the ranges that take different
+// code paths, noise, the fastest attractor, the CV recorder and the
+// multi-segment cases.
+inline std::vector<GeneratorBenchmark> GeneratorBenchmarks() {
+  const char* type_names[] = { "ramp", "step", "hold", "turing" };
+  const char* range_names[] = { "default", "slow", "fast", "audio" };
+  std::vector<GeneratorBenchmark> benchmarks;
+
+  GeneratorBenchmark b;
+  b.num_segments = 1;
+  b.pulse_period = 0;
+  b.pulse_width = 0;
+  b.oversampling = 1;
+  b.polyblep = false;
+  std::fill(&b.primary[0], &b.primary[kNumChannels], 0.5f);
+  std::fill(&b.secondary[0], &b.secondary[kNumChannels], 0.5f);
+  segment::Configuration c = {
+    segment::TYPE_RAMP, false, false, segment::RANGE_DEFAULT, 0, false
+  };
+  std::fill(&b.configuration[0], &b.configuration[kNumChannels], c);
+
+  for (int advanced = 0; advanced < 2; ++advanced) {
+    b.multimode = advanced ? MULTI_MODE_STAGES_ADVANCED : MULTI_MODE_STAGES;
+    for (int i = 0; i < 16; ++i) {
+      b.has_trigger = i & 2;
+      b.configuration[0].loop = i & 1;
+      b.configuration[0].type = segment::Type(i >> 2);
+      b.name = std::string(advanced ? "advanced/" : "standard/") + \
+          type_names[i >> 2] + \
+          (b.configuration[0].loop ? "/loop" : "") + \
+          (b.has_trigger ? "/gate" : "");
+      benchmarks.push_back(b);
+    }
+  }
+
+  // Looping ramps and random segments take different paths depending on
+  // the range.
+  b.multimode = MULTI_MODE_STAGES_ADVANCED;
+  b.configuration[0].loop = true;
+  for (int type = 0; type < 4; type += 3) {
+    for (int range = 1; range < 4; ++range) {
+      for (int has_trigger = 0; has_trigger < 2; ++has_trigger) {
+        b.has_trigger = has_trigger;
+        b.configuration[0].type = segment::Type(type);
+        b.configuration[0].range = segment::FreqRange(range);
+        b.pulse_period = range == segment::RANGE_AUDIO ? 50 : 0;
+        b.pulse_width = 15;
+        b.name = std::string("advanced/") + type_names[type] + "/loop" + \
+            (has_trigger ? "/gate/" : "/") + range_names[range];
+        benchmarks.push_back(b);
+      }
+    }
+  }
+  b.configuration[0].range = segment::RANGE_DEFAULT;
+  b.pulse_period = 0;
+
+  // White and brown noise: looping random segments above the LFO range.
+  b.has_trigger = false;
+  b.primary[0] = 1.0f;
+  b.configuration[0].type = segment::TYPE_TURING;
+  b.configuration[0].range = segment::RANGE_FAST;
+  for (int brown = 0; brown < 2; ++brown) {
+    b.name = brown ? "advanced/turing/loop/brown_noise" : \
+        "advanced/turing/loop/white_noise";
+    b.secondary[0] = brown ? 1.0f : 0.0f;
+    benchmarks.push_back(b);
+  }
+
+  // Double scroll attractor at the top of the fast range (slider and CV at
+  // their maximum), where each control period takes two RK4 steps.
+  b.name = "advanced/turing/fast";
+  b.configuration[0].loop = false;
+  b.configuration[0].type = segment::TYPE_TURING;
+  b.configuration[0].range = segment::RANGE_FAST;
+  b.primary[0] = 2.0f;
+  b.secondary[0] = 0.0f;
+  benchmarks.push_back(b);
+  b.configuration[0].loop = true;
+  b.configuration[0].range = segment::RANGE_DEFAULT;
+  b.primary[0] = 0.5f;
+  b.secondary[0] = 0.5f;
+
+  // CV recorder: looping HOLD patched while its button was held.
+  b.name = "advanced/hold/loop/gate/recorder";
+  b.has_trigger = true;
+  b.configuration[0].type = segment::TYPE_HOLD;
+  b.configuration[0].reset_on_gate = true;
+  benchmarks.push_back(b);
+  b.configuration[0].reset_on_gate = false;
+
+  // ADSR.
+  b.name = "advanced/multi/adsr";
+  b.has_trigger = true;
+  b.num_segments = 5;
+  segment::Configuration adsr[5] = {
+    { segment::TYPE_RAMP, false },
+    { segment::TYPE_RAMP, false },
+    { segment::TYPE_RAMP, false },
+    { segment::TYPE_HOLD, true },
+    { segment::TYPE_RAMP, false },
+  };
+  const float adsr_primary[] = { 0.15f, 0.25f, 0.25f, 0.5f, 0.5f };
+  const float adsr_secondary[] = { 0.0f, 0.3f, 0.75f, 0.1f, 0.25f };
+  std::copy(&adsr[0], &adsr[5], &b.configuration[0]);
+  std::copy(&adsr_primary[0], &adsr_primary[5], &b.primary[0]);
+  std::copy(&adsr_secondary[0], &adsr_secondary[5], &b.secondary[0]);
+  benchmarks.push_back(b);
+
+  // AD envelope with a looping ramp, only made of ramps.
+  b.name = "advanced/multi/ramps";
+  b.num_segments = 3;
+  segment::Configuration ramps[3] = {
+    { segment::TYPE_RAMP, false },
+    { segment::TYPE_RAMP, true },
+    { segment::TYPE_RAMP, false },
+  };
+  std::copy(&ramps[0], &ramps[3], &b.configuration[0]);
+  benchmarks.push_back(b);
+
+  // Looping multi-segment LFO with a Turing segment and a tracking step.
+  b.name = "advanced/multi/looping_turing";
+  b.num_segments = 4;
+  segment::Configuration looping[4] = {
+    { segment::TYPE_RAMP, true },
+    { segment::TYPE_TURING, false },
+    { segment::TYPE_STEP, false },
+    { segment::TYPE_RAMP, true },
+  };
+  std::copy(&looping[0], &looping[4], &b.configuration[0]);
+  std::fill(&b.primary[0], &b.primary[kNumChannels], 0.3f);
+  std::fill(&b.secondary[0], &b.secondary[kNumChannels], 0.6f);
+  benchmarks.push_back(b);
+
+  // Sequencer.
+  b.name = "advanced/multi/sequencer";
+  b.num_segments = 6;
+  b.configuration[0].type = segment::TYPE_RAMP;
+  b.configuration[0].loop = false;
+  for (int i = 1; i < 6; ++i) {
+    b.configuration[i].type = segment::TYPE_STEP;
+    b.configuration[i].loop = false;
+  }
+  b.primary[0] = 0.0f;
+  b.secondary[0] = 0.0f;
+  benchmarks.push_back(b);
+
+  // Audio-rate loops of two ramps and of two holds (a square wave), without
+  // and with oversampling, and with the polyBLEP.
+  segment::Configuration audio_loop[2] = {
+    { segment::TYPE_RAMP, true },
+    { segment::TYPE_RAMP, true },
+  };
+  segment::Configuration audio_square[2] = {
+    { segment::TYPE_HOLD, true },
+    { segment::TYPE_HOLD, true },
+  };
+  const char* oversampling_names[] = { "", "/2x", "", "/4x" };
+  b.num_segments = 2;
+  for (int square = 0; square < 2; ++square) {
+    std::string name = square
+        ? "advanced/multi/audio_square"
+        : "advanced/multi/audio_loop";
+    std::copy(
+        square ? &audio_square[0] : &audio_loop[0],
+        square ? &audio_square[2] : &audio_loop[2],
+        &b.configuration[0]);
+    std::fill(&b.primary[0], &b.primary[kNumChannels], 0.0f);
+    std::fill(&b.secondary[0], &b.secondary[kNumChannels], 0.3f);
+    b.primary[0] = square ? 1.0f : 0.0f;
+    for (int factor = 1; factor <= 4; factor *= 2) {
+      b.name = name + oversampling_names[factor - 1];
+      b.oversampling = factor;
+      benchmarks.push_back(b);
+    }
+    b.name = name + "/polyblep";
+    b.oversampling = 1;
+    b.polyblep = true;
+    benchmarks.push_back(b);
+    b.polyblep = false;
+  }
+
+  return benchmarks;
+}
+
+}  // namespace stages
+
+#endif  // STAGES_TEST_BENCHMARKS_H_
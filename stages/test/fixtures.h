@@ -16,12 +16,14 @@
 #ifndef STAGES_TEST_FIXTURES_H_
 #define STAGES_TEST_FIXTURES_H_
 
+#include <algorithm>
 #include <cstdlib>
 #include <vector>
 
 #include "stmlib/test/wav_writer.h"
 #include "stmlib/utils/gate_flags.h"
 
+#include "stages/io_buffer.h"
 #include "stages/segment_generator.h"
 #include "stages/modes.h"
 
@@ -30,6 +32,16 @@ namespace stages {
 using namespace std;
 using namespace stmlib;
 
+// Whether a block of gate flags contains a rising or falling edge, as
+// reported for each channel by IOBuffer::Block::input_edges on the module.
+inline bool HasGateEdges(const GateFlags* flags, size_t size) {
+  GateFlags edges = 0;
+  while (size--) {
+    edges |= *flags++;
+  }
+  return edges & (GATE_FLAG_RISING | GATE_FLAG_FALLING);
+}
+
 class PulseGenerator {
  public:
   PulseGenerator() {
@@ -105,11 +117,22 @@ class PulseGenerator {
 };
 
 
+// Block sizes at which the renders are checked for consistency. 8 is what
+// the firmware uses (kBlockSize).
+const size_t kTestBlockSizes[] = { 1, 8, 32, 256 };
+const size_t kMaxTestBlockSize = 256;
+
 class SegmentGeneratorTest {
  public:
    SegmentGeneratorTest() {
-    note_quantizer.Init(13, 0.03f, false);
-    segment_generator_.Init(MULTI_MODE_STAGES_ADVANCED, &note_quantizer);
+    // The sequencer uses one quantizer per segment.
+    for (int i = 0; i < kMaxNumLocalSegments; ++i) {
+      note_quantizer[i].Init(13, 0.03f, false);
+    }
+    segment_generator_.Init(
+        MULTI_MODE_STAGES_ADVANCED, &note_quantizer[0], &segment_pool_, 0);
+    block_size_ = kBlockSize;
+    detect_gate_edges_ = true;
   }
   ~SegmentGeneratorTest() { }
 
@@ -130,6 +153,17 @@ class SegmentGeneratorTest {
     segment_parameters_.push_back(p);
   }
 
+  // Number of samples processed by each call to SegmentGenerator::Process.
+  // Segment parameters are updated once per block, like on the module.
+  void set_block_size(size_t block_size) {
+    block_size_ = std::min(block_size, kMaxTestBlockSize);
+  }
+
+  // When disabled, every block is processed as if it had gate edges.
+  void set_detect_gate_edges(bool detect_gate_edges) {
+    detect_gate_edges_ = detect_gate_edges;
+  }
+
   void Render(const char* file_name, int sr) {
     Render(file_name, sr, 20, true, true, true, true);
   }
@@ -143,10 +177,12 @@ class SegmentGeneratorTest {
     stmlib::WavWriter wav_writer(gate + value + segment + phase, sr, duration);
     wav_writer.Open(file_name);
 
-    for (int i = 0; i < sr * duration; ++i) {
-      GateFlags f;
-      pulse_generator_.Render(&f, 1);
-      SegmentGenerator::Output out;
+    GateFlags f[kMaxTestBlockSize];
+    SegmentGenerator::Output out[kMaxTestBlockSize];
+    int remaining = sr * duration;
+    while (remaining) {
+      size_t size = std::min(static_cast<size_t>(remaining), block_size_);
+      pulse_generator_.Render(f, size);
 
       for (size_t j = 0; j < segment_parameters_.size(); ++j) {
         const SegmentParameters& p = segment_parameters_[j];
@@ -156,22 +192,54 @@ class SegmentGeneratorTest {
             p.secondary >= 0.0f ? p.secondary : wav_writer.triangle(-p.secondary));
       }
 
-      segment_generator_.Process(&f, &out, 1);
-      int channel = 0;
-      float s[4];
-      if (gate) s[channel++] = f & GATE_FLAG_HIGH ? 0.8f : 0.0f;
-      if (value) s[channel++] = out.value;
-      if (segment) s[channel++] = out.segment * 0.1f;
-      if (phase) s[channel++] = out.phase;
-      wav_writer.Write(s, channel, 32767.0f);
+      segment_generator_.Process(
+          f, !detect_gate_edges_ || HasGateEdges(f, size), out, size);
+      for (size_t i = 0; i < size; ++i) {
+        int channel = 0;
+        float s[4];
+        if (gate) s[channel++] = f[i] & GATE_FLAG_HIGH ? 0.8f : 0.0f;
+        if (value) s[channel++] = out[i].value;
+        if (segment) s[channel++] = out[i].segment * 0.1f;
+        if (phase) s[channel++] = out[i].phase;
+        wav_writer.Write(s, channel, 32767.0f);
+      }
+      remaining -= size;
+    }
+  }
+
+  // Renders num_samples to memory instead of a WAV file. Segment parameters
+  // must be constant (no triangle modulation).
+  void Render(vector<SegmentGenerator::Output>* output, size_t num_samples) {
+    if (pulse_generator_.empty()) {
+      pulse_generator_.CreateTestPattern();
+    }
+
+    GateFlags f[kMaxTestBlockSize];
+    output->resize(num_samples);
+    SegmentGenerator::Output* out = &(*output)[0];
+    while (num_samples) {
+      size_t size = std::min(num_samples, block_size_);
+      pulse_generator_.Render(f, size);
+      for (size_t j = 0; j < segment_parameters_.size(); ++j) {
+        const SegmentParameters& p = segment_parameters_[j];
+        segment_generator_.set_segment_parameters(
+            p.index, p.primary, p.secondary);
+      }
+      segment_generator_.Process(
+          f, !detect_gate_edges_ || HasGateEdges(f, size), out, size);
+      out += size;
+      num_samples -= size;
     }
   }
 
  private:
   SegmentGenerator segment_generator_;
+  SegmentGenerator::Pool segment_pool_;
   PulseGenerator pulse_generator_;
   vector<SegmentParameters> segment_parameters_;
-  HysteresisQuantizer2 note_quantizer;
+  HysteresisQuantizer2 note_quantizer[kMaxNumLocalSegments];
+  size_t block_size_;
+  bool detect_gate_edges_;
 
   DISALLOW_COPY_AND_ASSIGN(SegmentGeneratorTest);
 };
@@ -0,0 +1,562 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Declarative patch description, and a renderer that groups channels and
+// drives SegmentGenerators the same way ChainState does on the hardware.
+//
+// A patch file contains one "channel" line per channel (left to right, up to
+// 36 channels, ie a full chain), optionally preceded by a "mode" line.
+// Everything after a '#' is a comment. Example (ADSR triggered by the test
+// pattern on channel 0, free-running LFO on channel 5):
+//
+//   mode advanced
+//   channel type=ramp gate=test primary=0.15 secondary=0.0
+//   channel type=ramp primary=0.25 secondary=0.3
+//   channel type=ramp primary=0.25 secondary=0.75
+//   channel type=hold loop=1 primary=0.5 secondary=0.1
+//   channel type=ramp primary=0.5 secondary=0.25
+//   channel type=ramp loop=1 primary=tri:4 secondary=cv:0
+//
+// Channel keys:
+//   type       ramp | step | hold | turing
+//   loop       0 | 1
+//   bipolar    0 | 1
+//   range      default | slow | fast | audio
+//   scale      quantizer scale index (0 = off)
+//   reset      0 | 1 (reset LFO phase on gate instead of tap tempo)
+//   gate       none | test | in:N | pulse:PERIOD:WIDTH (in samples)
+//   primary, secondary, cv, slider
+//              constant | cv:N (channel N of the CV input file)
+//                       | tri:P (0-1 triangle with a period of P seconds)
+//
+// The edges of in:N gates are located between samples by interpolating the
+// threshold crossings, which gives tap LFOs and envelopes sub-sample timing.
+//
+// A channel with a gate source is "patched" and starts a new group, which
+// extends over the following unpatched channels. Unpatched channels before
+// the first patched channel run as free-running single segments.
+
+#ifndef STAGES_TEST_PATCH_H_
+#define STAGES_TEST_PATCH_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "stmlib/dsp/hysteresis_quantizer.h"
+#include "stmlib/utils/gate_flags.h"
+
+#include "stages/lfo_bank.h"
+#include "stages/segment_generator.h"
+#include "stages/modes.h"
+#include "stages/test/fixtures.h"
+#include "stages/test/wav_file.h"
+
+namespace stages {
+
+enum SourceType {
+  SOURCE_CONSTANT,
+  SOURCE_CV_INPUT,
+  SOURCE_TRIANGLE
+};
+
+struct Source {
+  SourceType type;
+  float value;  // Constant value, CV input channel, or triangle period.
+};
+
+enum GateSourceType {
+  GATE_SOURCE_NONE,
+  GATE_SOURCE_TEST_PATTERN,
+  GATE_SOURCE_INPUT,
+  GATE_SOURCE_PULSE
+};
+
+struct GateSource {
+  GateSourceType type;
+  int input;
+  int period;
+  int width;
+};
+
+struct ChannelPatch {
+  segment::Configuration configuration;
+  GateSource gate;
+  Source primary;
+  Source secondary;
+  Source cv;
+  Source slider;
+};
+
+struct Patch {
+  MultiMode multimode;
+  std::vector<ChannelPatch> channels;
+};
+
+class PatchParser {
+ public:
+  PatchParser() { }
+  ~PatchParser() { }
+
+  // Returns false and prints a diagnostic on stderr if the file is malformed.
+  bool Parse(const char* file_name, Patch* patch) {
+    FILE* fp = fopen(file_name, "r");
+    if (!fp) {
+      fprintf(stderr, "%s: cannot open file\n", file_name);
+      return false;
+    }
+    file_name_ = file_name;
+    patch->multimode = MULTI_MODE_STAGES_ADVANCED;
+    patch->channels.clear();
+
+    bool success = true;
+    char line[1024];
+    line_number_ = 0;
+    while (success && fgets(line, sizeof(line), fp)) {
+      ++line_number_;
+      char* comment = strchr(line, '#');
+      if (comment) {
+        *comment = '\0';
+      }
+      success = ParseLine(line, patch);
+    }
+    fclose(fp);
+
+    if (success && patch->channels.empty()) {
+      fprintf(stderr, "%s: no channels defined\n", file_name);
+      success = false;
+    }
+    return success;
+  }
+
+ private:
+  bool Error(const char* message, const char* token) {
+    fprintf(stderr, "%s:%d: %s '%s'\n",
+            file_name_, line_number_, message, token);
+    return false;
+  }
+
+  bool ParseLine(char* line, Patch* patch) {
+    const char* separators = " \t\r\n";
+    char* token = strtok(line, separators);
+    if (!token) {
+      return true;
+    }
+    if (!strcmp(token, "mode")) {
+      token = strtok(NULL, separators);
+      if (!token) {
+        return Error("missing mode", "");
+      } else if (!strcmp(token, "standard")) {
+        patch->multimode = MULTI_MODE_STAGES;
+      } else if (!strcmp(token, "advanced")) {
+        patch->multimode = MULTI_MODE_STAGES_ADVANCED;
+      } else if (!strcmp(token, "slow_lfo")) {
+        patch->multimode = MULTI_MODE_STAGES_SLOW_LFO;
+      } else {
+        return Error("unknown mode", token);
+      }
+      return true;
+    } else if (strcmp(token, "channel")) {
+      return Error("unknown statement", token);
+    }
+
+    if (patch->channels.size() >= size_t(kMaxNumSegments)) {
+      return Error("too many channels", token);
+    }
+
+    ChannelPatch c;
+    c.configuration.type = segment::TYPE_RAMP;
+    c.configuration.loop = false;
+    c.configuration.bipolar = false;
+    c.configuration.range = segment::RANGE_DEFAULT;
+    c.configuration.quant_scale = 0;
+    c.configuration.reset_on_gate = false;
+    c.gate.type = GATE_SOURCE_NONE;
+    c.primary.type = c.secondary.type = SOURCE_CONSTANT;
+    c.primary.value = c.secondary.value = 0.0f;
+    bool has_cv = false;
+    bool has_slider = false;
+
+    while ((token = strtok(NULL, separators)) != NULL) {
+      char* value = strchr(token, '=');
+      if (!value) {
+        return Error("expected key=value, got", token);
+      }
+      *value++ = '\0';
+      bool valid = true;
+      if (!strcmp(token, "type")) {
+        valid = ParseType(value, &c.configuration.type);
+      } else if (!strcmp(token, "loop")) {
+        c.configuration.loop = atoi(value) != 0;
+      } else if (!strcmp(token, "bipolar")) {
+        c.configuration.bipolar = atoi(value) != 0;
+      } else if (!strcmp(token, "reset")) {
+        c.configuration.reset_on_gate = atoi(value) != 0;
+      } else if (!strcmp(token, "scale")) {
+        c.configuration.quant_scale = atoi(value);
+      } else if (!strcmp(token, "range")) {
+        valid = ParseRange(value, &c.configuration.range);
+      } else if (!strcmp(token, "gate")) {
+        valid = ParseGate(value, &c.gate);
+      } else if (!strcmp(token, "primary")) {
+        valid = ParseSource(value, &c.primary);
+      } else if (!strcmp(token, "secondary")) {
+        valid = ParseSource(value, &c.secondary);
+      } else if (!strcmp(token, "cv")) {
+        valid = ParseSource(value, &c.cv);
+        has_cv = true;
+      } else if (!strcmp(token, "slider")) {
+        valid = ParseSource(value, &c.slider);
+        has_slider = true;
+      } else {
+        return Error("unknown key", token);
+      }
+      if (!valid) {
+        return Error("invalid value", value);
+      }
+    }
+
+    // On the module, cv_slider is the sum of the CV and slider. Without more
+    // information, consider that everything comes from the slider.
+    if (!has_cv) {
+      c.cv.type = SOURCE_CONSTANT;
+      c.cv.value = 0.0f;
+    }
+    if (!has_slider) {
+      c.slider = c.primary;
+    }
+    patch->channels.push_back(c);
+    return true;
+  }
+
+  static bool ParseType(const char* s, segment::Type* type) {
+    const char* names[] = { "ramp", "step", "hold", "turing" };
+    for (int i = 0; i < 4; ++i) {
+      if (!strcmp(s, names[i])) {
+        *type = segment::Type(i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool ParseRange(const char* s, segment::FreqRange* range) {
+    const char* names[] = { "default", "slow", "fast", "audio" };
+    for (int i = 0; i < 4; ++i) {
+      if (!strcmp(s, names[i])) {
+        *range = segment::FreqRange(i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool ParseGate(const char* s, GateSource* gate) {
+    if (!strcmp(s, "none")) {
+      gate->type = GATE_SOURCE_NONE;
+    } else if (!strcmp(s, "test")) {
+      gate->type = GATE_SOURCE_TEST_PATTERN;
+    } else if (!strncmp(s, "in:", 3)) {
+      gate->type = GATE_SOURCE_INPUT;
+      gate->input = atoi(s + 3);
+    } else if (sscanf(s, "pulse:%d:%d", &gate->period, &gate->width) == 2) {
+      gate->type = GATE_SOURCE_PULSE;
+      return gate->period > 0 && gate->width >= 0;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  static bool ParseSource(const char* s, Source* source) {
+    char* end;
+    if (!strncmp(s, "cv:", 3)) {
+      source->type = SOURCE_CV_INPUT;
+      source->value = atoi(s + 3);
+    } else if (!strncmp(s, "tri:", 4)) {
+      source->type = SOURCE_TRIANGLE;
+      source->value = strtof(s + 4, &end);
+      return *end == '\0' && source->value > 0.0f;
+    } else {
+      source->type = SOURCE_CONSTANT;
+      source->value = strtof(s, &end);
+      return *end == '\0';
+    }
+    return true;
+  }
+
+  const char* file_name_;
+  int line_number_;
+
+  DISALLOW_COPY_AND_ASSIGN(PatchParser);
+};
+
+const size_t kMaxBlockSize = 256;
+
+// A gate is high above ~1V on a 10V full-scale input file.
+const float kGateThreshold = 0.1f;
+
+class PatchRenderer {
+ public:
+  PatchRenderer() { }
+  ~PatchRenderer() { }
+
+  // When batch_lfos is set, free-running LFOs are rendered together by an
+  // LfoBank rather than by their SegmentGenerator. The output is identical.
+  void Init(const Patch* patch, const WavReader* gate_input,
+            const WavReader* cv_input, bool batch_lfos) {
+    patch_ = patch;
+    batch_lfos_ = batch_lfos;
+    gate_input_ = gate_input;
+    cv_input_ = cv_input;
+    num_channels_ = patch->channels.size();
+    frame_ = 0;
+    std::fill(&no_gate_[0], &no_gate_[kMaxBlockSize], GATE_FLAG_LOW);
+    last_sample_.value = 0.0f;
+    last_sample_.phase = 0.0f;
+    last_sample_.segment = 0;
+    last_sample_.changed_segments = 0;
+
+    for (size_t i = 0; i < kMaxNumSegments + kNumChannels; ++i) {
+      note_quantizer_[i].Init(13, 0.03f, false);
+    }
+    lfo_bank_.Init(patch->multimode);
+    for (int i = 0; i < kMaxNumLfoBankLanes; ++i) {
+      lfo_output_ptr_[i] = lfo_output_[i];
+    }
+    for (size_t i = 0; i < num_channels_; ++i) {
+      generator_[i].Init(
+          patch->multimode,
+          &note_quantizer_[i],
+          &segment_pool_[i / kNumChannels],
+          i % kNumChannels);
+      previous_gate_[i] = 0;
+      lfo_lane_[i] = -1;
+
+      const GateSource& g = patch->channels[i].gate;
+      if (g.type == GATE_SOURCE_TEST_PATTERN) {
+        pulses_[i].CreateTestPattern();
+      } else if (g.type == GATE_SOURCE_PULSE) {
+        pulses_[i].AddPulses(g.period, g.width, 0x7fffffff);
+      }
+    }
+    Configure();
+  }
+
+  inline size_t num_channels() const { return num_channels_; }
+  inline SegmentGenerator* generator(size_t i) { return &generator_[i]; }
+
+  // Renders size frames, with parameters updated once at the beginning of
+  // the block, like on the module. out receives num_channels() interleaved
+  // values per frame.
+  void Render(float* out, size_t size) {
+    BindParameters();
+
+    // As in stages.cc, the output buffer is shared by all channels, so that
+    // slave channels can observe the segment and phase of their group leader.
+    SegmentGenerator::Output* o = output_;
+    std::fill(&o[0], &o[size], last_sample_);
+    if (lfo_bank_.num_lanes()) {
+      lfo_bank_.Process(lfo_output_ptr_, size);
+    }
+    for (size_t channel = 0; channel < num_channels_; ++channel) {
+      ReadGates(channel, size);
+      o->changed_segments >>= 1;
+      if (lfo_lane_[channel] != -1) {
+        const SegmentGenerator::Output* lfo = lfo_output_[lfo_lane_[channel]];
+        for (size_t i = 0; i < size; ++i) {
+          o[i].value = lfo[i].value;
+          o[i].phase = lfo[i].phase;
+          o[i].segment = lfo[i].segment;
+        }
+      } else {
+        GateSourceType type = patch_->channels[channel].gate.type;
+        bool patched = type != GATE_SOURCE_NONE;
+        generator_[channel].Process(
+            patched ? gate_[channel] : no_gate_,
+            type == GATE_SOURCE_INPUT ? edge_offset_[channel] : NULL,
+            patched && HasGateEdges(gate_[channel], size),
+            o,
+            size);
+      }
+      for (size_t i = 0; i < size; ++i) {
+        out[i * num_channels_ + channel] = o[i].value;
+      }
+    }
+    frame_ += size;
+  }
+
+ private:
+  float Evaluate(const Source& s) const {
+    switch (s.type) {
+      case SOURCE_CV_INPUT:
+        return cv_input_ ? cv_input_->sample(frame_, size_t(s.value)) : 0.0f;
+
+      case SOURCE_TRIANGLE:
+        {
+          float phase = static_cast<float>(frame_) / (s.value * kSampleRate);
+          phase -= static_cast<float>(static_cast<int64_t>(phase));
+          return phase < 0.5f ? 2.0f * phase : 2.0f - 2.0f * phase;
+        }
+
+      default:
+        return s.value;
+    }
+  }
+
+  void ReadGates(size_t channel, size_t size) {
+    const GateSource& g = patch_->channels[channel].gate;
+    GateFlags* flags = gate_[channel];
+    if (g.type == GATE_SOURCE_INPUT) {
+      GateFlags previous = previous_gate_[channel];
+      float* edge_offset = edge_offset_[channel];
+      for (size_t i = 0; i < size; ++i) {
+        float x = gate_input_ ? gate_input_->sample(frame_ + i, g.input) : 0.0f;
+        previous = flags[i] = ExtractGateFlags(previous, x > kGateThreshold);
+
+        // Unlike the module, we can locate the threshold crossing between
+        // two samples of the input.
+        edge_offset[i] = 0.0f;
+        if (previous & (GATE_FLAG_RISING | GATE_FLAG_FALLING)) {
+          float x_previous = frame_ + i
+              ? gate_input_->sample(frame_ + i - 1, g.input)
+              : 0.0f;
+          edge_offset[i] = (x - kGateThreshold) / (x - x_previous);
+          CONSTRAIN(edge_offset[i], 0.0f, 0.999f);
+        }
+      }
+      previous_gate_[channel] = previous;
+    } else if (g.type != GATE_SOURCE_NONE) {
+      pulses_[channel].Render(flags, size);
+    }
+  }
+
+  // Mirrors ChainState::Configure, with all channels considered local.
+  void Configure() {
+    segment::Configuration configuration[kMaxNumSegments];
+    size_t last_patched_channel = num_channels_;
+
+    num_bindings_ = 0;
+    for (size_t i = 0; i < num_channels_; ++i) {
+      if (patch_->channels[i].gate.type == GATE_SOURCE_NONE) {
+        if (last_patched_channel != num_channels_) {
+          generator_[i].ConfigureSlave(i - last_patched_channel);
+        } else {
+          generator_[i].ConfigureSingleSegment(
+              false, patch_->channels[i].configuration);
+          if (batch_lfos_ && generator_[i].is_free_running_lfo()) {
+            lfo_lane_[i] = lfo_bank_.AddLane(patch_->channels[i].configuration);
+          }
+          if (lfo_lane_[i] == -1) {
+            AddBinding(i, i, 0);
+          }
+        }
+      } else {
+        last_patched_channel = i;
+        int num_segments = 0;
+        size_t channel = i;
+        do {
+          configuration[num_segments] = patch_->channels[channel].configuration;
+          AddBinding(i, channel, num_segments);
+          ++channel;
+          ++num_segments;
+        } while (channel < num_channels_ &&
+                 patch_->channels[channel].gate.type == GATE_SOURCE_NONE);
+        generator_[i].Configure(true, configuration, num_segments);
+      }
+    }
+  }
+
+  void AddBinding(size_t generator, size_t source, size_t destination) {
+    binding_[num_bindings_].generator = generator;
+    binding_[num_bindings_].source = source;
+    binding_[num_bindings_].destination = destination;
+    ++num_bindings_;
+  }
+
+  void BindParameters() {
+    for (size_t i = 0; i < num_channels_; ++i) {
+      if (lfo_lane_[i] != -1) {
+        const ChannelPatch& c = patch_->channels[i];
+        lfo_bank_.set_parameters(
+            lfo_lane_[i], Evaluate(c.primary), Evaluate(c.secondary));
+      }
+    }
+    for (size_t i = 0; i < num_bindings_; ++i) {
+      const Binding& b = binding_[i];
+      const ChannelPatch& c = patch_->channels[b.source];
+      if (b.destination < size_t(kMaxNumLocalSegments)) {
+        generator_[b.generator].set_segment_parameters(
+            b.destination,
+            Evaluate(c.primary),
+            Evaluate(c.secondary),
+            Evaluate(c.cv),
+            Evaluate(c.slider));
+      } else {
+        generator_[b.generator].set_segment_parameters(
+            b.destination,
+            Evaluate(c.primary),
+            Evaluate(c.secondary));
+      }
+    }
+  }
+
+  struct Binding {
+    size_t generator;
+    size_t source;
+    size_t destination;
+  };
+
+  const Patch* patch_;
+  const WavReader* gate_input_;
+  const WavReader* cv_input_;
+  size_t num_channels_;
+  size_t frame_;
+
+  bool batch_lfos_;
+
+  SegmentGenerator generator_[kMaxNumSegments];
+  // As in stages.cc, generator i uses quantizers i to i + its number of
+  // segments.
+  stmlib::HysteresisQuantizer2 note_quantizer_[kMaxNumSegments + kNumChannels];
+  // One pool of segments per module.
+  SegmentGenerator::Pool segment_pool_[kMaxNumSegments / kNumChannels];
+  PulseGenerator pulses_[kMaxNumSegments];
+  GateFlags previous_gate_[kMaxNumSegments];
+  GateFlags gate_[kMaxNumSegments][kMaxBlockSize];
+  float edge_offset_[kMaxNumSegments][kMaxBlockSize];
+  GateFlags no_gate_[kMaxBlockSize];
+
+  size_t num_bindings_;
+  Binding binding_[kMaxNumSegments];
+
+  SegmentGenerator::Output output_[kMaxBlockSize];
+  SegmentGenerator::Output last_sample_;
+
+  LfoBank lfo_bank_;
+  int lfo_lane_[kMaxNumSegments];
+  SegmentGenerator::Output lfo_output_[kMaxNumLfoBankLanes][kMaxBlockSize];
+  SegmentGenerator::Output* lfo_output_ptr_[kMaxNumLfoBankLanes];
+
+  DISALLOW_COPY_AND_ASSIGN(PatchRenderer);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_TEST_PATCH_H_
@@ -0,0 +1,169 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Cortex-M4 cycle-budget estimator. Runs the benchmark cases of stages_perf
+// on a build of the segment generator with STAGES_COUNT_OPS defined, counts
+// the operations done by each call to the process function (see
+// op_counter.h), and converts the counts into an estimated number of M4
+// cycles per block.
+//
+// On the module, the six channels have to be rendered in the time it takes
+// to play a block (kBlockSize samples at kSampleRate), so each channel of a
+// group gets a sixth of it. The per-op costs below are rough figures for an
+// STM32F373 running from flash; the estimate is meant to compare segment
+// types and to spot the ones that cannot fit, not to replace a measurement
+// on the hardware.
+//
+// A case whose process function recorded nothing besides the call and the
+// per-sample overhead has no COUNT_OP in its body: it is reported as not
+// instrumented rather than as (wrongly) almost free. Functions that really do
+// nothing else say so with a COUNT_OPS of 0.
+//
+// Usage: stages_budget [--filter substring] [--verbose]
+//
+// The exit code is 1 if the worst block of any case exceeds its budget.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "stages/io_buffer.h"
+#include "stages/op_counter.h"
+#include "stages/test/benchmarks.h"
+
+#ifndef STAGES_COUNT_OPS
+#error "stages_budget must be built with -DSTAGES_COUNT_OPS"
+#endif  // STAGES_COUNT_OPS
+
+using namespace std;
+using namespace stages;
+
+const float kCpuFrequency = 72000000.0f;
+const float kCyclesPerBlock = kCpuFrequency * kBlockSize / kSampleRate;
+const float kCyclesPerChannel = kCyclesPerBlock / kNumChannels;
+
+const size_t kNumBudgetBlocks = 10 * 31250 / kBlockSize;  // 10s of signal.
+
+struct OpCost {
+  const char* name;
+  float cycles;
+};
+
+const OpCost op_costs[OP_LAST] = {
+  // Indirect call, prologue/epilogue, reloading members.
+  { "call", 24.0f },
+  // Loop counter, gate flag load, stores to the output.
+  { "sample", 8.0f },
+  // VADD, VMUL, VCMP and VMRS are single-cycle; VMLA is 3.
+  { "float", 1.2f },
+  // VDIV.F32.
+  { "div", 14.0f },
+  // VCVT, bounds, two loads with flash wait states, linear interpolation.
+  { "lut", 8.0f },
+  // Two table lookups and a multiplication.
+  { "semitones", 24.0f },
+  // LCG update and conversion.
+  { "random", 6.0f },
+  // Pipeline refill on a taken branch, and the code around it.
+  { "branch", 4.0f },
+};
+
+float EstimateCycles() {
+  float cycles = 0.0f;
+  for (int i = 0; i < OP_LAST; ++i) {
+    cycles += OpCounter::Get(Op(i)) * op_costs[i].cycles;
+  }
+  return cycles;
+}
+
+// Returns true if the case fits in its budget.
+bool EstimateBudget(const GeneratorBenchmark& b, bool verbose) {
+  GeneratorBenchmarkRunner runner;
+  SegmentGenerator::Output out[kBlockSize];
+  runner.Init(b, kNumBudgetBlocks);
+
+  double total_count[OP_LAST] = { 0 };
+  double total_cycles = 0.0;
+  float worst_cycles = 0.0f;
+  bool instrumented = false;
+  for (size_t i = 0; i < kNumBudgetBlocks; ++i) {
+    runner.PrepareBlock();
+    OpCounter::Reset();
+    runner.ProcessBlock(out);
+    instrumented = instrumented || OpCounter::Instrumented();
+    float cycles = EstimateCycles();
+    total_cycles += cycles;
+    worst_cycles = max(worst_cycles, cycles);
+    for (int j = 0; j < OP_LAST; ++j) {
+      total_count[j] += OpCounter::Get(Op(j));
+    }
+  }
+
+  if (!instrumented) {
+    printf("%-40s not instrumented\n", b.name.c_str());
+    return true;
+  }
+
+  // A group of N segments uses the time slots of N channels.
+  float budget = kCyclesPerChannel * b.num_segments;
+  bool fits = worst_cycles <= budget;
+  printf("%-40s %7.0f mean %7.0f worst %6.0f budget %5.1f%%%s\n",
+         b.name.c_str(),
+         total_cycles / kNumBudgetBlocks,
+         worst_cycles,
+         budget,
+         100.0f * worst_cycles / budget,
+         fits ? "" : "  OVER BUDGET");
+  if (verbose) {
+    printf("   ");
+    for (int i = 0; i < OP_LAST; ++i) {
+      printf(" %s:%.1f", op_costs[i].name, total_count[i] / kNumBudgetBlocks);
+    }
+    printf(" (per block)\n");
+  }
+  return fits;
+}
+
+int main(int argc, char** argv) {
+  const char* filter = NULL;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (!strcmp(argv[i], "--verbose")) {
+      verbose = true;
+    } else {
+      fprintf(stderr, "Usage: %s [--filter substring] [--verbose]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("Estimated Cortex-M4 cycles per block of %lu samples "
+         "(%.0f cycles available per channel)\n\n",
+         kBlockSize, kCyclesPerChannel);
+
+  int num_over_budget = 0;
+  vector<GeneratorBenchmark> benchmarks = GeneratorBenchmarks();
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    if (filter && !strstr(benchmarks[i].name.c_str(), filter)) {
+      continue;
+    }
+    num_over_budget += !EstimateBudget(benchmarks[i], verbose);
+  }
+  return num_over_budget ? 1 : 0;
+}
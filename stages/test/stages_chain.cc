@@ -0,0 +1,311 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Chain timing measurements on the virtual chain (see virtual_chain.h), for
+// chains of 1 to 6 modules:
+//
+// - positions: time between power-on and the moment all the modules know
+//   their position in the chain.
+// - discovery: time between power-on and the end of the discovery phase of
+//   all modules, when they start processing.
+// - parameters: the chain is a 6N-step addressable sequencer started from
+//   the first channel, which plays the last step. This is the time between
+//   a move of the last slider of the chain and the corresponding change on
+//   the output of the first channel. Measured again with all the sliders of
+//   the chain moving at the same time.
+// - reconfiguration: time between patching (or unpatching) an input on the
+//   last module and the first module shortening (or extending) its group.
+//   Unpatching includes the deliberate delay of ChainState.
+//
+// Usage: stages_chain [--modules n] [--latency seconds] [--jitter seconds]
+//                     [--loss probability] [--boot-skew blocks]
+//                     [--trials n] [--seed n]
+//
+// The exit code is 1 if a chain fails to discover itself, or if a change
+// does not make it to the first module.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "stages/test/virtual_chain.h"
+
+using namespace std;
+using namespace stages;
+
+const size_t kMaxDiscoveryBlocks = size_t(4.0f * kSampleRate / kBlockSize);
+// Unpatched inputs are ignored after 2000 updates of the local state, ie 2s.
+const size_t kMaxChangeBlocks = size_t(4.0f * kSampleRate / kBlockSize);
+const size_t kSettleBlocks = size_t(0.25f * kSampleRate / kBlockSize);
+
+struct ChainOptions {
+  VirtualLinkOptions link;
+  size_t boot_skew;
+  size_t num_trials;
+  uint32_t seed;
+};
+
+class Statistics {
+ public:
+  Statistics() : num_failures_(0) { }
+
+  void Add(size_t num_blocks, bool success) {
+    if (success) {
+      blocks_.push_back(num_blocks);
+    } else {
+      ++num_failures_;
+    }
+  }
+
+  void Print(const char* name) const {
+    if (blocks_.empty()) {
+      printf("  %-16s failed\n", name);
+      return;
+    }
+    size_t sum = 0;
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+      sum += blocks_[i];
+    }
+    printf("  %-16s min %7.1fms  mean %7.1fms  max %7.1fms",
+           name,
+           Milliseconds(*min_element(blocks_.begin(), blocks_.end())),
+           Milliseconds(sum) / float(blocks_.size()),
+           Milliseconds(*max_element(blocks_.begin(), blocks_.end())));
+    if (num_failures_) {
+      printf("  (%lu failed)", num_failures_);
+    }
+    printf("\n");
+  }
+
+  inline size_t num_failures() const { return num_failures_; }
+
+ private:
+  static float Milliseconds(size_t num_blocks) {
+    return float(num_blocks) * kVirtualBlockDuration * 1000.0f;
+  }
+
+  vector<size_t> blocks_;
+  size_t num_failures_;
+};
+
+void Run(VirtualChain* chain, size_t num_blocks) {
+  while (num_blocks--) {
+    chain->Process();
+  }
+}
+
+// Patches the first channel, and turns all the others into steps.
+void ConfigureSequencer(VirtualChain* chain) {
+  for (size_t i = 0; i < chain->num_modules(); ++i) {
+    VirtualModule* m = chain->module(i);
+    for (size_t j = 0; j < kNumChannels; ++j) {
+      bool first = i == 0 && j == 0;
+      m->set_segment_configuration(j, first ? 0 : segment::TYPE_STEP);
+      m->set_input_patched(j, first);
+      m->set_slider(j, first ? 1.0f : 0.5f);
+      // Fully clockwise on the first channel is the addressable mode.
+      m->set_pot(j, first ? 1.0f : 0.0f);
+    }
+  }
+}
+
+// When all_sliders is true, all the other sliders of the chain move at the
+// same time as the last one, and compete with it for room in the packets.
+void MeasureParameters(
+    VirtualChain* chain,
+    const ChainOptions& options,
+    bool all_sliders,
+    Statistics* s) {
+  VirtualModule* first = chain->module(0);
+  VirtualModule* last = chain->module(chain->num_modules() - 1);
+  for (size_t trial = 0; trial < options.num_trials; ++trial) {
+    // Moves happen at different times in the transmission cycle.
+    Run(chain, kSettleBlocks + rand() % 64);
+    float before = first->output(0);
+    float value = trial & 1 ? 0.5f : 0.25f;
+    for (size_t i = 0; all_sliders && i < chain->num_modules(); ++i) {
+      for (size_t j = i == 0 ? 1 : 0; j < kNumChannels; ++j) {
+        chain->module(i)->set_slider(j, value);
+      }
+    }
+    last->set_slider(kNumChannels - 1, value);
+    size_t num_blocks = 0;
+    bool changed = false;
+    while (!changed && num_blocks < kMaxChangeBlocks) {
+      chain->Process();
+      ++num_blocks;
+      changed = fabsf(first->output(0) - before) > 0.01f;
+    }
+    s->Add(num_blocks, changed);
+  }
+}
+
+void MeasureReconfiguration(
+    VirtualChain* chain,
+    const ChainOptions& options,
+    Statistics* patch,
+    Statistics* unpatch) {
+  size_t n = chain->num_modules();
+  VirtualModule* last = chain->module(n - 1);
+  SegmentGenerator* group = chain->module(0)->segment_generator(0);
+  const size_t channel = 3;
+
+  for (size_t trial = 0; trial < options.num_trials; ++trial) {
+    bool patched = trial & 1 ? false : true;
+    int expected_num_segments = patched
+        ? (n - 1) * kNumChannels + channel
+        : n * kNumChannels;
+    Run(chain, kSettleBlocks + rand() % 64);
+    last->set_input_patched(channel, patched);
+    size_t num_blocks = 0;
+    while (group->num_segments() != expected_num_segments &&
+           num_blocks < kMaxChangeBlocks) {
+      chain->Process();
+      ++num_blocks;
+    }
+    (patched ? patch : unpatch)->Add(
+        num_blocks, group->num_segments() == expected_num_segments);
+  }
+}
+
+bool MeasureChain(size_t num_modules, const ChainOptions& options) {
+  VirtualChain* chain = new VirtualChain();
+  size_t boot_delay[kMaxChainSize];
+  for (size_t i = 0; i < num_modules; ++i) {
+    boot_delay[i] = options.boot_skew ? rand() % (options.boot_skew + 1) : 0;
+  }
+  chain->Init(
+      num_modules,
+      MULTI_MODE_STAGES,
+      options.link,
+      options.seed,
+      boot_delay);
+
+  printf("%lu module%s (%lu channels)\n",
+         num_modules, num_modules > 1 ? "s" : "",
+         num_modules * kNumChannels);
+
+  Statistics positions;
+  Statistics discovery;
+  size_t positions_known = 0;
+  while (!chain->discovered() && chain->num_blocks() < kMaxDiscoveryBlocks) {
+    chain->Process();
+    if (!positions_known && chain->positions_known()) {
+      positions_known = chain->num_blocks();
+    }
+  }
+  positions.Add(positions_known, positions_known != 0);
+  discovery.Add(chain->num_blocks(), chain->discovered());
+  positions.Print("positions");
+  discovery.Print("discovery");
+  if (!chain->discovered()) {
+    for (size_t i = 0; i < num_modules; ++i) {
+      const ChainState& c = chain->module(i)->chain_state();
+      printf("    module %lu: index %lu, size %lu\n", i, c.index(), c.size());
+    }
+    delete chain;
+    return false;
+  }
+
+  ConfigureSequencer(chain);
+  Run(chain, kMaxChangeBlocks);
+  int num_segments = chain->module(0)->segment_generator(0)->num_segments();
+  if (num_segments != int(num_modules * kNumChannels)) {
+    printf("  first group has %d segments\n", num_segments);
+    delete chain;
+    return false;
+  }
+
+  Statistics parameters;
+  MeasureParameters(chain, options, false, &parameters);
+  parameters.Print("parameters");
+
+  Statistics all_parameters;
+  MeasureParameters(chain, options, true, &all_parameters);
+  all_parameters.Print("all parameters");
+
+  Statistics patch;
+  Statistics unpatch;
+  MeasureReconfiguration(chain, options, &patch, &unpatch);
+  patch.Print("patch");
+  unpatch.Print("unpatch");
+
+  if (chain->bytes_sent()) {
+    printf("  %lu bytes lost out of %lu\n",
+           chain->bytes_lost(), chain->bytes_sent());
+  }
+  printf("\n");
+
+  bool success = !parameters.num_failures() && \
+      !all_parameters.num_failures() && \
+      !patch.num_failures() && !unpatch.num_failures();
+  delete chain;
+  return success;
+}
+
+int main(int argc, char** argv) {
+  ChainOptions options;
+  options.link.latency = 0.0f;
+  options.link.jitter = 0.0f;
+  options.link.byte_loss = 0.0f;
+  options.boot_skew = 0;
+  options.num_trials = 16;
+  options.seed = 0;
+  size_t num_modules = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--modules") && i + 1 < argc) {
+      num_modules = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--latency") && i + 1 < argc) {
+      options.link.latency = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--jitter") && i + 1 < argc) {
+      options.link.jitter = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--loss") && i + 1 < argc) {
+      options.link.byte_loss = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--boot-skew") && i + 1 < argc) {
+      options.boot_skew = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--trials") && i + 1 < argc) {
+      options.num_trials = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      options.seed = atoi(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--modules n] [--latency seconds] "
+              "[--jitter seconds] [--loss probability] [--boot-skew blocks] "
+              "[--trials n] [--seed n]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (num_modules > kMaxChainSize) {
+    fprintf(stderr, "A chain has at most %lu modules\n", kMaxChainSize);
+    return 1;
+  }
+
+  srand(options.seed);
+  int num_failures = 0;
+  for (size_t n = 1; n <= kMaxChainSize; ++n) {
+    if (num_modules && n != num_modules) {
+      continue;
+    }
+    num_failures += !MeasureChain(n, options);
+  }
+  return num_failures ? 1 : 0;
+}
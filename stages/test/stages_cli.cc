@@ -0,0 +1,226 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Offline renderer. Renders one or several patch files (see patch.h for the
+// syntax) to 32-bit float WAV or raw float files, one channel per output.
+//
+//   stages_cli --gates gates.wav --cv cv.wav --duration 20
+//       --output-dir renders adsr.patch lfo.patch
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "stages/io_buffer.h"
+#include "stages/test/patch.h"
+#include "stages/test/wav_file.h"
+
+using namespace stages;
+using namespace std;
+
+namespace po = boost::program_options;
+
+struct RenderOptions {
+  string gates;
+  string cv;
+  string output_dir;
+  string format;
+  float duration;
+  size_t block_size;
+  bool no_batch;
+  bool quiet;
+};
+
+// Loads an input file. The inputs are read frame by frame, without
+// resampling, so the file must be at the sample rate of the module.
+bool LoadInput(const string& file_name, WavReader* reader) {
+  if (!reader->Load(file_name.c_str())) {
+    cerr << file_name << ": cannot read file" << endl;
+    return false;
+  }
+  if (reader->sample_rate() != static_cast<uint32_t>(kSampleRate)) {
+    cerr << file_name << ": sample rate is " << reader->sample_rate()
+         << "Hz instead of " << kSampleRate << "Hz" << endl;
+    return false;
+  }
+  return true;
+}
+
+// Strips the directory and extension from a patch file name.
+string BaseName(const string& path) {
+  size_t start = path.find_last_of('/');
+  start = start == string::npos ? 0 : start + 1;
+  size_t end = path.find_last_of('.');
+  if (end == string::npos || end < start) {
+    end = path.size();
+  }
+  return path.substr(start, end - start);
+}
+
+bool RenderPatch(
+    const string& patch_file,
+    const RenderOptions& options,
+    const WavReader* gates,
+    const WavReader* cv) {
+  Patch patch;
+  PatchParser parser;
+  if (!parser.Parse(patch_file.c_str(), &patch)) {
+    return false;
+  }
+
+  OutputFormat format = options.format == "raw"
+      ? OUTPUT_FORMAT_RAW
+      : OUTPUT_FORMAT_WAV;
+  string output_file = options.output_dir + "/" + BaseName(patch_file) + \
+      (format == OUTPUT_FORMAT_RAW ? ".raw" : ".wav");
+
+  // Too large for the stack when rendering a full chain.
+  PatchRenderer* renderer = new PatchRenderer();
+  renderer->Init(&patch, gates, cv, !options.no_batch);
+
+  FloatWavWriter writer;
+  if (!writer.Open(
+          output_file.c_str(),
+          format,
+          renderer->num_channels(),
+          static_cast<uint32_t>(kSampleRate))) {
+    cerr << output_file << ": cannot open file" << endl;
+    delete renderer;
+    return false;
+  }
+
+  size_t num_frames = static_cast<size_t>(options.duration * kSampleRate);
+  vector<float> buffer(options.block_size * renderer->num_channels());
+
+  chrono::high_resolution_clock::time_point start = \
+      chrono::high_resolution_clock::now();
+  while (num_frames) {
+    size_t size = min(num_frames, options.block_size);
+    renderer->Render(&buffer[0], size);
+    writer.Write(&buffer[0], size);
+    num_frames -= size;
+  }
+  writer.Close();
+  double elapsed = chrono::duration<double>(
+      chrono::high_resolution_clock::now() - start).count();
+
+  if (!options.quiet) {
+    printf("%s -> %s: %lu channels, %.2fx real-time\n",
+           patch_file.c_str(),
+           output_file.c_str(),
+           renderer->num_channels(),
+           elapsed > 0.0 ? options.duration / elapsed : 0.0);
+  }
+  delete renderer;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  RenderOptions options;
+  vector<string> patches;
+
+  po::options_description visible("Options");
+  visible.add_options()
+      ("help,h", "Show this message")
+      ("gates,g", po::value<string>(&options.gates),
+       "Gate input file (WAV at 31250Hz). Channel N is used by gate=in:N")
+      ("cv,c", po::value<string>(&options.cv),
+       "CV input file (WAV at 31250Hz). Channel N is used by cv:N sources")
+      ("output-dir,o", po::value<string>(&options.output_dir)->default_value("."),
+       "Directory in which the renders are written")
+      ("format,f", po::value<string>(&options.format)->default_value("wav"),
+       "Output format: wav or raw (interleaved 32-bit floats)")
+      ("duration,d", po::value<float>(&options.duration)->default_value(0.0f),
+       "Duration in seconds. Defaults to the length of the longest input, "
+       "or 20s without inputs")
+      ("block-size,b",
+       po::value<size_t>(&options.block_size)->default_value(kBlockSize),
+       "Number of samples rendered between parameter updates")
+      ("no-batch", po::bool_switch(&options.no_batch),
+       "Render free-running LFOs one by one instead of with the LFO bank")
+      ("quiet,q", po::bool_switch(&options.quiet), "Do not print statistics");
+
+  po::options_description hidden;
+  hidden.add_options()
+      ("patch", po::value<vector<string> >(&patches), "Patch files");
+
+  po::options_description all;
+  all.add(visible).add(hidden);
+
+  po::positional_options_description positional;
+  positional.add("patch", -1);
+
+  po::variables_map vm;
+  try {
+    po::store(
+        po::command_line_parser(argc, argv)
+            .options(all).positional(positional).run(),
+        vm);
+    po::notify(vm);
+  } catch (const po::error& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  if (vm.count("help") || patches.empty()) {
+    cout << "Usage: " << argv[0] << " [options] patch..." << endl;
+    cout << visible << endl;
+    return vm.count("help") ? 0 : 1;
+  }
+
+  if (options.format != "wav" && options.format != "raw") {
+    cerr << "Unknown output format: " << options.format << endl;
+    return 1;
+  }
+
+  if (options.block_size == 0 || options.block_size > kMaxBlockSize) {
+    cerr << "Block size must be between 1 and " << kMaxBlockSize << endl;
+    return 1;
+  }
+
+  WavReader gates;
+  WavReader cv;
+  if (!options.gates.empty() && !LoadInput(options.gates, &gates)) {
+    return 1;
+  }
+  if (!options.cv.empty() && !LoadInput(options.cv, &cv)) {
+    return 1;
+  }
+
+  if (options.duration <= 0.0f) {
+    size_t num_frames = max(gates.num_frames(), cv.num_frames());
+    options.duration = num_frames
+        ? static_cast<float>(num_frames) / kSampleRate
+        : 20.0f;
+  }
+
+  int num_failures = 0;
+  for (size_t i = 0; i < patches.size(); ++i) {
+    if (!RenderPatch(
+            patches[i],
+            options,
+            options.gates.empty() ? NULL : &gates,
+            options.cv.empty() ? NULL : &cv)) {
+      ++num_failures;
+    }
+  }
+  return num_failures ? 1 : 0;
+}
@@ -1,316 +1,639 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Benchmark suite. Every slot of the process function tables is timed block
+// by block (kBlockSize samples, like on the module), and the following are
+// reported:
+// - mean time per sample, in ns and in timestamp counter ticks.
+// - worst-case and 99.9th percentile time per block. This is what matters on
+//   the module, since the IOBuffer only has kNumBlocks - 1 blocks of slack.
+//
+// Usage: stages_perf [--filter substring] [--json results.json]
+//                    [--baseline baseline.json] [--tolerance 0.1]
+//
+// When a baseline is given, the exit code is 1 if any benchmark's mean or
+// 99.9th percentile block time regressed by more than the tolerance.
+
 #include <math.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
-#include <iostream>
-#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
+#include "stages/test/benchmarks.h"
 #include "stages/test/fixtures.h"
+#include "stages/attractor.h"
+#include "stages/envelope.h"
+#include "stages/envelope_bank.h"
+#include "stages/io_buffer.h"
+#include "stages/lfo_bank.h"
+#include "stages/phase_warp.h"
 #include "stages/quantizer.h"
+#include "stages/random_stream.h"
 #include "stages/braids_quantizer.h"
 #include "stages/quantizer_scales.h"
 
 using namespace std;
-using namespace chrono;
 using namespace stages;
 
-using timer = high_resolution_clock;
+using timer = chrono::high_resolution_clock;
 
 template <typename T>
 void use(T&& t) {
   __asm__ __volatile__("" ::"g"(t));
 }
 
-template <typename T>
-time_t time(T code, size_t iterations) {
-  auto start = timer::now();
-  while (iterations--) {
-    use(code());
-  }
-  auto end = timer::now();
-  return duration_cast<nanoseconds>(end - start).count();
+inline uint64_t ReadTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return chrono::duration_cast<chrono::nanoseconds>(
+      timer::now().time_since_epoch()).count();
+#endif
 }
 
-template <typename T>
-size_t pick_iters(T code) {
-  size_t iterations;
-  for (iterations = 1; iterations < 1e9; iterations *= 10) {
-    time_t t = time(code, iterations);
-    if (t > 10e6) {
-      return 10 * iterations;
+const size_t kNumRuns = 7;
+const size_t kNumBenchmarkBlocks = 2 * 31250 / kBlockSize;  // 2s of signal per run.
+
+struct Result {
+  string name;
+  double ns_per_sample;
+  double ticks_per_sample;
+  double worst_block_ns;
+  double p999_block_ns;
+};
+
+// Times kNumBenchmarkBlocks calls to process(), kNumRuns times. setup() is
+// called before each run, and prepare() before each block, outside of the
+// timed section. The figures from the fastest run are kept for the mean,
+// and the smallest worst case across runs is kept, to reject the spikes
+// caused by the OS scheduler.
+template <typename Setup, typename Prepare, typename Process>
+Result Measure(const char* name, Setup setup, Prepare prepare,
+               Process process, size_t samples_per_block) {
+  Result r;
+  r.name = name;
+  r.ns_per_sample = r.ticks_per_sample = 1e30;
+  r.worst_block_ns = r.p999_block_ns = 1e30;
+
+  vector<uint64_t> ticks(kNumBenchmarkBlocks);
+  for (size_t run = 0; run < kNumRuns; ++run) {
+    setup();
+    timer::time_point start = timer::now();
+    uint64_t start_ticks = ReadTicks();
+    uint64_t total_ticks = 0;
+    for (size_t i = 0; i < kNumBenchmarkBlocks; ++i) {
+      prepare(i);
+      uint64_t block_start = ReadTicks();
+      process(i);
+      ticks[i] = ReadTicks() - block_start;
+      total_ticks += ticks[i];
     }
+    uint64_t elapsed_ticks = ReadTicks() - start_ticks;
+    double elapsed_ns = chrono::duration_cast<chrono::nanoseconds>(
+        timer::now() - start).count();
+    double ns_per_tick = elapsed_ns / max(elapsed_ticks, uint64_t(1));
+
+    double num_samples = kNumBenchmarkBlocks * samples_per_block;
+    r.ticks_per_sample = min(r.ticks_per_sample, total_ticks / num_samples);
+    r.ns_per_sample = min(
+        r.ns_per_sample, total_ticks * ns_per_tick / num_samples);
+
+    size_t p999 = kNumBenchmarkBlocks - 1 - kNumBenchmarkBlocks / 1000;
+    nth_element(ticks.begin(), ticks.begin() + p999, ticks.end());
+    r.p999_block_ns = min(r.p999_block_ns, ticks[p999] * ns_per_tick);
+    uint64_t worst = *max_element(ticks.begin() + p999, ticks.end());
+    r.worst_block_ns = min(r.worst_block_ns, worst * ns_per_tick);
   }
-  return iterations;
+  return r;
 }
 
-void printf_dur(double ns) {
-  if (ns < 1e3) {
-    printf("%0.3fns", ns);
-  } else if (ns < 1e6) {
-    printf("%0.3fus", ns / 1e3);
-  } else if (ns < 1e9) {
-    printf("%0.3fms", ns / 1e6);
-  } else {
-    printf("%0.3fs", ns / 1e9);
-  }
+Result TimeGenerator(const GeneratorBenchmark& b) {
+  GeneratorBenchmarkRunner runner;
+  SegmentGenerator::Output out[kBlockSize];
+
+  return Measure(
+      b.name.c_str(),
+      [&] { runner.Init(b, kNumBenchmarkBlocks); },
+      [&](size_t) { runner.PrepareBlock(); },
+      [&](size_t) {
+        runner.ProcessBlock(out);
+        use(out[kBlockSize - 1].value);
+      },
+      kBlockSize);
 }
 
-template <typename T>
-void timeit(T code, size_t runs) {
-  double min = INT64_MAX;
-  double mean = 0;
-  size_t iterations = pick_iters(code);
-  for (size_t i = 0; i < runs; i++) {
-    time_t t = time(code, iterations);
-    printf_dur(t / iterations);
-    printf(" ");
-    fflush(stdout);
-    mean += t;
-    if (t < min) {
-      min = t;
-    }
-  }
-  min /= iterations;
-  mean = mean / iterations / runs;
-
-  printf("\n%ld runs of %ld iterations; mean ", runs, iterations);
-  printf_dur(mean);
-  printf(", min ");
-  printf_dur(min);
-  printf("\n\n");
+// A full chain of free-running LFOs, rendered one by one by SegmentGenerators
+// or all at once by an LfoBank. Times are per sample and per channel.
+const int kNumLfos = kMaxNumSegments;
+
+void LfoParameters(int lfo, size_t block, float* primary, float* secondary) {
+  *primary = 0.3f + 0.4f * lfo / kNumLfos;
+  *secondary = static_cast<float>((block + lfo * 100) % 1000) / 1000.0f;
 }
 
-void TimeFreeLFO() {
-  cout << "Free LFO" << endl;
-  timeit(
-      [] {
-        SegmentGeneratorTest t;
-        segment::Configuration configuration = {segment::TYPE_RAMP, true, false,
-                                                segment::RANGE_DEFAULT};
-        t.generator()->Configure(false, &configuration, 1);
-
-        t.set_segment_parameters(0, 0.75f, 1.0f);
-        const size_t size = 8;
-        size_t duration = (1500 * 6 + 3000 * 2) * 1000 / size;
-        while (duration--) {
-          SegmentGenerator::Output out[size];
-
-          t.generator()->Process(0, out, size);
+segment::Configuration LfoConfiguration(int lfo) {
+  segment::Configuration c = {
+    segment::TYPE_RAMP, true, lfo % 3 == 0, segment::FreqRange(lfo % 3), 0,
+    false
+  };
+  return c;
+}
+
+Result TimeLfoGenerators() {
+  SegmentGenerator* generator = new SegmentGenerator[kNumLfos];
+  SegmentGenerator::Pool* pool = \
+      new SegmentGenerator::Pool[kNumLfos / kNumChannels];
+  HysteresisQuantizer2 note_quantizer[kNumLfos];
+  SegmentGenerator::Output out[kBlockSize];
+  Result r = Measure(
+      "lfo/segment_generator",
+      [&] {
+        for (int i = 0; i < kNumLfos; ++i) {
+          note_quantizer[i].Init(13, 0.03f, false);
+          generator[i].Init(
+              MULTI_MODE_STAGES,
+              &note_quantizer[i],
+              &pool[i / kNumChannels],
+              i % kNumChannels);
+          generator[i].ConfigureSingleSegment(false, LfoConfiguration(i));
+        }
+      },
+      [&](size_t block) {
+        for (int i = 0; i < kNumLfos; ++i) {
+          float primary, secondary;
+          LfoParameters(i, block, &primary, &secondary);
+          generator[i].set_segment_parameters(0, primary, secondary);
+        }
+      },
+      [&](size_t) {
+        for (int i = 0; i < kNumLfos; ++i) {
+          generator[i].Process(NULL, out, kBlockSize);
+          use(out[kBlockSize - 1].value);
         }
-        return 0;
       },
-      7);
+      kBlockSize * kNumLfos);
+  delete[] pool;
+  delete[] generator;
+  return r;
 }
 
-void TimeFreeFastLFO() {
-  cout << "Free Fast LFO" << endl;
-  timeit(
-      [] {
-        SegmentGeneratorTest t;
-        segment::Configuration configuration = {segment::TYPE_RAMP, true, false,
-                                                segment::RANGE_FAST};
-        t.generator()->Configure(false, &configuration, 1);
-
-        t.set_segment_parameters(0, 0.75f, 1.0f);
-        const size_t size = 8;
-        size_t duration = (1500 * 6 + 3000 * 2) * 1000 / size;
-        while (duration--) {
-          SegmentGenerator::Output out[size];
-
-          t.generator()->Process(0, out, size);
+Result TimeLfoBank() {
+  LfoBank* bank = new LfoBank();
+  SegmentGenerator::Output out[kNumLfos][kBlockSize];
+  SegmentGenerator::Output* out_ptr[kNumLfos];
+  for (int i = 0; i < kNumLfos; ++i) {
+    out_ptr[i] = out[i];
+  }
+  Result r = Measure(
+      "lfo/bank",
+      [&] {
+        bank->Init(MULTI_MODE_STAGES);
+        for (int i = 0; i < kNumLfos; ++i) {
+          bank->AddLane(LfoConfiguration(i));
+        }
+      },
+      [&](size_t block) {
+        for (int i = 0; i < kNumLfos; ++i) {
+          float primary, secondary;
+          LfoParameters(i, block, &primary, &secondary);
+          bank->set_parameters(i, primary, secondary);
         }
-        return 0;
       },
-      7);
+      [&](size_t) {
+        bank->Process(out_ptr, kBlockSize);
+        use(out[kNumLfos - 1][kBlockSize - 1].value);
+      },
+      kBlockSize * kNumLfos);
+  delete bank;
+  return r;
 }
 
+// The six envelopes of the six-EG modes, rendered one by one by Envelopes or
+// all at once by an EnvelopeBank. Times are per sample and per channel.
+void EnvelopeParameters(size_t ch, float* length, float* curve) {
+  *length = 0.05f + 0.05f * ch;
+  *curve = 0.2f + 0.1f * ch;
+}
 
-void TimeTapLFO() {
-  cout << "Tap LFO" << endl;
-  timeit(
-      [] {
-        SegmentGeneratorTest t;
-        segment::Configuration configuration = {segment::TYPE_RAMP, true, false,
-                                                segment::RANGE_DEFAULT};
-        t.generator()->Configure(true, &configuration, 1);
-        for (int i = 0; i < 1000; ++i) {
-          t.pulses()->AddPulses(1500, 500, 6);
-          t.pulses()->AddPulses(3000, 500, 2);
-          // t.pulses()->AddPulses(50, 15, 400);
-        }
-
-        t.set_segment_parameters(0, 0.5f, 0.5f);
-        const size_t size = 8;
-        while (!t.pulses()->empty()) {
-          GateFlags flags[size];
-          t.pulses()->Render(flags, 8);
-          SegmentGenerator::Output out[size];
+bool EnvelopeGate(size_t ch, size_t block) {
+  size_t period = 400 + 300 * ch;
+  return (block % period) < period / 2;
+}
 
-          t.generator()->Process(flags, out, size);
+Result TimeEnvelopes() {
+  Envelope envelope[kNumChannels];
+  float out[kBlockSize];
+  return Measure(
+      "envelope/objects",
+      [&] {
+        for (size_t ch = 0; ch < kNumChannels; ++ch) {
+          float length, curve;
+          EnvelopeParameters(ch, &length, &curve);
+          envelope[ch].Init();
+          envelope[ch].SetAttackLength(length);
+          envelope[ch].SetAttackCurve(curve);
+          envelope[ch].SetDecayLength(length);
+          envelope[ch].SetDecayCurve(curve);
+          envelope[ch].SetSustainLevel(0.5f);
+          envelope[ch].SetReleaseLength(length);
+          envelope[ch].SetReleaseCurve(curve);
         }
-        return 0;
       },
-      7);
-}
-
-void TimeOscillator() {
-  cout << "Oscillator" << endl;
-  timeit(
-      [] {
-        SegmentGeneratorTest t;
-        segment::Configuration configuration = {segment::TYPE_RAMP, true, true,
-                                                segment::RANGE_AUDIO};
-        t.generator()->Configure(false, &configuration, 1);
-        t.set_segment_parameters(0, 0.5f, 0.5f);
-        const size_t size = 8;
-        size_t duration = (1500 * 6 + 3000 * 2) * 1000 / size;
-        while (duration--) {
-          SegmentGenerator::Output out[size];
-
-          t.generator()->Process(0, out, size);
+      [&](size_t) { },
+      [&](size_t block) {
+        for (size_t ch = 0; ch < kNumChannels; ++ch) {
+          envelope[ch].Gate(EnvelopeGate(ch, block));
+          envelope[ch].Render(out, kBlockSize);
+          use(out[kBlockSize - 1]);
         }
-        return 0;
       },
-      7);
+      kBlockSize * kNumChannels);
 }
 
-void TimePllOscillator() {
-  cout << "PLL Oscillator" << endl;
-  timeit(
-      [] {
-        SegmentGeneratorTest t;
-        segment::Configuration configuration = {segment::TYPE_RAMP, true, true,
-                                                segment::RANGE_AUDIO};
-        t.generator()->Configure(true, &configuration, 1);
-        const size_t size = 8;
-        size_t duration = (1500 * 6 + 3000 * 2) * 1000 / size;
-        t.pulses()->AddPulses(50, 15, 10);
-
-        t.set_segment_parameters(0, 0.5f, 0.5f);
-        while (!t.pulses()->empty()) {
-          GateFlags flags[size];
-          t.pulses()->Render(flags, size);
-          SegmentGenerator::Output out[size];
-
-          t.generator()->Process(flags, out, size);
+Result TimeEnvelopeBank() {
+  EnvelopeBank* bank = new EnvelopeBank();
+  float out[kBlockSize][kNumEnvelopeBankLanes];
+  Result r = Measure(
+      "envelope/bank",
+      [&] {
+        bank->Init();
+        for (size_t ch = 0; ch < kNumChannels; ++ch) {
+          float length, curve;
+          EnvelopeParameters(ch, &length, &curve);
+          bank->SetAttackLength(ch, length);
+          bank->SetAttackCurve(ch, curve);
+          bank->SetDecayLength(ch, length);
+          bank->SetDecayCurve(ch, curve);
+          bank->SetSustainLevel(ch, 0.5f);
+          bank->SetReleaseLength(ch, length);
+          bank->SetReleaseCurve(ch, curve);
         }
-        return 0;
       },
-      7);
-}
-
-void TimeRandomBrownianTapLFO() {
-  cout << "Random Brownian Tap LFO" << endl;
-  timeit(
-      [] {
-        SegmentGeneratorTest t;
-        segment::Configuration configuration = {segment::TYPE_TURING, true};
-        t.generator()->Configure(true, &configuration, 1);
-        for (int i = 0; i < 1000; ++i) {
-          t.pulses()->AddPulses(1500, 500, 6);
-          t.pulses()->AddPulses(3000, 500, 2);
+      [&](size_t) { },
+      [&](size_t block) {
+        for (size_t ch = 0; ch < kNumChannels; ++ch) {
+          bank->Gate(ch, EnvelopeGate(ch, block));
         }
+        bank->Render(out, kBlockSize);
+        use(out[kBlockSize - 1][kNumChannels - 1]);
+      },
+      kBlockSize * kNumChannels);
+  delete bank;
+  return r;
+}
 
-        t.set_segment_parameters(0, 0.5f, 0.75f);
-        const size_t size = 8;
-        while (!t.pulses()->empty()) {
-          GateFlags flags[size];
-          t.pulses()->Render(flags, 8);
-          SegmentGenerator::Output out[size];
+// Pitches from -1 to 1 (-8V to 8V). Random pitches mostly land outside the
+// hysteresis window of the previous one. In the worst case, the pitch jumps
+// by more than an octave at every sample, and every sample is a miss.
+void FillQuantizerInput(float* pitch, size_t size, bool misses) {
+  for (size_t i = 0; i < size; ++i) {
+    float x = static_cast<float>(rand()) / RAND_MAX;
+    if (misses) {
+      x = 0.2f + 0.8f * x;
+      pitch[i] = i & 1 ? x : -x;
+    } else {
+      pitch[i] = 2.0f * x - 1.0f;
+    }
+  }
+}
 
-          t.generator()->Process(flags, out, size);
+Result TimeSmallQuantizer(bool misses) {
+  Quantizer quant;
+  float pitch[kBlockSize];
+  return Measure(
+      misses ? "quantizer/small/misses" : "quantizer/small",
+      [&] {
+        srand(0);
+        quant.Init();
+        quant.Configure(scales[1]);
+      },
+      [&](size_t) { FillQuantizerInput(pitch, kBlockSize, misses); },
+      [&](size_t) {
+        for (size_t i = 0; i < kBlockSize; ++i) {
+          use(quant.Process(pitch[i]));
         }
-        return 0;
       },
-      7);
+      kBlockSize);
 }
 
-void TimeRandomSplineTapLFO() {
-  cout << "Random Spline Tap LFO" << endl;
-  timeit(
-      [] {
-        SegmentGeneratorTest t;
-        segment::Configuration configuration = {segment::TYPE_TURING, true};
-        t.generator()->Configure(true, &configuration, 1);
-        for (int i = 0; i < 1000; ++i) {
-          t.pulses()->AddPulses(1500, 500, 6);
-          t.pulses()->AddPulses(3000, 500, 2);
+Result TimeQuantizer(bool misses) {
+  BraidsQuantizer quant;
+  float pitch[kBlockSize];
+  return Measure(
+      misses ? "quantizer/braids/misses" : "quantizer/braids",
+      [&] {
+        srand(0);
+        quant.Init();
+        quant.Configure(scales[1]);
+      },
+      [&](size_t) { FillQuantizerInput(pitch, kBlockSize, misses); },
+      [&](size_t) {
+        for (size_t i = 0; i < kBlockSize; ++i) {
+          use(quant.Process(pitch[i]));
         }
+      },
+      kBlockSize);
+}
 
-        t.set_segment_parameters(0, 0.5f, 0.5f);
-        const size_t size = 8;
-        while (!t.pulses()->empty()) {
-          GateFlags flags[size];
-          t.pulses()->Render(flags, 8);
-          SegmentGenerator::Output out[size];
-
-          t.generator()->Process(flags, out, size);
+// The curve of a segment, as computed once per block and applied to each
+// sample, with the reference and fast kernels.
+Result TimePhaseWarp(bool fast) {
+  PhaseWarp warp;
+  float phase = 0.0f;
+  return Measure(
+      fast ? "kernels/phase_warp/fast" : "kernels/phase_warp",
+      [&] { phase = 0.0f; },
+      [&](size_t) { },
+      [&](size_t block) {
+        warp.Init(float(block % 1024) / 1024.0f);
+        for (size_t i = 0; i < kBlockSize; ++i) {
+          phase += 0.001f;
+          if (phase >= 1.0f) {
+            phase -= 1.0f;
+          }
+          use(fast ? warp.WarpFast(phase) : warp.WarpExact(phase));
         }
-        return 0;
       },
-      7);
+      kBlockSize);
 }
 
-void TimeRandomSineTapLFO() {
-  cout << "Random Sine Tap LFO" << endl;
-  timeit(
-      [] {
-        SegmentGeneratorTest t;
-        segment::Configuration configuration = {segment::TYPE_TURING, true};
-        t.generator()->Configure(true, &configuration, 1);
-        for (int i = 0; i < 1000; ++i) {
-          t.pulses()->AddPulses(1500, 500, 6);
-          t.pulses()->AddPulses(3000, 500, 2);
+// The double scroll attractor, integrated with one Euler step per sample or
+// with the decimated RK4 solver, over the range of time steps of its segment.
+Result TimeAttractor(bool rk4) {
+  Attractor<DoubleScrollSystem> attractor;
+  return Measure(
+      rk4 ? "kernels/attractor/rk4" : "kernels/attractor/euler",
+      [&] { attractor.Init(0.3f, 0.5f, 0.7f); },
+      [&](size_t) { },
+      [&](size_t block) {
+        // With b = 3.5 (knob at noon), Euler diverges from dt = 0.01.
+        float dt = 0.008f * float(block % 1024) / 1024.0f;
+        for (size_t i = 0; i < kBlockSize; ++i) {
+          use(rk4 ? attractor.Next(dt, 3.5f) : attractor.NextEuler(dt, 3.5f));
         }
+      },
+      kBlockSize);
+}
 
-        t.set_segment_parameters(0, 0.5f, 0.5f);
-        const size_t size = 8;
-        while (!t.pulses()->empty()) {
-          GateFlags flags[size];
-          t.pulses()->Render(flags, 8);
-          SegmentGenerator::Output out[size];
-
-          t.generator()->Process(flags, out, size);
+// Brown noise on all channels: the random values of a block, one after the
+// other or by blocks.
+Result TimeAlmostNormals(bool block) {
+  const size_t kNumValues = kBlockSize * kNumChannels;
+  float values[kNumValues];
+  RandomStream random;
+  return Measure(
+      block ? "kernels/almost_normal/block" : "kernels/almost_normal",
+      [&] { random.Seed(0); },
+      [&](size_t) { },
+      [&](size_t) {
+        if (block) {
+          random.GetAlmostNormals(values, kNumValues);
+        } else {
+          for (size_t i = 0; i < kNumValues; ++i) {
+            uint32_t a = random.GetWord();
+            uint32_t b = random.GetWord();
+            values[i] = AlmostNormal(a, b);
+          }
         }
-        return 0;
+        use(values[kNumValues - 1]);
       },
-      7);
+      kNumValues);
 }
 
-void TimeSmallQuantizer() {
-  cout << "Small Quantizer" << endl;
-  Quantizer quant;
-  quant.Init();
-  quant.Configure(scales[1]);
-  timeit(
-    [&quant] {
-      return quant.Process(2.0f * static_cast<float>(rand()) / RAND_MAX - 1.0f);
-    },
-    7
-  );
+void PrintResult(const Result& r) {
+  printf("%-40s %8.2f ns/sample %8.2f ticks/sample "
+         "%9.1f ns worst block %9.1f ns p99.9 block\n",
+         r.name.c_str(),
+         r.ns_per_sample,
+         r.ticks_per_sample,
+         r.worst_block_ns,
+         r.p999_block_ns);
+  fflush(stdout);
 }
 
+// One benchmark per line, so that the baseline can be read back without a
+// JSON library.
+bool WriteJson(const char* file_name, const vector<Result>& results) {
+  FILE* fp = fopen(file_name, "w");
+  if (!fp) {
+    return false;
+  }
+  fprintf(fp, "{\n  \"block_size\": %lu,\n  \"benchmarks\": [\n", kBlockSize);
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    fprintf(fp,
+            "    {\"name\": \"%s\", \"ns_per_sample\": %.3f, "
+            "\"ticks_per_sample\": %.3f, \"worst_block_ns\": %.1f, "
+            "\"p999_block_ns\": %.1f}%s\n",
+            r.name.c_str(),
+            r.ns_per_sample,
+            r.ticks_per_sample,
+            r.worst_block_ns,
+            r.p999_block_ns,
+            i == results.size() - 1 ? "" : ",");
+  }
+  fprintf(fp, "  ]\n}\n");
+  fclose(fp);
+  return true;
+}
 
-void TimeQuantizer() {
-  cout << "Quantizer" << endl;
-  BraidsQuantizer quant;
-  quant.Init();
-  quant.Configure(scales[1]);
-  timeit(
-    [&quant] {
-      return quant.Process(2.0f * static_cast<float>(rand()) / RAND_MAX - 1.0f);
-    },
-    7
-  );
+bool ReadField(const char* line, const char* key, double* value) {
+  const char* p = strstr(line, key);
+  if (!p) {
+    return false;
+  }
+  p = strchr(p + strlen(key), ':');
+  *value = p ? atof(p + 1) : 0.0;
+  return p != NULL;
+}
+
+bool ReadJson(const char* file_name, vector<Result>* results) {
+  FILE* fp = fopen(file_name, "r");
+  if (!fp) {
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), fp)) {
+    const char* name = strstr(line, "\"name\": \"");
+    if (!name) {
+      continue;
+    }
+    name += strlen("\"name\": \"");
+    const char* name_end = strchr(name, '"');
+    if (!name_end) {
+      continue;
+    }
+    Result r;
+    r.name = string(name, name_end - name);
+    if (ReadField(line, "\"ns_per_sample\"", &r.ns_per_sample) &&
+        ReadField(line, "\"ticks_per_sample\"", &r.ticks_per_sample) &&
+        ReadField(line, "\"worst_block_ns\"", &r.worst_block_ns) &&
+        ReadField(line, "\"p999_block_ns\"", &r.p999_block_ns)) {
+      results->push_back(r);
+    }
+  }
+  fclose(fp);
+  return true;
 }
 
-int main() {
-  TimeFreeLFO();
-  TimeFreeFastLFO();
-  TimeOscillator();
-  // TimePllOscillator();
-  // TimeTapLFO();
-  // TimeRandomBrownianTapLFO();
-  // TimeRandomSineTapLFO();
-  // TimeRandomSplineTapLFO();
-}
\ No newline at end of file
+// Returns the number of regressions.
+int CompareWithBaseline(
+    const vector<Result>& results,
+    const vector<Result>& baseline,
+    double tolerance) {
+  int num_regressions = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    for (size_t j = 0; j < baseline.size(); ++j) {
+      const Result& b = baseline[j];
+      if (b.name != r.name) {
+        continue;
+      }
+      double mean_ratio = r.ns_per_sample / b.ns_per_sample;
+      double worst_ratio = r.p999_block_ns / b.p999_block_ns;
+      bool regression = mean_ratio > 1.0 + tolerance || \
+          worst_ratio > 1.0 + tolerance;
+      if (regression || mean_ratio < 1.0 - tolerance) {
+        printf("%-40s mean %+6.1f%%  p99.9 block %+6.1f%%%s\n",
+               r.name.c_str(),
+               100.0 * (mean_ratio - 1.0),
+               100.0 * (worst_ratio - 1.0),
+               regression ? "  REGRESSION" : "");
+      }
+      num_regressions += regression;
+      break;
+    }
+  }
+  return num_regressions;
+}
+
+int main(int argc, char** argv) {
+  const char* filter = NULL;
+  const char* json_file = NULL;
+  const char* baseline_file = NULL;
+  double tolerance = 0.1;
+
+  for (int i = 1; i < argc; ++i) {
+    bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "--filter") && has_value) {
+      filter = argv[++i];
+    } else if (!strcmp(argv[i], "--json") && has_value) {
+      json_file = argv[++i];
+    } else if (!strcmp(argv[i], "--baseline") && has_value) {
+      baseline_file = argv[++i];
+    } else if (!strcmp(argv[i], "--tolerance") && has_value) {
+      tolerance = atof(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--filter substring] [--json results.json] "
+              "[--baseline baseline.json] [--tolerance 0.1]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  vector<Result> results;
+  vector<GeneratorBenchmark> benchmarks = GeneratorBenchmarks();
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    if (filter && !strstr(benchmarks[i].name.c_str(), filter)) {
+      continue;
+    }
+    results.push_back(TimeGenerator(benchmarks[i]));
+    PrintResult(results.back());
+  }
+  if (!filter || strstr("lfo/segment_generator", filter)) {
+    results.push_back(TimeLfoGenerators());
+    PrintResult(results.back());
+  }
+  if (!filter || strstr("lfo/bank", filter)) {
+    results.push_back(TimeLfoBank());
+    PrintResult(results.back());
+  }
+  if (!filter || strstr("envelope/objects", filter)) {
+    results.push_back(TimeEnvelopes());
+    PrintResult(results.back());
+  }
+  if (!filter || strstr("envelope/bank", filter)) {
+    results.push_back(TimeEnvelopeBank());
+    PrintResult(results.back());
+  }
+  for (int misses = 0; misses < 2; ++misses) {
+    const char* name = misses ? "quantizer/small/misses" : "quantizer/small";
+    if (!filter || strstr(name, filter)) {
+      results.push_back(TimeSmallQuantizer(misses));
+      PrintResult(results.back());
+    }
+  }
+  for (int misses = 0; misses < 2; ++misses) {
+    const char* name = misses ? "quantizer/braids/misses" : "quantizer/braids";
+    if (!filter || strstr(name, filter)) {
+      results.push_back(TimeQuantizer(misses));
+      PrintResult(results.back());
+    }
+  }
+  for (int fast = 0; fast < 2; ++fast) {
+    const char* name = fast ? "kernels/phase_warp/fast" : "kernels/phase_warp";
+    if (!filter || strstr(name, filter)) {
+      results.push_back(TimePhaseWarp(fast));
+      PrintResult(results.back());
+    }
+  }
+  for (int rk4 = 0; rk4 < 2; ++rk4) {
+    const char* name = rk4 ? "kernels/attractor/rk4" : "kernels/attractor/euler";
+    if (!filter || strstr(name, filter)) {
+      results.push_back(TimeAttractor(rk4));
+      PrintResult(results.back());
+    }
+  }
+  for (int block = 0; block < 2; ++block) {
+    const char* name = block
+        ? "kernels/almost_normal/block"
+        : "kernels/almost_normal";
+    if (!filter || strstr(name, filter)) {
+      results.push_back(TimeAlmostNormals(block));
+      PrintResult(results.back());
+    }
+  }
+
+  if (json_file && !WriteJson(json_file, results)) {
+    fprintf(stderr, "%s: cannot write file\n", json_file);
+    return 1;
+  }
+
+  if (baseline_file) {
+    vector<Result> baseline;
+    if (!ReadJson(baseline_file, &baseline)) {
+      fprintf(stderr, "%s: cannot read file\n", baseline_file);
+      return 1;
+    }
+    printf("\nComparison with %s (tolerance %.0f%%):\n",
+           baseline_file, 100.0 * tolerance);
+    int num_regressions = CompareWithBaseline(results, baseline, tolerance);
+    printf("%d regression(s)\n", num_regressions);
+    return num_regressions ? 1 : 0;
+  }
+  return 0;
+}
@@ -0,0 +1,256 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Parameter sweep renderer. Renders a patch file (see patch.h) over a grid of
+// primary and secondary values of one of its channels, on all cores, into a
+// memory-mapped file of 32-bit floats, and writes an index of the grid
+// points next to it.
+//
+//   stages_sweep --channel 0 --primary 0:1:33 --secondary 0:1:5
+//       --duration 2 --output renders/lfo lfos.patch
+//
+// renders/lfo.raw then holds, for each grid point, duration * 32000 frames of
+// interleaved channels, and renders/lfo.index gives the parameters and the
+// offset (in floats) of each point.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <boost/program_options.hpp>
+
+#include "stages/test/patch.h"
+#include "stages/test/sweep.h"
+#include "stages/test/wav_file.h"
+
+using namespace stages;
+using namespace std;
+
+namespace po = boost::program_options;
+
+// Loads an input file. The inputs are read frame by frame, without
+// resampling, so the file must be at the sample rate of the module.
+bool LoadInput(const string& file_name, WavReader* reader) {
+  if (!reader->Load(file_name.c_str())) {
+    cerr << file_name << ": cannot read file" << endl;
+    return false;
+  }
+  if (reader->sample_rate() != static_cast<uint32_t>(kSampleRate)) {
+    cerr << file_name << ": sample rate is " << reader->sample_rate()
+         << "Hz instead of " << kSampleRate << "Hz" << endl;
+    return false;
+  }
+  return true;
+}
+
+// start:end:num_steps, or a single value.
+bool ParseAxis(const string& s, SweepAxis* axis) {
+  char end;
+  if (sscanf(s.c_str(), "%f:%f:%lu%c",
+             &axis->start, &axis->end, &axis->num_steps, &end) == 3) {
+    return axis->num_steps > 0;
+  } else if (sscanf(s.c_str(), "%f%c", &axis->start, &end) == 1) {
+    axis->end = axis->start;
+    axis->num_steps = 1;
+    return true;
+  }
+  return false;
+}
+
+bool WriteIndex(const string& file_name, const SweepRenderer& renderer) {
+  FILE* fp = fopen(file_name.c_str(), "w");
+  if (!fp) {
+    return false;
+  }
+  const SweepGrid& grid = renderer.grid();
+  fprintf(fp, "# channel %lu, %lu channels, %lu frames per point\n",
+          grid.channel,
+          renderer.num_channels(),
+          renderer.point_size() / renderer.num_channels());
+  fprintf(fp, "# point\tprimary\tsecondary\toffset\n");
+  for (size_t i = 0; i < grid.num_points(); ++i) {
+    fprintf(fp, "%lu\t%f\t%f\t%lu\n",
+            i,
+            grid.primary_value(i),
+            grid.secondary_value(i),
+            i * renderer.point_size());
+  }
+  fclose(fp);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  string gates_file;
+  string cv_file;
+  string output;
+  string primary;
+  string secondary;
+  size_t channel;
+  float duration;
+  size_t block_size;
+  size_t num_threads;
+  bool quiet;
+  string patch_file;
+
+  po::options_description visible("Options");
+  visible.add_options()
+      ("help,h", "Show this message")
+      ("gates,g", po::value<string>(&gates_file),
+       "Gate input file (WAV at 31250Hz). Channel N is used by gate=in:N")
+      ("cv,c", po::value<string>(&cv_file),
+       "CV input file (WAV at 31250Hz). Channel N is used by cv:N sources")
+      ("output,o", po::value<string>(&output)->default_value("sweep"),
+       "Output files, without extension (.raw and .index are added)")
+      ("channel", po::value<size_t>(&channel)->default_value(0),
+       "Channel of the patch whose parameters are swept")
+      ("primary,p", po::value<string>(&primary)->default_value("0:1:11"),
+       "Primary values: start:end:num_steps, or a single value")
+      ("secondary,s", po::value<string>(&secondary)->default_value("0.5"),
+       "Secondary values: start:end:num_steps, or a single value")
+      ("duration,d", po::value<float>(&duration)->default_value(1.0f),
+       "Duration of each render, in seconds")
+      ("block-size,b",
+       po::value<size_t>(&block_size)->default_value(kBlockSize),
+       "Number of samples rendered between parameter updates")
+      ("threads,j",
+       po::value<size_t>(&num_threads)->default_value(
+           max(thread::hardware_concurrency(), 1U)),
+       "Number of threads")
+      ("quiet,q", po::bool_switch(&quiet), "Do not print statistics");
+
+  po::options_description hidden;
+  hidden.add_options()
+      ("patch", po::value<string>(&patch_file), "Patch file");
+
+  po::options_description all;
+  all.add(visible).add(hidden);
+
+  po::positional_options_description positional;
+  positional.add("patch", 1);
+
+  po::variables_map vm;
+  try {
+    po::store(
+        po::command_line_parser(argc, argv)
+            .options(all).positional(positional).run(),
+        vm);
+    po::notify(vm);
+  } catch (const po::error& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+
+  if (vm.count("help") || patch_file.empty()) {
+    cout << "Usage: " << argv[0] << " [options] patch" << endl;
+    cout << visible << endl;
+    return vm.count("help") ? 0 : 1;
+  }
+
+  SweepGrid grid;
+  grid.channel = channel;
+  if (!ParseAxis(primary, &grid.primary) ||
+      !ParseAxis(secondary, &grid.secondary)) {
+    cerr << "Parameter values must be start:end:num_steps or a value" << endl;
+    return 1;
+  }
+
+  if (block_size == 0 || block_size > kMaxBlockSize) {
+    cerr << "Block size must be between 1 and " << kMaxBlockSize << endl;
+    return 1;
+  }
+
+  Patch patch;
+  PatchParser parser;
+  if (!parser.Parse(patch_file.c_str(), &patch)) {
+    return 1;
+  }
+  if (channel >= patch.channels.size()) {
+    cerr << patch_file << ": no channel " << channel << endl;
+    return 1;
+  }
+
+  WavReader gates;
+  WavReader cv;
+  if (!gates_file.empty() && !LoadInput(gates_file, &gates)) {
+    return 1;
+  }
+  if (!cv_file.empty() && !LoadInput(cv_file, &cv)) {
+    return 1;
+  }
+
+  SweepRenderer renderer;
+  renderer.Init(
+      &patch,
+      grid,
+      gates_file.empty() ? NULL : &gates,
+      cv_file.empty() ? NULL : &cv,
+      static_cast<size_t>(duration * kSampleRate),
+      block_size);
+
+  // The threads write straight into the pages of the output file.
+  string data_file = output + ".raw";
+  size_t size = grid.num_points() * renderer.point_size() * sizeof(float);
+  int fd = open(data_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1 || ftruncate(fd, size) == -1) {
+    cerr << data_file << ": cannot create file" << endl;
+    return 1;
+  }
+  float* data = NULL;
+  if (size) {
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      cerr << data_file << ": cannot map file" << endl;
+      close(fd);
+      return 1;
+    }
+    data = static_cast<float*>(p);
+  }
+
+  chrono::high_resolution_clock::time_point start = \
+      chrono::high_resolution_clock::now();
+  renderer.Render(data, num_threads);
+  double elapsed = chrono::duration<double>(
+      chrono::high_resolution_clock::now() - start).count();
+
+  if (size) {
+    munmap(data, size);
+  }
+  close(fd);
+
+  string index_file = output + ".index";
+  if (!WriteIndex(index_file, renderer)) {
+    cerr << index_file << ": cannot open file" << endl;
+    return 1;
+  }
+
+  if (!quiet) {
+    double rendered = duration * grid.num_points();
+    printf("%s -> %s: %lu points, %lu threads, %.2fx real-time\n",
+           patch_file.c_str(),
+           data_file.c_str(),
+           grid.num_points(),
+           num_threads,
+           elapsed > 0.0 ? rendered / elapsed : 0.0);
+  }
+  return 0;
+}
@@ -13,16 +13,29 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <vector>
 
+#include "stages/test/benchmarks.h"
 #include "stages/test/fixtures.h"
+#include "stages/test/sweep.h"
+#include "stages/test/virtual_chain.h"
 
+#include "stages/attractor.h"
 #include "stages/braids_quantizer.h"
+#include "stages/envelope.h"
+#include "stages/envelope_bank.h"
+#include "stages/lfo_bank.h"
+#include "stages/phase_warp.h"
 #include "stages/quantizer.h"
 #include "stages/quantizer_scales.h"
+#include "stages/random_stream.h"
+#include "stmlib/utils/random.h"
+#include "tides2/ramp/ramp_extractor.h"
 
 using namespace stages;
 using namespace stmlib;
@@ -184,7 +197,7 @@ void TestRandomSteppedLFO() {
   t.generator()->Configure(false, &configuration, 1);
   t.set_segment_parameters(0, 0.7f, 0.0f);
   fprintf(stderr, "Rendering stepped LFO\n");
-  Random::Seed(0);
+  t.generator()->set_random_seed(0);
   t.Render("stages_random_stepped_lfo.wav", ::kSampleRate);
 }
 
@@ -195,7 +208,7 @@ void TestRandomSineLFO() {
 
   t.generator()->Configure(false, &configuration, 1);
   t.set_segment_parameters(0, 0.7f, 0.25f);
-  Random::Seed(0);
+  t.generator()->set_random_seed(0);
   t.Render("stages_random_sine_lfo.wav", ::kSampleRate);
 }
 
@@ -206,7 +219,7 @@ void TestRandomSplineLFO() {
 
   t.generator()->Configure(false, &configuration, 1);
   t.set_segment_parameters(0, 0.7f, 0.5f);
-  Random::Seed(0);
+  t.generator()->set_random_seed(0);
   t.Render("stages_random_spline_lfo.wav", ::kSampleRate);
 }
 
@@ -217,7 +230,7 @@ void TestRandomBrownianLFO() {
 
   t.generator()->Configure(false, &configuration, 1);
   t.set_segment_parameters(0, 0.7f, 0.75f);
-  Random::Seed(0);
+  t.generator()->set_random_seed(0);
   t.Render("stages_random_brownian_lfo.wav", ::kSampleRate);
 }
 
@@ -243,7 +256,7 @@ void TestWhiteNoise() {
 
   t.generator()->Configure(false, &configuration, 1);
   t.set_segment_parameters(0, 1.0f, 0.0f);
-  Random::Seed(0);
+  t.generator()->set_random_seed(0);
   t.Render("stages_random_white_noise.wav", ::kSampleRate);
 }
 
@@ -254,7 +267,7 @@ void TestBrownNoise() {
 
   t.generator()->Configure(false, &configuration, 1);
   t.set_segment_parameters(0, 1.0f, 1.0f);
-  Random::Seed(0);
+  t.generator()->set_random_seed(0);
   t.Render("stages_random_brown_noise.wav", ::kSampleRate);
 }
 
@@ -289,9 +302,1059 @@ void TestZero() {
 }
 
 
+// Renders a configuration at each of kTestBlockSizes and compares the outputs
+// with the single-sample render. Only meaningful for process functions whose
+// parameters are not interpolated across the block.
+bool CheckBlockSizeInvariance(
+    const char* name,
+    bool has_trigger,
+    const segment::Configuration* configuration,
+    int num_segments,
+    const float* primary,
+    const float* secondary) {
+  const size_t num_samples = ::kSampleRate * 5;
+  vector<SegmentGenerator::Output> reference;
+  bool passed = true;
+
+  for (size_t i = 0; i < sizeof(kTestBlockSizes) / sizeof(size_t); ++i) {
+    SegmentGeneratorTest t;
+    t.set_block_size(kTestBlockSizes[i]);
+    t.generator()->Configure(has_trigger, configuration, num_segments);
+    for (int j = 0; j < num_segments; ++j) {
+      t.set_segment_parameters(j, primary[j], secondary[j]);
+    }
+    vector<SegmentGenerator::Output> out;
+    t.Render(&out, num_samples);
+    if (i == 0) {
+      reference = out;
+      continue;
+    }
+
+    float max_error = 0.0f;
+    size_t segment_mismatches = 0;
+    for (size_t j = 0; j < num_samples; ++j) {
+      max_error = max(max_error, fabsf(out[j].value - reference[j].value));
+      segment_mismatches += out[j].segment != reference[j].segment;
+    }
+    if (max_error > 1e-6f || segment_mismatches) {
+      printf("%s: block size %lu differs from block size 1 "
+             "(max error %g, %lu segment mismatches)\n",
+             name, kTestBlockSizes[i], max_error, segment_mismatches);
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+void TestBlockSizeInvariance() {
+  int num_failures = 0;
+
+  segment::Configuration adsr[5] = {
+    { segment::TYPE_RAMP, false },
+    { segment::TYPE_RAMP, false },
+    { segment::TYPE_RAMP, false },
+    { segment::TYPE_HOLD, true },
+    { segment::TYPE_RAMP, false },
+  };
+  const float adsr_primary[] = { 0.15f, 0.25f, 0.25f, 0.5f, 0.5f };
+  const float adsr_secondary[] = { 0.0f, 0.3f, 0.75f, 0.1f, 0.25f };
+  num_failures += !CheckBlockSizeInvariance(
+      "ADSR", true, adsr, 5, adsr_primary, adsr_secondary);
+
+  segment::Configuration decay = { segment::TYPE_RAMP, false };
+  const float decay_primary[] = { 0.7f };
+  const float decay_secondary[] = { 0.2f };
+  num_failures += !CheckBlockSizeInvariance(
+      "Decay", true, &decay, 1, decay_primary, decay_secondary);
+
+  segment::Configuration lfo = { segment::TYPE_RAMP, true };
+  const float lfo_primary[] = { 0.7f };
+  const float lfo_secondary[] = { 0.3f };
+  num_failures += !CheckBlockSizeInvariance(
+      "Free running LFO", false, &lfo, 1, lfo_primary, lfo_secondary);
+
+  if (!num_failures) {
+    printf("Outputs are block size invariant.\n");
+  }
+}
+
+// Blocks without gate edges take a different path through the process
+// functions, which must render exactly the same thing.
+void TestGateEdges() {
+  const size_t num_samples = ::kSampleRate * 2;
+  vector<GeneratorBenchmark> benchmarks = GeneratorBenchmarks();
+  int num_failures = 0;
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    const GeneratorBenchmark& b = benchmarks[i];
+    // Tap LFOs don't look at edges, and the state of their ramp extractor is
+    // not entirely reset by Init(), so two renders can differ anyway.
+    bool tap_lfo = b.num_segments == 1 && b.configuration[0].loop && (
+        b.configuration[0].type == segment::TYPE_RAMP ||
+        b.configuration[0].type == segment::TYPE_TURING);
+    if (!b.has_trigger || tap_lfo) {
+      continue;
+    }
+    vector<SegmentGenerator::Output> out[2];
+    for (int detect = 0; detect < 2; ++detect) {
+      SegmentGeneratorTest t;
+      t.set_detect_gate_edges(detect);
+      // Same pattern as the benchmarks, which starts low to give a valid
+      // first period to the ramp extractor.
+      t.pulses()->AddPulses(100, 0, 1);
+      for (size_t j = 0; j < num_samples / 15000 + 1; ++j) {
+        t.pulses()->AddPulses(1500, 500, 6);
+        t.pulses()->AddPulses(3000, 500, 2);
+      }
+      t.generator()->SetMode(b.multimode);
+      t.generator()->Configure(true, b.configuration, b.num_segments);
+      for (int j = 0; j < b.num_segments; ++j) {
+        t.set_segment_parameters(j, b.primary[j], b.secondary[j]);
+      }
+      t.Render(&out[detect], num_samples);
+    }
+    for (size_t j = 0; j < num_samples; ++j) {
+      if (out[0][j].value != out[1][j].value ||
+          out[0][j].phase != out[1][j].phase ||
+          out[0][j].segment != out[1][j].segment) {
+        printf("%s: gate edge detection changes the output at sample %lu\n",
+               b.name.c_str(), j);
+        ++num_failures;
+        break;
+      }
+    }
+  }
+  if (!num_failures) {
+    printf("Blocks without gate edges are rendered identically.\n");
+  }
+}
+
+// Tracks a 437.8 Hz clock, whose period is not a whole number of samples,
+// with and without the sub-sample edge timestamps.
+void TestSubsampleGates() {
+  const float period = 71.37f;
+  const size_t num_blocks = ::kSampleRate * 2 / kBlockSize;
+  const tides::Ratio ratio = { 1.0f, 1 };
+  float error[2];
+
+  for (int subsample = 0; subsample < 2; ++subsample) {
+    tides::RampExtractor ramp_extractor;
+    ramp_extractor.Init(::kSampleRate, 1000.0f / ::kSampleRate);
+    GateFlags previous = GATE_FLAG_LOW;
+    float sum = 0.0f;
+    size_t count = 0;
+    for (size_t block = 0; block < num_blocks; ++block) {
+      GateFlags flags[kBlockSize];
+      float edge_offset[kBlockSize];
+      float ramp[kBlockSize];
+      for (size_t i = 0; i < kBlockSize; ++i) {
+        // Starts low for a few samples.
+        float t = static_cast<float>(block * kBlockSize + i) - 10.0f;
+        float cycles = t / period;
+        float phase = cycles - floorf(cycles);
+        previous = flags[i] = ExtractGateFlags(previous, t >= 0 && phase < 0.5f);
+        // Time elapsed since the edge, in samples.
+        float edge_phase = phase < 0.5f ? phase : phase - 0.5f;
+        edge_offset[i] = edge_phase * period;
+      }
+      float frequency = ramp_extractor.Process(
+          true, false, ratio, flags, ramp, kBlockSize,
+          subsample ? edge_offset : NULL);
+      if (block >= num_blocks / 2) {
+        sum += fabsf(frequency * period - 1.0f);
+        ++count;
+      }
+    }
+    error[subsample] = sum / static_cast<float>(count);
+  }
+
+  if (error[1] < error[0]) {
+    printf("Sub-sample gate timestamps reduce the PLL frequency error "
+           "from %g%% to %g%%.\n", error[0] * 100.0f, error[1] * 100.0f);
+  } else {
+    printf("Sub-sample gate timestamps do not improve PLL tracking "
+           "(%g%% vs %g%%)\n", error[1] * 100.0f, error[0] * 100.0f);
+  }
+}
+
+void TestLfoBank() {
+  const int kNumLanes = 7;  // Not a multiple of the SIMD width.
+  segment::Configuration configuration[kNumLanes] = {
+    { segment::TYPE_RAMP, true, false, segment::RANGE_DEFAULT },
+    { segment::TYPE_RAMP, true, true, segment::RANGE_DEFAULT },
+    { segment::TYPE_RAMP, true, false, segment::RANGE_SLOW },
+    { segment::TYPE_RAMP, true, false, segment::RANGE_FAST },
+    { segment::TYPE_RAMP, true, true, segment::RANGE_FAST },
+    { segment::TYPE_RAMP, true, false, segment::RANGE_DEFAULT },
+    { segment::TYPE_RAMP, true, false, segment::RANGE_FAST },
+  };
+
+  for (int mode = 0; mode < 2; ++mode) {
+    MultiMode multimode = mode ? MULTI_MODE_STAGES_SLOW_LFO : MULTI_MODE_STAGES;
+    LfoBank bank;
+    SegmentGenerator generator[kNumLanes];
+    SegmentGenerator::Pool pool[2];
+    HysteresisQuantizer2 note_quantizer[kNumLanes];
+    bank.Init(multimode);
+    for (int i = 0; i < kNumLanes; ++i) {
+      note_quantizer[i].Init(13, 0.03f, false);
+      generator[i].Init(
+          multimode,
+          &note_quantizer[i],
+          &pool[i / kNumChannels],
+          i % kNumChannels);
+      generator[i].ConfigureSingleSegment(false, configuration[i]);
+      bank.AddLane(configuration[i]);
+    }
+
+    SegmentGenerator::Output bank_out[kNumLanes][kBlockSize];
+    SegmentGenerator::Output* bank_out_ptr[kNumLanes];
+    for (int i = 0; i < kNumLanes; ++i) {
+      bank_out_ptr[i] = bank_out[i];
+    }
+
+    float max_error = 0.0f;
+    size_t mismatches = 0;
+    for (size_t block = 0; block < 4000; ++block) {
+      for (int i = 0; i < kNumLanes; ++i) {
+        // Sweep rate and shape, including rates where the LFO waveshape is
+        // bandlimited.
+        float primary = fmodf(0.0011f * block * (i + 1), 1.0f);
+        float secondary = fmodf(0.0007f * block * (i + 2), 1.0f);
+        generator[i].set_segment_parameters(0, primary, secondary);
+        bank.set_parameters(i, primary, secondary);
+      }
+      bank.Process(bank_out_ptr, kBlockSize);
+      for (int i = 0; i < kNumLanes; ++i) {
+        SegmentGenerator::Output out[kBlockSize];
+        generator[i].Process(NULL, out, kBlockSize);
+        for (size_t j = 0; j < kBlockSize; ++j) {
+          max_error = max(max_error, fabsf(out[j].value - bank_out[i][j].value));
+          mismatches += out[j].phase != bank_out[i][j].phase;
+          mismatches += out[j].segment != bank_out[i][j].segment;
+        }
+      }
+    }
+    if (max_error > 1e-6f || mismatches) {
+      printf("LFO bank differs from SegmentGenerator "
+             "(max error %g, %lu phase/segment mismatches)\n",
+             max_error, mismatches);
+      return;
+    }
+  }
+  printf("LFO bank matches SegmentGenerator.\n");
+}
+
+void TestEnvelopeRender() {
+  Envelope a, b;
+  a.Init();
+  b.Init();
+  float curves[] = { 0.1f, 0.5f, 0.9f };
+  float out[kBlockSize] = { 0.0f };
+  float max_error = 0.0f;
+  size_t out_of_range = 0;
+  for (int i = 0; i < 3; ++i) {
+    Envelope* e[2] = { &a, &b };
+    for (int j = 0; j < 2; ++j) {
+      e[j]->SetDelayLength(0.05f * i);
+      e[j]->SetAttackLength(0.1f + 0.1f * i);
+      e[j]->SetAttackCurve(curves[i]);
+      e[j]->SetHoldLength(0.05f);
+      e[j]->SetDecayLength(0.2f);
+      e[j]->SetDecayCurve(curves[2 - i]);
+      e[j]->SetSustainLevel(0.4f);
+      e[j]->SetReleaseLength(0.3f);
+      e[j]->SetReleaseCurve(curves[i]);
+    }
+    for (int tick = 0; tick < 8000; ++tick) {
+      bool gate = tick < 3000 + 1000 * i;
+      a.Gate(gate);
+      b.Gate(gate);
+      float previous = out[kBlockSize - 1];
+      float value = a.Value();
+      b.Render(out, kBlockSize);
+      // The rendered block must end on the value of the tick, and move
+      // monotonically from the previous one.
+      max_error = std::max(max_error, fabsf(out[kBlockSize - 1] - value));
+      float lo = std::min(previous, value) - 1e-6f;
+      float hi = std::max(previous, value) + 1e-6f;
+      for (size_t k = 0; k < kBlockSize; ++k) {
+        if (out[k] < lo || out[k] > hi) {
+          ++out_of_range;
+        }
+      }
+    }
+  }
+  if (max_error > 0.0f || out_of_range) {
+    printf("Envelope::Render differs from Envelope::Value "
+           "(max error %g, %lu samples out of range)\n",
+           max_error, out_of_range);
+    return;
+  }
+  printf("Envelope::Render matches Envelope::Value.\n");
+}
+
+void TestEnvelopeBank() {
+  Envelope envelope[kNumChannels];
+  EnvelopeBank* bank = new EnvelopeBank();
+  bank->Init();
+  for (size_t ch = 0; ch < kNumChannels; ++ch) {
+    float x = float(ch) / kNumChannels;
+    envelope[ch].Init();
+    envelope[ch].SetDelayLength(ch & 1 ? 0.0f : 0.1f * x);
+    bank->SetDelayLength(ch, ch & 1 ? 0.0f : 0.1f * x);
+    envelope[ch].SetAttackLength(0.3f * x);
+    bank->SetAttackLength(ch, 0.3f * x);
+    envelope[ch].SetAttackCurve(x);
+    bank->SetAttackCurve(ch, x);
+    envelope[ch].SetHoldLength(ch == 2 ? 0.1f : 0.0f);
+    bank->SetHoldLength(ch, ch == 2 ? 0.1f : 0.0f);
+    envelope[ch].SetDecayLength(0.2f + 0.1f * x);
+    bank->SetDecayLength(ch, 0.2f + 0.1f * x);
+    envelope[ch].SetDecayCurve(1.0f - x);
+    bank->SetDecayCurve(ch, 1.0f - x);
+    envelope[ch].SetSustainLevel(x);
+    bank->SetSustainLevel(ch, x);
+    envelope[ch].SetReleaseLength(0.4f * x);
+    bank->SetReleaseLength(ch, 0.4f * x);
+    envelope[ch].SetReleaseCurve(0.25f + 0.5f * x);
+    bank->SetReleaseCurve(ch, 0.25f + 0.5f * x);
+  }
+
+  // Gates of different lengths and periods, so that every envelope is
+  // retriggered or released in the middle of its stages at some point.
+  size_t mismatches = 0;
+  float expected[kBlockSize];
+  float rendered[kBlockSize][kNumEnvelopeBankLanes];
+  for (size_t tick = 0; tick < 40000; ++tick) {
+    for (size_t ch = 0; ch < kNumChannels; ++ch) {
+      size_t period = 500 + 731 * ch;
+      bool gate = (tick % period) < period * (ch + 1) / (kNumChannels + 1);
+      envelope[ch].Gate(gate);
+      bank->Gate(ch, gate);
+    }
+    bank->Render(rendered, kBlockSize);
+    for (size_t ch = 0; ch < kNumChannels; ++ch) {
+      envelope[ch].Render(expected, kBlockSize);
+      bool match = envelope[ch].CurrentStage() == bank->stage(ch);
+      for (size_t i = 0; i < kBlockSize; ++i) {
+        match = match && expected[i] == rendered[i][ch];
+      }
+      if (!match) {
+        ++mismatches;
+      }
+    }
+  }
+  delete bank;
+  if (mismatches) {
+    printf("Envelope bank differs from Envelope (%lu mismatches)\n",
+           mismatches);
+    return;
+  }
+  printf("Envelope bank matches Envelope.\n");
+}
+
+typedef IOBufferRing<4, kBlockSize> TestRing;
+
+std::vector<int> rendered_blocks;
+
+// Renders a single segment at sample_rate, with a trigger at the beginning of
+// the first block when has_trigger is true. Otherwise, the primary parameter
+// jumps from 0 to primary after the first block. Returns the time, in seconds, at which
+// the output crosses threshold (going up when rising is true), or the
+// time of the 4th wrap of the phase when threshold is negative.
+float MeasureTime(
+    float sample_rate,
+    const segment::Configuration& configuration,
+    bool has_trigger,
+    float primary,
+    float secondary,
+    float threshold,
+    bool rising) {
+  SegmentGenerator generator;
+  SegmentGenerator::Pool pool;
+  HysteresisQuantizer2 note_quantizer;
+  note_quantizer.Init(13, 0.03f, false);
+  generator.Init(MULTI_MODE_STAGES, &note_quantizer, &pool, 0, sample_rate);
+  generator.ConfigureSingleSegment(has_trigger, configuration);
+
+  GateFlags gate[kBlockSize];
+  SegmentGenerator::Output out[kBlockSize];
+  fill(&gate[0], &gate[kBlockSize], GATE_FLAG_LOW);
+  float previous_phase = 0.0f;
+  int num_wraps = 0;
+  bool armed = false;
+  const size_t num_blocks = size_t(20.0f * sample_rate) / kBlockSize;
+  for (size_t block = 0; block < num_blocks; ++block) {
+    if (has_trigger) {
+      gate[0] = block == 0 ? GATE_FLAG_RISING | GATE_FLAG_HIGH : GATE_FLAG_LOW;
+      gate[1] = block == 0 ? GATE_FLAG_FALLING : GATE_FLAG_LOW;
+    }
+    generator.set_segment_parameters(
+        0, block || has_trigger ? primary : 0.0f, secondary);
+    generator.Process(gate, out, kBlockSize);
+    for (size_t i = 0; i < kBlockSize; ++i) {
+      float t = float(block * kBlockSize + i) / sample_rate;
+      if (threshold < 0.0f) {
+        num_wraps += out[i].phase < previous_phase;
+        previous_phase = out[i].phase;
+        if (num_wraps == 4) {
+          return t;
+        }
+      } else {
+        bool crossed = rising
+            ? out[i].value >= threshold
+            : out[i].value <= threshold;
+        if (crossed && armed) {
+          return t;
+        }
+        armed = armed || !crossed;
+      }
+    }
+  }
+  return 0.0f;
+}
+
+void TestSampleRateInvariance() {
+  const float sample_rates[] = { 44100.0f, 48000.0f, 96000.0f };
+  const segment::Configuration decay = { segment::TYPE_RAMP, false };
+  const segment::Configuration pulse = { segment::TYPE_HOLD, false };
+  const segment::Configuration portamento = { segment::TYPE_STEP, false };
+  const segment::Configuration lfo = { segment::TYPE_RAMP, true };
+
+  int num_failures = 0;
+  for (int j = 0; j < 3; ++j) {
+    float sr[2] = { stages::kSampleRate, sample_rates[j] };
+    float t[2][4];
+    for (int k = 0; k < 2; ++k) {
+      t[k][0] = MeasureTime(sr[k], decay, true, 0.6f, 0.5f, 0.5f, false);
+      t[k][1] = MeasureTime(sr[k], pulse, true, 1.0f, 0.5f, 0.5f, false);
+      t[k][2] = MeasureTime(sr[k], portamento, false, 1.0f, 0.7f, 0.5f, true);
+      t[k][3] = MeasureTime(sr[k], lfo, false, 0.5f, 0.5f, -1.0f, true);
+    }
+    const char* names[] = { "decay", "pulse", "portamento", "LFO" };
+    for (int i = 0; i < 4; ++i) {
+      // One block of tolerance for parameter interpolation, plus 1%.
+      float tolerance = 0.01f * t[0][i] + kBlockSize / sr[0];
+      if (t[0][i] == 0.0f || fabsf(t[1][i] - t[0][i]) > tolerance) {
+        printf("%s at %.0fHz: %.4fs instead of %.4fs\n",
+               names[i], sr[1], t[1][i], t[0][i]);
+        ++num_failures;
+      }
+    }
+  }
+  if (!num_failures) {
+    printf("Time constants are preserved across sample rates.\n");
+  }
+}
+
+// Renders a portamento with its secondary parameter moving around 0.5 by
+// jitter every block, and returns the value reached after a step from 0 to 1.
+float RenderPortamentoStep(float secondary, float jitter) {
+  SegmentGeneratorTest t;
+  segment::Configuration configuration = { segment::TYPE_STEP, false };
+  SegmentGenerator* g = t.generator();
+  g->Configure(false, &configuration, 1);
+
+  GateFlags gate[kBlockSize];
+  SegmentGenerator::Output out[kBlockSize];
+  fill(&gate[0], &gate[kBlockSize], GATE_FLAG_LOW);
+  for (int i = 0; i < 64; ++i) {
+    float primary = i < 32 ? 0.0f : 1.0f;
+    g->set_segment_parameters(0, primary, secondary + (i & 1 ? jitter : 0.0f));
+    g->Process(gate, out, kBlockSize);
+  }
+  return out[kBlockSize - 1].value;
+}
+
+void TestDerivedParameters() {
+  float reference = RenderPortamentoStep(0.5f, 0.0f);
+  float jittery = RenderPortamentoStep(0.5f, -0.5f * kParameterHysteresis);
+  float moved = RenderPortamentoStep(0.5f, 4.0f * kParameterHysteresis);
+  if (jittery != reference) {
+    printf("Derived parameters: recomputed on jitter (%f vs %f)\n",
+           jittery, reference);
+  } else if (moved == reference) {
+    printf("Derived parameters: not recomputed on a move (%f)\n", moved);
+  } else {
+    printf("Derived parameters are only recomputed when the knob moves.\n");
+  }
+}
+
+// Records 2s of a slow sine on the CV input of a CV recorder, then measures
+// how far the replay is from the take, and the duration of the loop at 1x
+// and 4x.
+float ReplayTake(float slider, float* loop_duration) {
+  SegmentGeneratorTest t;
+  segment::Configuration configuration = {
+    segment::TYPE_HOLD, true, false, segment::RANGE_DEFAULT, 0, true
+  };
+  SegmentGenerator* g = t.generator();
+  g->Configure(true, &configuration, 1);
+
+  const size_t kTakeSize = size_t(2.0f * ::kSampleRate);
+  const size_t kReplaySize = 3 * kTakeSize;
+  GateFlags gate[kBlockSize];
+  SegmentGenerator::Output out[kBlockSize];
+  GateFlags previous = GATE_FLAG_LOW;
+  float error = 0.0f;
+  size_t num_wraps = 0;
+  size_t first_wrap = 0;
+  size_t last_wrap = 0;
+  float previous_phase = 0.0f;
+  for (size_t i = 0; i < kTakeSize + kReplaySize; i += kBlockSize) {
+    size_t position = i % kTakeSize;
+    float cv = 0.5f * sinf(2.0f * M_PI * float(position) / float(kTakeSize));
+    for (size_t j = 0; j < kBlockSize; ++j) {
+      previous = gate[j] = ExtractGateFlags(previous, i + j < kTakeSize);
+    }
+    g->set_segment_parameters(0, cv, 0.0f, cv, slider);
+    g->Process(gate, out, kBlockSize);
+    if (i < kTakeSize) {
+      continue;
+    }
+    if (slider == 0.5f) {
+      // Recorder samples are averaged, which delays the replay by half a
+      // recorder sample.
+      error = max(error, fabsf(out[0].value - cv));
+    }
+    for (size_t j = 0; j < kBlockSize; ++j) {
+      if (out[j].phase < previous_phase) {
+        first_wrap = num_wraps++ ? first_wrap : i + j;
+        last_wrap = i + j;
+      }
+      previous_phase = out[j].phase;
+    }
+  }
+  *loop_duration = num_wraps > 1
+      ? float(last_wrap - first_wrap) / float(num_wraps - 1) / ::kSampleRate
+      : 0.0f;
+  return error;
+}
+
+void TestRecorder() {
+  float duration_1x = 0.0f;
+  float duration_4x = 0.0f;
+  float error = ReplayTake(0.5f, &duration_1x);
+  ReplayTake(1.0f, &duration_4x);
+  if (error > 0.01f ||
+      fabsf(duration_1x - 2.0f) > 0.01f ||
+      fabsf(duration_4x - 0.5f) > 0.01f) {
+    printf("Recorder: error %f, loop %fs at 1x, %fs at 4x\n",
+           error, duration_1x, duration_4x);
+  } else {
+    printf("Recorder: 2s take replayed within %.4f, %.3fs loop at 4x\n",
+           error, duration_4x);
+  }
+}
+
+// RandomStream must give the same values as stmlib::Random, by blocks of any
+// size, and end up in the same state.
+void TestRandomStream() {
+  int num_failures = 0;
+  const size_t kMaxSize = 4 * kRandomLanes + 3;
+  for (size_t size = 0; size <= kMaxSize; ++size) {
+    uint32_t words[kMaxSize];
+    float floats[kMaxSize];
+    float normals[kMaxSize];
+    RandomStream stream;
+    stream.Seed(size);
+    stream.GetWords(words, size);
+    stream.GetFloats(floats, size, 1.25f, -0.625f);
+    stream.GetAlmostNormals(normals, size);
+    int16_t sample = stream.GetSample();
+    float value = stream.GetFloat();
+    float scaled_value = stream.GetFloat(1.25f, -0.625f);
+
+    Random::Seed(size);
+    for (size_t i = 0; i < size; ++i) {
+      num_failures += words[i] != Random::GetWord();
+    }
+    for (size_t i = 0; i < size; ++i) {
+      num_failures += floats[i] != Random::GetFloat() * 1.25f - 0.625f;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      uint32_t a = Random::GetWord();
+      uint32_t b = Random::GetWord();
+      num_failures += normals[i] != AlmostNormal(a, b);
+    }
+    num_failures += sample != Random::GetSample();
+    num_failures += value != Random::GetFloat();
+    num_failures += scaled_value != Random::GetFloat() * 1.25f - 0.625f;
+    num_failures += stream.state() != Random::state();
+  }
+  if (num_failures) {
+    printf("RandomStream: %d mismatches with stmlib::Random\n", num_failures);
+  } else {
+    printf("RandomStream matches stmlib::Random.\n");
+  }
+}
+
+// Each generator has its own random stream: all the benchmarks rendered
+// together, block by block and in reverse order, must give the same outputs
+// as the benchmarks rendered one after the other.
+void TestRandomStreamOrder() {
+  const size_t num_blocks = ::kSampleRate / kBlockSize;
+  vector<GeneratorBenchmark> benchmarks = GeneratorBenchmarks();
+  const size_t n = benchmarks.size();
+  vector<vector<SegmentGenerator::Output> > out[2];
+  out[0].resize(n);
+  out[1].resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    GeneratorBenchmarkRunner runner;
+    runner.Init(benchmarks[i], num_blocks);
+    out[0][i].resize(num_blocks * kBlockSize);
+    for (size_t j = 0; j < num_blocks; ++j) {
+      runner.PrepareBlock();
+      runner.ProcessBlock(&out[0][i][j * kBlockSize]);
+    }
+  }
+
+  vector<GeneratorBenchmarkRunner*> runners(n);
+  for (size_t i = 0; i < n; ++i) {
+    runners[i] = new GeneratorBenchmarkRunner();
+    runners[i]->Init(benchmarks[i], num_blocks);
+    out[1][i].resize(num_blocks * kBlockSize);
+  }
+  for (size_t j = 0; j < num_blocks; ++j) {
+    for (size_t i = n; i--; ) {
+      runners[i]->PrepareBlock();
+      runners[i]->ProcessBlock(&out[1][i][j * kBlockSize]);
+    }
+  }
+
+  int num_failures = 0;
+  for (size_t i = 0; i < n; ++i) {
+    delete runners[i];
+    // As in TestGateEdges, two renders of a tap LFO can differ anyway.
+    const GeneratorBenchmark& b = benchmarks[i];
+    bool tap_lfo = b.has_trigger && b.num_segments == 1 &&
+        b.configuration[0].loop && (
+            b.configuration[0].type == segment::TYPE_RAMP ||
+            b.configuration[0].type == segment::TYPE_TURING);
+    if (tap_lfo) {
+      continue;
+    }
+    for (size_t j = 0; j < num_blocks * kBlockSize; ++j) {
+      if (out[0][i][j].value != out[1][i][j].value ||
+          out[0][i][j].segment != out[1][i][j].segment) {
+        printf("%s: the order of the renders changes the output at "
+               "sample %lu\n", benchmarks[i].name.c_str(), j);
+        ++num_failures;
+        break;
+      }
+    }
+  }
+  if (!num_failures) {
+    printf("Renders don't depend on the order of the generators.\n");
+  }
+}
+
+// A sweep gives the same renders whatever the number of threads, and each
+// point is the render of the patch with the parameters of the point.
+void TestSweep() {
+  Patch patch;
+  patch.multimode = MULTI_MODE_STAGES_ADVANCED;
+  ChannelPatch c;
+  c.configuration.type = segment::TYPE_TURING;
+  c.configuration.loop = true;
+  c.configuration.bipolar = false;
+  c.configuration.range = segment::RANGE_FAST;
+  c.configuration.quant_scale = 0;
+  c.configuration.reset_on_gate = false;
+  c.gate.type = GATE_SOURCE_NONE;
+  c.primary.type = c.secondary.type = c.cv.type = SOURCE_CONSTANT;
+  c.primary.value = c.secondary.value = c.cv.value = 0.0f;
+  c.slider = c.primary;
+  patch.channels.push_back(c);
+  c.configuration.type = segment::TYPE_RAMP;
+  c.gate.type = GATE_SOURCE_TEST_PATTERN;
+  patch.channels.push_back(c);
+
+  SweepGrid grid = { 0, { 0.0f, 1.0f, 5 }, { 0.0f, 1.0f, 3 } };
+  const size_t num_frames = ::kSampleRate / 4;
+  SweepRenderer renderer;
+  renderer.Init(&patch, grid, NULL, NULL, num_frames, kBlockSize);
+  const size_t size = grid.num_points() * renderer.point_size();
+  vector<float> out[2];
+  out[0].resize(size);
+  out[1].resize(size);
+  renderer.Render(&out[0][0], 1);
+  renderer.Render(&out[1][0], 4);
+
+  const size_t point = 7;
+  patch.channels[0].primary.value = grid.primary_value(point);
+  patch.channels[0].slider.value = grid.primary_value(point);
+  patch.channels[0].secondary.value = grid.secondary_value(point);
+  PatchRenderer* reference = new PatchRenderer();
+  reference->Init(&patch, NULL, NULL, true);
+  vector<float> expected(renderer.point_size());
+  for (size_t i = 0; i < num_frames; i += kBlockSize) {
+    reference->Render(&expected[i * patch.channels.size()], kBlockSize);
+  }
+  delete reference;
+
+  int num_failures = 0;
+  if (memcmp(&out[0][0], &out[1][0], size * sizeof(float))) {
+    printf("Sweep: the renders depend on the number of threads\n");
+    ++num_failures;
+  }
+  if (memcmp(&out[1][point * renderer.point_size()], &expected[0],
+             renderer.point_size() * sizeof(float))) {
+    printf("Sweep: point %lu differs from the render of its patch\n", point);
+    ++num_failures;
+  }
+  if (!num_failures) {
+    printf("Sweeps don't depend on the number of threads.\n");
+  }
+}
+
+inline bool Bounded(const float* s, float bound) {
+  for (int i = 0; i < 3; ++i) {
+    if (!(fabsf(s[i]) < bound)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// At the top of the fast range (dt = 0.01) and with the smallest b, one Euler
+// step per sample makes the double scroll diverge. The decimated RK4 trajectory must
+// stay on the attractor, both on its own and through the segment generator.
+void TestAttractors() {
+  const size_t kNumSamples = 60 * ::kSampleRate;
+  int num_failures = 0;
+
+  Attractor<DoubleScrollSystem> rk4;
+  Attractor<DoubleScrollSystem> euler;
+  rk4.Init(0.3f, 0.5f, 0.7f);
+  euler.Init(0.3f, 0.5f, 0.7f);
+  size_t euler_divergence = 0;
+  for (size_t i = 0; i < kNumSamples; ++i) {
+    rk4.Next(0.01f, 1.0f);
+    if (!Bounded(rk4.state(), 100.0f)) {
+      printf("Double scroll diverged after %lu samples\n", i);
+      ++num_failures;
+      break;
+    }
+    if (!euler_divergence) {
+      euler.NextEuler(0.01f, 1.0f);
+      euler_divergence = Bounded(euler.state(), 100.0f) ? 0 : i;
+    }
+  }
+
+  // With the smallest b, the Thomas attractor stays within 1 / b of the
+  // origin. Its steps are clamped when dt is too large.
+  Attractor<ThomasSymmetricSystem> thomas;
+  thomas.Init(0.3f, 0.5f, 0.7f);
+  for (size_t i = 0; i < kNumSamples; ++i) {
+    thomas.Next(1.0f, 0.001f);
+    if (!Bounded(thomas.state(), 1001.0f)) {
+      printf("Thomas attractor diverged after %lu samples\n", i);
+      ++num_failures;
+      break;
+    }
+  }
+
+  // Non-looping TURING segment without gate, in advanced mode.
+  SegmentGeneratorTest t;
+  segment::Configuration configuration = {
+    segment::TYPE_TURING, false, false, segment::RANGE_FAST
+  };
+  t.generator()->Configure(false, &configuration, 1);
+  // Slider and CV at their maximum.
+  t.set_segment_parameters(0, 2.0f, 0.0f);
+  vector<SegmentGenerator::Output> out;
+  t.Render(&out, kNumSamples);
+  // The x coordinate keeps switching between the two scrolls.
+  size_t num_switches = 0;
+  for (size_t i = kNumSamples - ::kSampleRate; i < kNumSamples; ++i) {
+    num_switches += out[i].segment != out[i - 1].segment;
+    if (!(out[i].value >= 0.0f && out[i].value <= 1.0f)) {
+      ++num_failures;
+      break;
+    }
+  }
+  if (num_switches < 10) {
+    printf("Double scroll segment: %lu switches in the last second\n",
+           num_switches);
+    ++num_failures;
+  }
+
+  if (!num_failures) {
+    printf("Attractors stay bounded (Euler diverges after %lu samples).\n",
+           euler_divergence);
+  }
+}
+
+// Renders a square wave made by a loop of two timed HOLD segments, and
+// returns its period (in samples). The last kSpectrumSize samples are
+// stored in x, and the largest distance (in samples) between a rising edge
+// of the wave and the start of the first segment in lag.
+const size_t kSpectrumSize = 4096;
+
+float RenderMultiSegmentLoop(
+    int oversampling,
+    bool polyblep,
+    float time,
+    vector<float>* x,
+    size_t* lag) {
+  SegmentGeneratorTest t;
+  segment::Configuration configuration[2] = {
+    { segment::TYPE_HOLD, true },
+    { segment::TYPE_HOLD, true },
+  };
+  SegmentGenerator* g = t.generator();
+  g->Configure(false, configuration, 2);
+  g->set_oversampling(oversampling);
+  g->set_polyblep(polyblep);
+  g->set_segment_parameters(0, 1.0f, time);
+  g->set_segment_parameters(1, 0.0f, time);
+
+  const size_t kNumSamples = 65536;
+  GateFlags gate[kBlockSize];
+  SegmentGenerator::Output out[kBlockSize];
+  fill(&gate[0], &gate[kBlockSize], GATE_FLAG_LOW);
+  x->clear();
+  int num_cycles = 0;
+  size_t first_cycle = 0;
+  size_t last_cycle = 0;
+  int previous_segment = 0;
+  float previous_value = 0.0f;
+  *lag = 0;
+  for (size_t i = 0; i < kNumSamples; i += kBlockSize) {
+    g->Process(gate, out, kBlockSize);
+    for (size_t j = 0; j < kBlockSize; ++j) {
+      if (out[j].segment == 0 && previous_segment == 1) {
+        first_cycle = num_cycles++ ? first_cycle : i + j;
+        last_cycle = i + j;
+      }
+      if (num_cycles && out[j].value >= 0.5f && previous_value < 0.5f) {
+        *lag = max(*lag, i + j - last_cycle);
+      }
+      previous_segment = out[j].segment;
+      previous_value = out[j].value;
+      if (i >= kNumSamples - kSpectrumSize) {
+        x->push_back(out[j].value);
+      }
+    }
+  }
+  return float(last_cycle - first_cycle) / float(num_cycles - 1);
+}
+
+// Level (in dB, relative to the whole signal) of everything below a quarter
+// of the sample rate which is not a harmonic of f0.
+float InharmonicLevel(const vector<float>& x, float f0) {
+  float total = 0.0f;
+  float inharmonic = 0.0f;
+  for (size_t bin = 0; bin < kSpectrumSize / 4; ++bin) {
+    float re = 0.0f;
+    float im = 0.0f;
+    for (size_t i = 0; i < kSpectrumSize; ++i) {
+      // 4-term Blackman-Harris window.
+      const float w = 2.0f * M_PI * float(i) / float(kSpectrumSize);
+      const float window = 0.35875f - 0.48829f * cosf(w) + \
+          0.14128f * cosf(2.0f * w) - 0.01168f * cosf(3.0f * w);
+      const float phase = w * float(bin);
+      re += window * x[i] * cosf(phase);
+      im += window * x[i] * sinf(phase);
+    }
+    const float power = re * re + im * im;
+    const float f = float(bin) / float(kSpectrumSize);
+    const float harmonic = floorf(f / f0 + 0.5f) * f0;
+    total += power;
+    if (fabsf(f - harmonic) > 4.0f / float(kSpectrumSize)) {
+      inharmonic += power;
+    }
+  }
+  return 10.0f * log10f(inharmonic / total);
+}
+
+// A segment starts where the previous one overshot its end, so that loops
+// are in tune at any oversampling factor, but their jumps fall between
+// samples and alias. Oversampling and the polyBLEP (the last case, at 1x)
+// must reduce the aliasing, and the segment must stay aligned with the
+// delayed output, as it is without either.
+void TestOversampledMultiSegment() {
+  vector<float> x;
+  float max_error[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  float aliasing[4];
+  size_t max_lag[4] = { 0, 0, 0, 0 };
+  for (int i = 0; i < 4; ++i) {
+    const int oversampling = i == 3 ? 1 : 1 << i;
+    const bool polyblep = i == 3;
+    size_t lag;
+    // The fastest loops, around 500Hz.
+    for (int j = 0; j < 16; ++j) {
+      float time = (float(j) + 0.5f) / 2048.0f;
+      float period = RenderMultiSegmentLoop(
+          oversampling, polyblep, time, &x, &lag);
+      float f0 = lut_env_frequency[j] / 2.0f;
+      max_error[i] = max(max_error[i], fabsf(1200.0f * log2f(period * f0)));
+      max_lag[i] = max(max_lag[i], lag);
+    }
+    float period = RenderMultiSegmentLoop(
+        oversampling, polyblep, 1.5f / 2048.0f, &x, &lag);
+    aliasing[i] = InharmonicLevel(x, 1.0f / period);
+  }
+  float max_max_error = *max_element(&max_error[0], &max_error[4]);
+  size_t max_max_lag = *max_element(&max_lag[1], &max_lag[4]);
+  if (max_max_error > 0.1f ||
+      aliasing[2] > aliasing[0] - 10.0f ||
+      aliasing[3] > aliasing[2] ||
+      max_max_lag > max_lag[0] + 1) {
+    printf("Multi-segment oversampling failed: ");
+  } else {
+    printf("Multi-segment loops: ");
+  }
+  printf("pitch error %.2f/%.2f/%.2f/%.2f cents, "
+         "aliasing %.0f/%.0f/%.0f/%.0fdB, "
+         "lag %lu/%lu/%lu/%lu samples (1x/2x/4x/polyBLEP)\n",
+         max_error[0], max_error[1], max_error[2], max_error[3],
+         aliasing[0], aliasing[1], aliasing[2], aliasing[3],
+         max_lag[0], max_lag[1], max_lag[2], max_lag[3]);
+}
+
+void TestPhaseWarp() {
+  float max_error = 0.0f;
+  float worst_curve = 0.0f;
+  float worst_t = 0.0f;
+  for (int i = 0; i <= 1024; ++i) {
+    PhaseWarp w;
+    float curve = float(i) / 1024.0f;
+    w.Init(curve);
+    for (int j = 0; j <= 4096; ++j) {
+      float t = float(j) / 4096.0f;
+      float error = fabsf(w.WarpFast(t) - w.WarpExact(t));
+      if (error > max_error) {
+        max_error = error;
+        worst_curve = curve;
+        worst_t = t;
+      }
+    }
+  }
+  printf("PhaseWarp: fast path within %g of the reference "
+         "(curve %.3f, phase %.3f)%s\n",
+         max_error, worst_curve, worst_t,
+         max_error > kMaxPhaseWarpError ? ", ABOVE THE DOCUMENTED BOUND" : "");
+}
+
+void RecordBlock(TestRing::Block* block, size_t size) {
+  rendered_blocks.push_back(int(block->cv[0]));
+}
+
+void TestIOBufferRing() {
+  TestRing* ring = new TestRing();
+  ring->Init();
+  rendered_blocks.clear();
+
+  // The producer runs like the DAC interrupt, in slices of 2 frames, and
+  // tags each block with its number. The render loop stalls for 2 blocks
+  // (within the slack of a 4-block ring), then for 6 blocks, after which 7
+  // blocks are pending and the 4 oldest ones have been overwritten.
+  const int stalls[] = { 20, 22, 40, 46 };
+  int num_blocks = 64;
+  for (int i = 0; i < num_blocks; ++i) {
+    for (size_t frame = 0; frame < kBlockSize; frame += 2) {
+      TestRing::Slice s = ring->NextSlice(2);
+      if (s.frame_index == 0) {
+        s.block->cv[0] = float(i);
+      }
+      bool stalled = (i >= stalls[0] && i < stalls[1]) || \
+          (i >= stalls[2] && i < stalls[3]);
+      if (!stalled) {
+        ring->Process(&RecordBlock);
+      }
+    }
+  }
+
+  // The first half of the ring is rendered before anything is played.
+  size_t skipped = 0;
+  for (size_t i = 4 / 2 + 1; i < rendered_blocks.size(); ++i) {
+    int step = rendered_blocks[i] - rendered_blocks[i - 1];
+    if (step < 1) {
+      printf("IOBufferRing rendered block %d after block %d\n",
+             rendered_blocks[i], rendered_blocks[i - 1]);
+      delete ring;
+      return;
+    }
+    skipped += step - 1;
+  }
+  if (skipped != 4 || ring->overruns() != 4 || !ring->underruns() || \
+      ring->high_water_mark() != 7) {
+    printf("IOBufferRing: %lu blocks skipped, %u overruns, %u underruns, "
+           "high-water mark %u\n", skipped, ring->overruns(),
+           ring->underruns(), ring->high_water_mark());
+  } else {
+    printf("IOBufferRing: %u overruns, %u underruns on a %lu-sample ring.\n",
+           ring->overruns(), ring->underruns(), ring->latency());
+  }
+  delete ring;
+}
+
+void TestVirtualChain() {
+  VirtualChain* chain = new VirtualChain();
+  // About one byte in a thousand is lost, which shifts the packets in the
+  // RX buffers of the modules.
+  VirtualLinkOptions options = { 0.0005f, 0.0001f, 0.001f };
+  const size_t boot_delay[] = { 0, 37, 5, 120, 64, 200 };
+  chain->Init(kMaxChainSize, MULTI_MODE_STAGES, options, 0, boot_delay);
+
+  const size_t kTimeout = size_t(4.0 / kVirtualBlockDuration);
+  while (!chain->discovered() && chain->num_blocks() < kTimeout) {
+    chain->Process();
+  }
+  if (!chain->discovered()) {
+    printf("Virtual chain: discovery failed\n");
+    delete chain;
+    return;
+  }
+  size_t discovery_blocks = chain->num_blocks();
+
+  // No two generators of the chain draw from the same stream.
+  vector<uint32_t> states;
+  for (size_t i = 0; i < kMaxChainSize; ++i) {
+    for (size_t j = 0; j < kNumChannels; ++j) {
+      states.push_back(chain->module(i)->segment_generator(j)->random_state());
+    }
+  }
+  sort(states.begin(), states.end());
+  if (unique(states.begin(), states.end()) != states.end()) {
+    printf("Virtual chain: modules share random streams\n");
+  }
+
+  // A gate on the first channel makes a 36-segment group once the other
+  // inputs have been seen unpatched for long enough. Patching an input on
+  // the last module splits it.
+  SegmentGenerator* group = chain->module(0)->segment_generator(0);
+  chain->module(0)->set_input_patched(0, true);
+  for (size_t i = 0; i < kTimeout; ++i) {
+    chain->Process();
+  }
+  size_t split_blocks = 0;
+  if (group->num_segments() == int(kMaxNumChannels)) {
+    chain->module(kMaxChainSize - 1)->set_input_patched(3, true);
+    while (group->num_segments() != int(kMaxNumChannels - 3) &&
+           split_blocks < kTimeout) {
+      chain->Process();
+      ++split_blocks;
+    }
+  }
+  if (split_blocks == 0 || split_blocks == kTimeout) {
+    printf("Virtual chain: first group has %d segments\n",
+           group->num_segments());
+  } else {
+    printf("Virtual chain: %lu modules ready after %.0fms, group split "
+           "%.1fms after patching the last module.\n",
+           kMaxChainSize,
+           float(discovery_blocks) * kVirtualBlockDuration * 1000.0f,
+           float(split_blocks) * kVirtualBlockDuration * 1000.0f);
+  }
+  delete chain;
+}
+
 void TestDelayLine() {
-  DelayLine16Bits<8> d;
-  d.Init();
+  PackedDelayLine<16, DELAY_LINE_FORMAT_16_BIT> d;
+  d.Init(0.0f);
   for (int i = 0; i < 21; i++) {
     d.Write(i / 22.0f + 0.01f);
     float a = d.Read(size_t(1));
@@ -305,6 +1368,53 @@ float rand_float() {
   return static_cast<float>(rand()) / RAND_MAX;
 }
 
+// Writes noise in a delay line, and returns the largest error of what comes
+// out of the longest delay.
+template<DelayLineFormat format>
+float PackedDelayLineError() {
+  const size_t kSize = 2304;
+  typedef PackedDelayLine<kSize, format> Line;
+  Line* d = new Line;
+  d->Init(0.0f);
+  const size_t capacity = Line::capacity();
+  vector<float> x;
+  float error = 0.0f;
+  for (size_t j = 0; j < 4 * capacity; ++j) {
+    x.push_back(rand_float() * 2.0f - 1.0f);
+    d->Write(x.back());
+    if (j >= capacity) {
+      float delayed = d->Read(float(capacity - 1));
+      error = max(error, fabsf(delayed - x[j - capacity + 2]));
+    }
+  }
+  delete d;
+  return error;
+}
+
+// The error must be below the quantization step of each format.
+void TestPackedDelayLine() {
+  // 16-bit and 12-bit truncate, mu-law rounds to a step of 1024 LSBs at
+  // full scale.
+  const float max_error[] = {
+    1.0f / 32768.0f, 16.0f / 32768.0f, 1024.0f / 32768.0f
+  };
+  const float error[] = {
+    PackedDelayLineError<DELAY_LINE_FORMAT_16_BIT>(),
+    PackedDelayLineError<DELAY_LINE_FORMAT_12_BIT>(),
+    PackedDelayLineError<DELAY_LINE_FORMAT_MU_LAW>()
+  };
+  int num_failures = 0;
+  for (int i = 0; i < DELAY_LINE_FORMAT_LAST; ++i) {
+    if (error[i] > max_error[i]) {
+      printf("Delay line format %d: error %g\n", i, error[i]);
+      ++num_failures;
+    }
+  }
+  if (!num_failures) {
+    printf("Delay line: 1152/1536/2304 samples in 16-bit/12-bit/mu-law.\n");
+  }
+}
+
 void TestSmallQuantizer() {
   printf("Testing quantizer\n");
   BraidsQuantizer ref;
@@ -359,6 +1469,57 @@ void TestSmallQuantizer() {
   printf("Passed %d quantization tests.\n", passed);
 }
 
+// The table lookup of Quantizer::Process must give the same notes as the
+// linear scan, for pitches that stay in the hysteresis window or leave it by
+// any amount, over the whole 16-bit range.
+void TestQuantizerLookup() {
+  const Scale extra_scales[] = {
+    { 12 << 7, 1, { 640 } },
+    { 1000, 3, { 0, 10, 999 } },
+    { 12 << 7, 16, {
+        0, 96, 192, 288, 384, 480, 576, 672,
+        768, 864, 960, 1056, 1152, 1248, 1344, 1440 } },
+  };
+  const size_t num_scales = sizeof(scales) / sizeof(Scale);
+  const size_t num_extra_scales = sizeof(extra_scales) / sizeof(Scale);
+  int num_failures = 0;
+  int num_tests = 0;
+  srand(0);
+  for (size_t ix = 0; ix < num_scales + num_extra_scales; ++ix) {
+    const Scale& scale = ix < num_scales
+        ? scales[ix]
+        : extra_scales[ix - num_scales];
+    Quantizer lookup;
+    Quantizer scan;
+    lookup.Init();
+    lookup.Configure(scale);
+    scan.Init();
+    scan.Configure(scale);
+    for (int step = 1; step < 3000; step += step < 8 ? 1 : step / 4) {
+      for (int direction = -1; direction <= 1; direction += 2) {
+        for (int32_t i = 0; i < 65536; i += step) {
+          int16_t pitch = direction > 0 ? i - 32768 : 32767 - i;
+          num_failures += lookup.Process(pitch) != scan.ProcessScan(pitch, 0);
+          ++num_tests;
+        }
+      }
+    }
+    for (int i = 0; i < 100000; ++i) {
+      int16_t pitch = (rand() & 0xffff) - 32768;
+      int16_t root = (rand() & 0x7ff) - 1024;
+      num_failures += lookup.Process(pitch, root) != \
+          scan.ProcessScan(pitch, root);
+      ++num_tests;
+    }
+  }
+  if (num_failures) {
+    printf("Quantizer: %d mismatches with the linear scan\n", num_failures);
+  } else {
+    printf("Quantizer lookup matches the linear scan (%d pitches).\n",
+           num_tests);
+  }
+}
+
 void TestTuringMachine() {
   SegmentGeneratorTest t;
 
@@ -424,6 +1585,25 @@ int main(void) {
   TestWhiteNoise();
   TestBrownNoise();
   TestDelay();
+  TestBlockSizeInvariance();
+  TestGateEdges();
+  TestSubsampleGates();
+  TestLfoBank();
+  TestIOBufferRing();
+  TestEnvelopeRender();
+  TestEnvelopeBank();
+  TestVirtualChain();
+  TestSampleRateInvariance();
+  TestOversampledMultiSegment();
+  TestPhaseWarp();
+  TestDerivedParameters();
+  TestPackedDelayLine();
+  TestRecorder();
+  TestAttractors();
+  TestRandomStream();
+  TestRandomStreamOrder();
+  TestSweep();
+  TestQuantizerLookup();
   // for (int i=100; i--;) TestTapLFO();
   // for (int i=200; i--;) TestTapLFOAudioRate();
   // TestSmallQuantizer();
@@ -0,0 +1,256 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Declarative patch description, and a renderer that groups channels and
+// drives SegmentGenerators the same way ChainState does on the hardware.
+//
+// A patch file contains one "channel" line per channel (left to right, up to
+// 36 channels, ie a full chain), optionally preceded by a "mode" line.
+// Everything after a '#' is a comment. Example (ADSR triggered by the test
+// pattern on channel 0, free-running LFO on channel 5):
+//
+// -----------------------------------------------------------------------------
+//
+// Parameter sweeps: a patch rendered over a grid of primary and secondary
+// values of one of its channels, on several threads.
+//
+// The grid points are independent renders, written at fixed offsets of a
+// single array of floats: point p occupies point_size() floats from
+// p * point_size(), with the channels interleaved as in PatchRenderer. The
+// threads only share the work queues. Each thread starts with a contiguous
+// share of the grid, and when it runs out of points, steals the upper half
+// of the points left to the busiest thread.
+//
+// The generators have their own random streams, so the renders don't depend
+// on the number of threads, nor on the order of the points.
+
+#ifndef STAGES_TEST_SWEEP_H_
+#define STAGES_TEST_SWEEP_H_
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "stages/test/patch.h"
+#include "stages/test/wav_file.h"
+
+namespace stages {
+
+// num_steps values from start to end, both included.
+struct SweepAxis {
+  float start;
+  float end;
+  size_t num_steps;
+
+  inline float value(size_t i) const {
+    return num_steps > 1
+        ? start + (end - start) * static_cast<float>(i) / (num_steps - 1)
+        : start;
+  }
+};
+
+// The primary value changes faster than the secondary value.
+struct SweepGrid {
+  size_t channel;
+  SweepAxis primary;
+  SweepAxis secondary;
+
+  inline size_t num_points() const {
+    return primary.num_steps * secondary.num_steps;
+  }
+  inline float primary_value(size_t point) const {
+    return primary.value(point % primary.num_steps);
+  }
+  inline float secondary_value(size_t point) const {
+    return secondary.value(point / primary.num_steps);
+  }
+};
+
+// A range of items per worker. The owner takes the items from the front, the
+// other workers steal from the back.
+class WorkStealingQueues {
+ public:
+  WorkStealingQueues() : queue_(NULL), num_workers_(0) { }
+  ~WorkStealingQueues() { delete[] queue_; }
+
+  void Init(size_t num_items, size_t num_workers) {
+    delete[] queue_;
+    num_workers_ = num_workers;
+    queue_ = new Queue[num_workers];
+    for (size_t i = 0; i < num_workers; ++i) {
+      queue_[i].begin = num_items * i / num_workers;
+      queue_[i].end = num_items * (i + 1) / num_workers;
+    }
+  }
+
+  // Returns false when there is nothing left to do.
+  bool Next(size_t worker, size_t* item) {
+    Queue* q = &queue_[worker];
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(q->mutex);
+        if (q->begin != q->end) {
+          *item = q->begin++;
+          return true;
+        }
+      }
+      if (!Steal(worker)) {
+        return false;
+      }
+    }
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    size_t begin;
+    size_t end;
+  };
+
+  // Moves the upper half of the largest queue to the queue of worker. Tries
+  // again if the victim got emptied in-between.
+  bool Steal(size_t worker) {
+    while (true) {
+      size_t victim = num_workers_;
+      size_t largest = 0;
+      for (size_t i = 0; i < num_workers_; ++i) {
+        std::lock_guard<std::mutex> lock(queue_[i].mutex);
+        size_t size = queue_[i].end - queue_[i].begin;
+        if (i != worker && size > largest) {
+          victim = i;
+          largest = size;
+        }
+      }
+      if (victim == num_workers_) {
+        return false;
+      }
+      size_t begin, end;
+      {
+        std::lock_guard<std::mutex> lock(queue_[victim].mutex);
+        Queue* v = &queue_[victim];
+        if (v->begin == v->end) {
+          continue;
+        }
+        end = v->end;
+        begin = v->end - (v->end - v->begin + 1) / 2;
+        v->end = begin;
+      }
+      std::lock_guard<std::mutex> lock(queue_[worker].mutex);
+      queue_[worker].begin = begin;
+      queue_[worker].end = end;
+      return true;
+    }
+  }
+
+  Queue* queue_;
+  size_t num_workers_;
+
+  DISALLOW_COPY_AND_ASSIGN(WorkStealingQueues);
+};
+
+class SweepRenderer {
+ public:
+  SweepRenderer() { }
+  ~SweepRenderer() { }
+
+  void Init(
+      const Patch* patch,
+      const SweepGrid& grid,
+      const WavReader* gate_input,
+      const WavReader* cv_input,
+      size_t num_frames,
+      size_t block_size) {
+    patch_ = patch;
+    grid_ = grid;
+    gate_input_ = gate_input;
+    cv_input_ = cv_input;
+    num_frames_ = num_frames;
+    block_size_ = std::min(block_size, kMaxBlockSize);
+  }
+
+  inline size_t num_channels() const { return patch_->channels.size(); }
+  inline size_t point_size() const { return num_frames_ * num_channels(); }
+  inline const SweepGrid& grid() const { return grid_; }
+
+  // out receives grid().num_points() * point_size() floats.
+  void Render(float* out, size_t num_threads) {
+    num_threads = std::max(std::min(num_threads, grid_.num_points()),
+                           size_t(1));
+    queues_.Init(grid_.num_points(), num_threads);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; ++i) {
+      threads.push_back(std::thread(&SweepRenderer::Work, this, i, out));
+    }
+    Work(0, out);
+    for (size_t i = 0; i < threads.size(); ++i) {
+      threads[i].join();
+    }
+  }
+
+  // Renders one point of the grid, without WAV writing: the patch is
+  // rendered block by block straight into out.
+  void RenderPoint(size_t point, float* out) const {
+    Patch patch = *patch_;
+    ChannelPatch* c = &patch.channels[grid_.channel];
+    // As in PatchParser, when the slider is not set, it follows primary.
+    bool slider_is_primary = c->slider.type == c->primary.type &&
+        c->slider.value == c->primary.value;
+    c->primary.type = SOURCE_CONSTANT;
+    c->primary.value = grid_.primary_value(point);
+    c->secondary.type = SOURCE_CONSTANT;
+    c->secondary.value = grid_.secondary_value(point);
+    if (slider_is_primary) {
+      c->slider = c->primary;
+    }
+
+    // Too large for the stack when rendering a full chain.
+    PatchRenderer* renderer = new PatchRenderer();
+    renderer->Init(&patch, gate_input_, cv_input_, true);
+    size_t num_frames = num_frames_;
+    while (num_frames) {
+      size_t size = std::min(num_frames, block_size_);
+      renderer->Render(out, size);
+      out += size * num_channels();
+      num_frames -= size;
+    }
+    delete renderer;
+  }
+
+ private:
+  void Work(size_t worker, float* out) {
+    size_t point;
+    while (queues_.Next(worker, &point)) {
+      RenderPoint(point, out + point * point_size());
+    }
+  }
+
+  const Patch* patch_;
+  SweepGrid grid_;
+  const WavReader* gate_input_;
+  const WavReader* cv_input_;
+  size_t num_frames_;
+  size_t block_size_;
+
+  WorkStealingQueues queues_;
+
+  DISALLOW_COPY_AND_ASSIGN(SweepRenderer);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_TEST_SWEEP_H_
@@ -0,0 +1,147 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Host implementation of SerialLink, on top of the virtual wires of the chain
+// simulator. Replaces stages/drivers/serial_link.cc in the test builds.
+
+#include "stages/test/virtual_chain.h"
+
+namespace stages {
+
+void SerialLink::Init(
+    SerialLinkDirection direction,
+    uint32_t baud_rate,
+    uint8_t* rx_buffer,
+    size_t rx_block_size) {
+  direction_ = direction;
+  baud_rate_ = baud_rate;
+  rx_buffer_ = rx_buffer;
+  rx_block_size_ = rx_block_size;
+
+  // The RX DMA channel is only enabled in circular mode.
+  rx_destination_ = rx_buffer_;
+  rx_size_ = rx_block_size_ * 2;
+  rx_position_ = 0;
+  rx_circular_ = rx_block_size_ != 0;
+  rx_half_complete_ = false;
+  rx_complete_ = false;
+}
+
+void SerialLink::Transmit(const void* buffer, size_t size) {
+  if (tx_wire_) {
+    // 8 data bits, a start bit and a stop bit.
+    tx_wire_->Send(
+        static_cast<const uint8_t*>(buffer),
+        size,
+        10.0 / double(baud_rate_));
+  }
+}
+
+bool SerialLink::tx_complete() {
+  return !tx_wire_ || tx_wire_->tx_complete();
+}
+
+void SerialLink::Receive(void* buffer, size_t size) {
+  rx_destination_ = static_cast<uint8_t*>(buffer);
+  rx_size_ = size;
+  rx_position_ = 0;
+  rx_circular_ = false;
+  rx_complete_ = false;
+}
+
+bool SerialLink::rx_complete() {
+  return rx_complete_;
+}
+
+const uint8_t* SerialLink::available_rx_buffer() {
+  if (rx_half_complete_) {
+    rx_half_complete_ = false;
+    return &rx_buffer_[0];
+  } else if (rx_complete_) {
+    rx_complete_ = false;
+    return &rx_buffer_[rx_block_size_];
+  } else {
+    return NULL;
+  }
+}
+
+void SerialLink::ReceiveByte(uint8_t byte) {
+  if (rx_position_ >= rx_size_) {
+    // DMA channel disabled, or single transfer already complete.
+    return;
+  }
+  rx_destination_[rx_position_++] = byte;
+  if (rx_circular_ && rx_position_ == rx_block_size_) {
+    rx_half_complete_ = true;
+  } else if (rx_position_ == rx_size_) {
+    rx_complete_ = true;
+    if (rx_circular_) {
+      rx_position_ = 0;
+    }
+  }
+}
+
+void VirtualWire::Init(
+    SerialLink* destination,
+    const VirtualLinkOptions& options,
+    uint32_t seed) {
+  destination_ = destination;
+  options_ = options;
+  rng_state_ = seed;
+  now_ = 0.0;
+  queue_.clear();
+  bytes_sent_ = 0;
+  bytes_lost_ = 0;
+  bytes_aborted_ = 0;
+}
+
+void VirtualWire::Send(
+    const uint8_t* data,
+    size_t size,
+    double byte_duration) {
+  while (!queue_.empty() && queue_.back().departure > now_) {
+    queue_.pop_back();
+    ++bytes_aborted_;
+  }
+
+  double departure = now_ + options_.jitter * NextRandom();
+  for (size_t i = 0; i < size; ++i) {
+    Byte b;
+    departure += byte_duration;
+    b.departure = departure;
+    b.arrival = departure + options_.latency;
+    b.value = data[i];
+    b.lost = NextRandom() < options_.byte_loss;
+    queue_.push_back(b);
+  }
+}
+
+void VirtualWire::Advance(double time) {
+  now_ = time;
+  while (!queue_.empty() && queue_.front().arrival <= now_) {
+    const Byte& b = queue_.front();
+    ++bytes_sent_;
+    if (b.lost) {
+      ++bytes_lost_;
+    } else {
+      destination_->ReceiveByte(b.value);
+    }
+    queue_.pop_front();
+  }
+}
+
+}  // namespace stages
@@ -0,0 +1,340 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Virtual chain: several modules, each with its own ChainState, Settings and
+// SegmentGenerators, connected by in-memory serial links and run in lock-step
+// one block at a time. This is the code of stages.cc minus the drivers and
+// the UI, so that discovery, reconfiguration and parameter propagation
+// across the chain can be observed without hardware.
+//
+// The links carry bytes at the baud rate set by ChainState, with a fixed
+// latency, a random delay (jitter) before each transmission, and a
+// probability for each byte to be lost. As on the hardware, the receiving
+// side is a circular buffer of two packets filled one byte at a time, so a
+// lost byte shifts the framing of all the packets that follow.
+
+#ifndef STAGES_TEST_VIRTUAL_CHAIN_H_
+#define STAGES_TEST_VIRTUAL_CHAIN_H_
+
+#include <algorithm>
+#include <deque>
+
+#include "stmlib/stmlib.h"
+#include "stmlib/utils/gate_flags.h"
+
+#include "stages/chain_state.h"
+#include "stages/drivers/serial_link.h"
+#include "stages/io_buffer.h"
+#include "stages/segment_generator.h"
+#include "stages/settings.h"
+
+namespace stages {
+
+// Duration of a block, in seconds. ChainState::Update is called once per
+// block.
+const double kVirtualBlockDuration = double(kBlockSize) / double(kSampleRate);
+
+struct VirtualLinkOptions {
+  // Time between the end of a byte on the TX pin and its arrival in the
+  // receiver's buffer, in seconds.
+  float latency;
+  // The start of each transmission is delayed by a random amount of time
+  // between 0 and jitter seconds.
+  float jitter;
+  // Probability for each byte to be lost.
+  float byte_loss;
+};
+
+// One direction of a serial cable.
+class VirtualWire {
+ public:
+  VirtualWire() { }
+  ~VirtualWire() { }
+
+  void Init(
+      SerialLink* destination,
+      const VirtualLinkOptions& options,
+      uint32_t seed);
+
+  // Called by SerialLink::Transmit. Like a restart of the TX DMA channel,
+  // this drops the bytes of the previous transmission that have not been
+  // sent yet.
+  void Send(const uint8_t* data, size_t size, double byte_duration);
+
+  // Moves the clock to time, and delivers the bytes that have arrived.
+  void Advance(double time);
+
+  inline bool tx_complete() const {
+    return queue_.empty() || queue_.back().departure <= now_;
+  }
+
+  inline size_t bytes_sent() const { return bytes_sent_; }
+  inline size_t bytes_lost() const { return bytes_lost_; }
+  inline size_t bytes_aborted() const { return bytes_aborted_; }
+
+ private:
+  struct Byte {
+    double departure;
+    double arrival;
+    uint8_t value;
+    bool lost;
+  };
+
+  inline float NextRandom() {
+    rng_state_ = rng_state_ * 1664525L + 1013904223L;
+    return static_cast<float>(rng_state_ >> 8) / 16777216.0f;
+  }
+
+  SerialLink* destination_;
+  VirtualLinkOptions options_;
+  uint32_t rng_state_;
+
+  double now_;
+  std::deque<Byte> queue_;
+
+  size_t bytes_sent_;
+  size_t bytes_lost_;
+  size_t bytes_aborted_;
+
+  DISALLOW_COPY_AND_ASSIGN(VirtualWire);
+};
+
+class VirtualModule {
+ public:
+  VirtualModule() { }
+  ~VirtualModule() { }
+
+  // Links are initialized (with no RX buffer) when the chain is created, so
+  // that bytes sent to a module which has not booted yet are dropped.
+  void Reset() {
+    left_link_.Init(SERIAL_LINK_DIRECTION_LEFT, 0, NULL, 0);
+    right_link_.Init(SERIAL_LINK_DIRECTION_RIGHT, 0, NULL, 0);
+    booted_ = false;
+  }
+
+  // Same as Init() in stages.cc, for a module without saved settings. The
+  // position of the module in the chain stands for the unique ID of its MCU
+  // in the seed of its random streams.
+  void Boot(MultiMode multimode, size_t position) {
+    settings_.Init();
+    settings_.mutable_state()->multimode = multimode;
+    for (size_t i = 0; i < kNumChannels + kMaxNumSegments; ++i) {
+      note_quantizer_[i].Init(13, 0.03f, false);
+    }
+    const uint32_t seed = SegmentGenerator::global_random_seed();
+    SegmentGenerator::set_global_random_seed(UnitSeed(seed, position));
+    for (size_t i = 0; i < kNumChannels; ++i) {
+      segment_generator_[i].Init(
+          multimode,
+          &note_quantizer_[i],
+          &segment_pool_,
+          i);
+      block_.cv[i] = 0.0f;
+      block_.slider[i] = 0.0f;
+      block_.cv_slider[i] = 0.0f;
+      block_.pot[i] = 0.0f;
+      block_.input_patched[i] = false;
+      std::fill(&block_.input[i][0], &block_.input[i][kBlockSize],
+                stmlib::GATE_FLAG_LOW);
+    }
+    SegmentGenerator::set_global_random_seed(seed);
+    block_.input_edges = 0;
+    std::fill(&no_gate_[0], &no_gate_[kBlockSize], stmlib::GATE_FLAG_LOW);
+    chain_state_.Init(&left_link_, &right_link_, settings_);
+    booted_ = true;
+  }
+
+  // Same as Process() in stages.cc, minus the UI.
+  void Process() {
+    chain_state_.Update(block_, &settings_, &segment_generator_[0], out_);
+    for (size_t channel = 0; channel < kNumChannels; ++channel) {
+      out_->changed_segments >>= 1;
+      bool patched = block_.input_patched[channel];
+      segment_generator_[channel].Process(
+          patched ? block_.input[channel] : no_gate_,
+          patched && (block_.input_edges & (1 << channel)),
+          out_,
+          kBlockSize);
+      output_[channel] = out_[kBlockSize - 1].value;
+    }
+  }
+
+  // The same slider position and pot are seen on the CV/slider input of
+  // the channel, with no CV.
+  inline void set_slider(size_t channel, float value) {
+    block_.slider[channel] = value;
+    block_.cv_slider[channel] = value;
+  }
+
+  inline void set_pot(size_t channel, float value) {
+    block_.pot[channel] = value;
+  }
+
+  // Patches a cable carrying a low gate.
+  inline void set_input_patched(size_t channel, bool patched) {
+    block_.input_patched[channel] = patched;
+  }
+
+  inline void set_segment_configuration(size_t channel, uint16_t config) {
+    settings_.mutable_state()->segment_configuration[channel] = config;
+  }
+
+  inline bool booted() const { return booted_; }
+  inline const ChainState& chain_state() const { return chain_state_; }
+  inline SegmentGenerator* segment_generator(size_t channel) {
+    return &segment_generator_[channel];
+  }
+  inline float output(size_t channel) const { return output_[channel]; }
+
+  inline SerialLink* left_link() { return &left_link_; }
+  inline SerialLink* right_link() { return &right_link_; }
+
+ private:
+  bool booted_;
+
+  Settings settings_;
+  ChainState chain_state_;
+  SerialLink left_link_;
+  SerialLink right_link_;
+
+  IOBuffer::Block block_;
+  stmlib::GateFlags no_gate_[kBlockSize];
+
+  stmlib::HysteresisQuantizer2 note_quantizer_[kNumChannels + kMaxNumSegments];
+  SegmentGenerator::Pool segment_pool_;
+  SegmentGenerator segment_generator_[kNumChannels];
+  SegmentGenerator::Output out_[kBlockSize];
+  float output_[kNumChannels];
+
+  DISALLOW_COPY_AND_ASSIGN(VirtualModule);
+};
+
+// Too large for the stack.
+class VirtualChain {
+ public:
+  VirtualChain() { }
+  ~VirtualChain() { }
+
+  // boot_delay, when not NULL, gives for each module the number of blocks
+  // between the start of the simulation and the moment it is powered on.
+  void Init(
+      size_t num_modules,
+      MultiMode multimode,
+      const VirtualLinkOptions& options,
+      uint32_t seed,
+      const size_t* boot_delay) {
+    num_modules_ = num_modules;
+    multimode_ = multimode;
+    num_blocks_ = 0;
+    for (size_t i = 0; i < num_modules_; ++i) {
+      module_[i].Reset();
+      boot_block_[i] = boot_delay ? boot_delay[i] : 0;
+      module_[i].left_link()->set_tx_wire(i == 0 ? NULL : &to_left_[i - 1]);
+      module_[i].right_link()->set_tx_wire(
+          i == num_modules_ - 1 ? NULL : &to_right_[i]);
+    }
+    for (size_t i = 0; i + 1 < num_modules_; ++i) {
+      to_right_[i].Init(module_[i + 1].left_link(), options, seed + 2 * i);
+      to_left_[i].Init(module_[i].right_link(), options, seed + 2 * i + 1);
+    }
+  }
+
+  // Runs all the modules for one block, then lets the bytes they have sent
+  // travel for the duration of a block.
+  void Process() {
+    for (size_t i = 0; i < num_modules_; ++i) {
+      if (num_blocks_ == boot_block_[i]) {
+        module_[i].Boot(multimode_, i);
+      }
+      if (module_[i].booted()) {
+        module_[i].Process();
+      }
+    }
+    ++num_blocks_;
+    double now = double(num_blocks_) * kVirtualBlockDuration;
+    for (size_t i = 0; i + 1 < num_modules_; ++i) {
+      to_right_[i].Advance(now);
+      to_left_[i].Advance(now);
+    }
+  }
+
+  inline size_t num_modules() const { return num_modules_; }
+  inline size_t num_blocks() const { return num_blocks_; }
+  inline VirtualModule* module(size_t i) { return &module_[i]; }
+
+  // True when every module knows its position in the chain. The discovery
+  // phase goes on for a while after that.
+  bool positions_known() const {
+    for (size_t i = 0; i < num_modules_; ++i) {
+      const ChainState& c = module_[i].chain_state();
+      if (!module_[i].booted() ||
+          c.index() != i ||
+          c.size() != num_modules_) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // True when every module has finished discovering its neighbors and knows
+  // its position in the chain.
+  bool discovered() const {
+    if (!positions_known()) {
+      return false;
+    }
+    for (size_t i = 0; i < num_modules_; ++i) {
+      if (module_[i].chain_state().status() != ChainState::CHAIN_READY) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  size_t bytes_sent() const {
+    size_t n = 0;
+    for (size_t i = 0; i + 1 < num_modules_; ++i) {
+      n += to_right_[i].bytes_sent() + to_left_[i].bytes_sent();
+    }
+    return n;
+  }
+
+  size_t bytes_lost() const {
+    size_t n = 0;
+    for (size_t i = 0; i + 1 < num_modules_; ++i) {
+      n += to_right_[i].bytes_lost() + to_left_[i].bytes_lost();
+    }
+    return n;
+  }
+
+ private:
+  size_t num_modules_;
+  MultiMode multimode_;
+  size_t num_blocks_;
+  size_t boot_block_[kMaxChainSize];
+
+  VirtualModule module_[kMaxChainSize];
+  // to_right_[i] connects module i to module i + 1, to_left_[i] module i + 1
+  // to module i.
+  VirtualWire to_right_[kMaxChainSize - 1];
+  VirtualWire to_left_[kMaxChainSize - 1];
+
+  DISALLOW_COPY_AND_ASSIGN(VirtualChain);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_TEST_VIRTUAL_CHAIN_H_
@@ -0,0 +1,229 @@
+// Copyright 2017 Emilie Gillet.
+//
+// Author: Emilie Gillet (emilie.o.gillet@gmail.com)
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// -----------------------------------------------------------------------------
+//
+// Minimal WAV reader (16-bit PCM or 32-bit float) and a streaming 32-bit
+// float WAV / raw float writer, for the offline renderer.
+
+#ifndef STAGES_TEST_WAV_FILE_H_
+#define STAGES_TEST_WAV_FILE_H_
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "stmlib/stmlib.h"
+
+namespace stages {
+
+class WavReader {
+ public:
+  WavReader() : num_channels_(0), sample_rate_(0) { }
+  ~WavReader() { }
+
+  // Loads the whole file in memory. Returns false if the file cannot be
+  // opened or uses an unsupported encoding.
+  bool Load(const char* file_name) {
+    FILE* fp = fopen(file_name, "rb");
+    if (!fp) {
+      return false;
+    }
+    bool success = Parse(fp);
+    fclose(fp);
+    return success;
+  }
+
+  inline size_t num_channels() const { return num_channels_; }
+  inline size_t num_frames() const {
+    return num_channels_ ? samples_.size() / num_channels_ : 0;
+  }
+  inline uint32_t sample_rate() const { return sample_rate_; }
+
+  // Reading past the end of the file, or from a non-existing channel,
+  // returns silence.
+  inline float sample(size_t frame, size_t channel) const {
+    if (channel >= num_channels_ || frame >= num_frames()) {
+      return 0.0f;
+    }
+    return samples_[frame * num_channels_ + channel];
+  }
+
+ private:
+  static uint32_t ReadWord(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+  }
+
+  static uint16_t ReadHalfWord(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+  }
+
+  bool Parse(FILE* fp) {
+    uint8_t header[12];
+    if (fread(header, 1, 12, fp) != 12 ||
+        memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+      return false;
+    }
+
+    uint16_t format = 0;
+    uint16_t bits_per_sample = 0;
+    while (true) {
+      uint8_t chunk_header[8];
+      if (fread(chunk_header, 1, 8, fp) != 8) {
+        return false;
+      }
+      uint32_t chunk_size = ReadWord(chunk_header + 4);
+      if (!memcmp(chunk_header, "fmt ", 4)) {
+        std::vector<uint8_t> fmt(chunk_size);
+        if (chunk_size < 16 || fread(&fmt[0], 1, chunk_size, fp) != chunk_size) {
+          return false;
+        }
+        format = ReadHalfWord(&fmt[0]);
+        num_channels_ = ReadHalfWord(&fmt[2]);
+        sample_rate_ = ReadWord(&fmt[4]);
+        bits_per_sample = ReadHalfWord(&fmt[14]);
+        if (format == 0xfffe && chunk_size >= 26) {
+          // WAVE_FORMAT_EXTENSIBLE: the actual format is in the sub-format GUID.
+          format = ReadHalfWord(&fmt[24]);
+        }
+      } else if (!memcmp(chunk_header, "data", 4)) {
+        break;
+      } else {
+        fseek(fp, chunk_size + (chunk_size & 1), SEEK_CUR);
+      }
+    }
+
+    if (!num_channels_) {
+      return false;
+    }
+
+    if (format == 1 && bits_per_sample == 16) {
+      int16_t buffer[1024];
+      size_t n;
+      while ((n = fread(buffer, sizeof(int16_t), 1024, fp)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+          samples_.push_back(static_cast<float>(buffer[i]) / 32768.0f);
+        }
+      }
+    } else if (format == 3 && bits_per_sample == 32) {
+      float buffer[1024];
+      size_t n;
+      while ((n = fread(buffer, sizeof(float), 1024, fp)) > 0) {
+        samples_.insert(samples_.end(), &buffer[0], &buffer[n]);
+      }
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  size_t num_channels_;
+  uint32_t sample_rate_;
+  std::vector<float> samples_;
+
+  DISALLOW_COPY_AND_ASSIGN(WavReader);
+};
+
+enum OutputFormat {
+  OUTPUT_FORMAT_WAV,
+  OUTPUT_FORMAT_RAW
+};
+
+// Unlike stmlib::WavWriter, this does not need to know the duration in
+// advance and writes 32-bit float samples, so that outputs can be compared
+// bit-for-bit against golden files.
+class FloatWavWriter {
+ public:
+  FloatWavWriter() : fp_(NULL), num_frames_(0) { }
+  ~FloatWavWriter() { Close(); }
+
+  bool Open(
+      const char* file_name,
+      OutputFormat format,
+      size_t num_channels,
+      uint32_t sample_rate) {
+    fp_ = fopen(file_name, "wb");
+    if (!fp_) {
+      return false;
+    }
+    format_ = format;
+    num_channels_ = num_channels;
+    sample_rate_ = sample_rate;
+    num_frames_ = 0;
+    if (format_ == OUTPUT_FORMAT_WAV) {
+      WriteHeader();
+    }
+    return true;
+  }
+
+  // Writes size frames of interleaved samples.
+  void Write(const float* samples, size_t size) {
+    fwrite(samples, sizeof(float), size * num_channels_, fp_);
+    num_frames_ += size;
+  }
+
+  void Close() {
+    if (!fp_) {
+      return;
+    }
+    if (format_ == OUTPUT_FORMAT_WAV) {
+      // Now that the size is known, patch the header.
+      fseek(fp_, 0, SEEK_SET);
+      WriteHeader();
+    }
+    fclose(fp_);
+    fp_ = NULL;
+  }
+
+ private:
+  void WriteWord(uint32_t w) {
+    uint8_t b[4] = { uint8_t(w), uint8_t(w >> 8), uint8_t(w >> 16),
+                     uint8_t(w >> 24) };
+    fwrite(b, 1, 4, fp_);
+  }
+
+  void WriteHalfWord(uint16_t w) {
+    uint8_t b[2] = { uint8_t(w), uint8_t(w >> 8) };
+    fwrite(b, 1, 2, fp_);
+  }
+
+  void WriteHeader() {
+    uint32_t data_size = num_frames_ * num_channels_ * sizeof(float);
+    fwrite("RIFF", 1, 4, fp_);
+    WriteWord(36 + data_size);
+    fwrite("WAVEfmt ", 1, 8, fp_);
+    WriteWord(16);
+    WriteHalfWord(3);  // IEEE float.
+    WriteHalfWord(num_channels_);
+    WriteWord(sample_rate_);
+    WriteWord(sample_rate_ * num_channels_ * sizeof(float));
+    WriteHalfWord(num_channels_ * sizeof(float));
+    WriteHalfWord(32);
+    fwrite("data", 1, 4, fp_);
+    WriteWord(data_size);
+  }
+
+  FILE* fp_;
+  OutputFormat format_;
+  size_t num_channels_;
+  uint32_t sample_rate_;
+  size_t num_frames_;
+
+  DISALLOW_COPY_AND_ASSIGN(FloatWavWriter);
+};
+
+}  // namespace stages
+
+#endif  // STAGES_TEST_WAV_FILE_H_
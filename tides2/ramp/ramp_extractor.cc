@@ -73,6 +73,7 @@ void RampExtractor::Reset() {
   p.on_duration = uint32_t(sample_rate_ * 0.25f);
   p.total_duration = uint32_t(sample_rate_ * 0.5f);
   p.pulse_width = 0.5f;
+  p.edge_offset = 0.0f;
 
   fill(&history_[0], &history_[kHistorySize], p);
   current_pulse_ = 0;
@@ -159,13 +160,14 @@ float RampExtractor::Process(
     Ratio ratio, 
     const GateFlags* gate_flags,
     float* ramp, 
-    size_t size) {
+    size_t size,
+    const float* edge_offsets) {
   if (smooth_audio_rate_tracking) {
     return ProcessInternal<true>(
-        force_integer_period, ratio, gate_flags, ramp, size);
+        force_integer_period, ratio, gate_flags, ramp, size, edge_offsets);
   } else {
     return ProcessInternal<false>(
-        force_integer_period, ratio, gate_flags, ramp, size);
+        force_integer_period, ratio, gate_flags, ramp, size, edge_offsets);
   }
 }
 
@@ -175,13 +177,17 @@ inline float RampExtractor::ProcessInternal(
     Ratio ratio, 
     const GateFlags* gate_flags,
     float* ramp, 
-    size_t size) {
+    size_t size,
+    const float* edge_offsets) {
   const size_t block_size = size;
   while (size--) {
     GateFlags flags = *gate_flags++;
     // We are done with the previous pulse.
     if (flags & GATE_FLAG_RISING) {
       Pulse& p = history_[current_pulse_];
+      const float edge_offset = edge_offsets
+          ? edge_offsets[block_size - 1 - size]
+          : 0.0f;
       
       const bool record_pulse = p.total_duration < reset_interval_;
       if (!record_pulse) {
@@ -191,7 +197,7 @@ inline float RampExtractor::ProcessInternal(
         max_train_phase_ = static_cast<float>(ratio.q);
         reset_interval_ = 4 * p.total_duration;
       } else {
-        float period = float(p.total_duration);
+        float period = float(p.total_duration) + p.edge_offset - edge_offset;
         if (smooth_audio_rate_tracking) {
           bool no_glide = f_ratio_ != ratio.ratio;
           f_ratio_ = ratio.ratio;
@@ -204,8 +210,8 @@ inline float RampExtractor::ProcessInternal(
             
             // Compensates for the latency in the acquisition of the
             // external signal.
-            float expected_phase = 2.0f * \
-                float(block_size) / period * f_ratio_;
+            float expected_phase = (2.0f * float(block_size) + edge_offset) \
+                / period * f_ratio_;
             while (expected_phase >= 1.0f) {
               expected_phase -= 1.0f;
             }
@@ -270,6 +276,7 @@ inline float RampExtractor::ProcessInternal(
       }
       history_[current_pulse_].on_duration = 0;
       history_[current_pulse_].total_duration = 0;
+      history_[current_pulse_].edge_offset = edge_offset;
     }
     
     // Update history buffer with total duration and on duration.
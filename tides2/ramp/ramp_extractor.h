@@ -55,19 +55,24 @@ class RampExtractor {
   void Reset();
   float ComputeAveragePulseWidth(float tolerance) const;
   
+  // When edge_offsets is not NULL, edge_offsets[i] tells how long before
+  // sample i (in fraction of a sample) the edge in gate_flags[i] occurred.
+  // The PLL then measures periods with sub-sample accuracy.
   float Process(
       bool smooth_audio_rate_tracking,
       bool force_integer_period,
       Ratio r,
       const stmlib::GateFlags* gate_flags,
       float* ramp,
-      size_t size);
+      size_t size,
+      const float* edge_offsets = NULL);
 
  private:
   struct Pulse {
     uint32_t on_duration;
     uint32_t total_duration;
     float pulse_width;
+    float edge_offset;
   };
 
   static const size_t kHistorySize = 16;
@@ -82,7 +87,8 @@ class RampExtractor {
         Ratio r,
         const stmlib::GateFlags* gate_flags,
         float* ramp,
-        size_t size);
+        size_t size,
+        const float* edge_offsets);
         
   size_t current_pulse_;
   Pulse history_[kHistorySize];